@@ -0,0 +1,101 @@
+#include <Python.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "batch.h"
+#include "counters.h"
+
+/**
+ * Batches
+ *
+ * Circles on many small native maps in one call.  Threads are started
+ * for each call, not pooled: each takes the next job off a shared counter
+ * and sweeps it with its own copy of the settings, whose callbacks read
+ * the job's map and write its lit cells straight from C.
+ */
+typedef struct {
+  const fov_settings_type *settings;
+  pyfov_batch_job *jobs;
+  size_t count;
+  bool timed;
+  /* The next job to take */
+  size_t next;
+} batch_queue;
+
+static bool
+batch_opaque(void *map, int x, int y) {
+  pyfov_batch_job *job = (pyfov_batch_job *)map;
+
+  ++job->probes;
+  return pyfov_map_opaque(job->map, x, y);
+}
+
+static void
+batch_apply(void *map, int x, int y, int dx, int dy, void *src) {
+  pyfov_batch_job *job = (pyfov_batch_job *)map;
+  unsigned char *cell;
+  int col, row;
+
+  pyfov_map_to_storage(job->map, x, y, &col, &row);
+  if (col < 0 || row < 0 || col >= job->map->width ||
+      row >= job->map->height)
+    return;
+  cell = &job->lit[(size_t)row * job->map->width + col];
+  if (!*cell) {
+    *cell = 1;
+    ++job->applied;
+  }
+}
+
+static void *
+batch_worker(void *arg) {
+  batch_queue *queue = (batch_queue *)arg;
+  fov_settings_type settings = *queue->settings;
+  pyfov_batch_job *job;
+  uint64_t start = 0;
+  size_t i;
+
+  // libfov caches circle heights in the settings, so each thread keeps
+  // its own
+  settings.heights = NULL;
+  settings.numheights = 0;
+  settings.opaque = batch_opaque;
+  settings.apply = batch_apply;
+
+  while ((i = __sync_fetch_and_add(&queue->next, 1)) < queue->count) {
+    job = &queue->jobs[i];
+    job->probes = 0;
+    job->applied = 0;
+    if (queue->timed)
+      start = pyfov_clock_ns();
+    job->result = pyfov_engine_circle(job->engine, &settings, job, NULL,
+                                      job->source_x, job->source_y,
+                                      job->radius, NULL);
+    job->ns = queue->timed ? pyfov_clock_ns() - start : 0;
+  }
+  fov_settings_free(&settings);
+  return NULL;
+}
+
+void
+pyfov_batch_run(const fov_settings_type *settings, pyfov_batch_job *jobs,
+                size_t count, int threads, bool timed) {
+  batch_queue queue = {settings, jobs, count, timed, 0};
+  pthread_t *ids = NULL;
+  int started = 0, i;
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if ((size_t)threads > count)
+    threads = (int)count;
+  if (threads > 1 && (ids = malloc((threads - 1) * sizeof(*ids))) != NULL) {
+    // Whatever threads can't be started, the rest pick up the work of
+    for (; started < threads - 1; ++started)
+      if (pthread_create(&ids[started], NULL, batch_worker, &queue) != 0)
+        break;
+  }
+  batch_worker(&queue);
+  for (i = 0; i < started; ++i)
+    pthread_join(ids[i], NULL);
+  free(ids);
+}
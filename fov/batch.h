@@ -0,0 +1,43 @@
+#ifndef PYFOV_BATCH_H
+#define PYFOV_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fov/fov.h"
+#include "engines.h"
+#include "map.h"
+
+/**
+ * One circle of a batch, swept on a native map
+ */
+typedef struct {
+  pyfov_Map *map;
+  /* Not ENGINE_AUTO or ENGINE_BITBOARD */
+  pyfov_engine_type engine;
+  /* The source in the engines' coordinates */
+  int source_x, source_y;
+  unsigned radius;
+  /* The map's width * height cells, set to 1 where lit */
+  unsigned char *lit;
+
+  /* Set by the run: opacity tests, cells lit, a PYFOV_ENGINE_* code and,
+   * if timed, the sweep's wall time */
+  unsigned long probes;
+  unsigned long applied;
+  int result;
+  uint64_t ns;
+} pyfov_batch_job;
+
+/**
+ * Sweeps every job with the shape, corner peeking and opaque apply of
+ * `settings`, spread over up to `threads` threads (the caller's included),
+ * or one per CPU if `threads` isn't positive.  The threads are started
+ * for the call and joined before it returns.
+ * No python objects are touched, so the GIL can be released around it,
+ * but the maps and masks must not change meanwhile.
+ */
+void pyfov_batch_run(const fov_settings_type *settings,
+                     pyfov_batch_job *jobs, size_t count, int threads,
+                     bool timed);
+
+#endif
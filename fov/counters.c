@@ -0,0 +1,148 @@
+#include <string.h>
+#include <time.h>
+#include "counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Hardware counters
+ *
+ * Each event is opened on its own rather than as a group, so one the CPU
+ * doesn't offer leaves the others running.  Only user space is counted,
+ * which perf_event_paranoid allows unprivileged processes by default.
+ */
+
+const char *const pyfov_counter_names[PYFOV_COUNTER_COUNT] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+};
+
+uint64_t
+pyfov_clock_ns(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#else
+  return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+#ifdef __linux__
+static int
+counters_open_event(pyfov_counter counter) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (counter) {
+  case PYFOV_COUNTER_CYCLES:
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PYFOV_COUNTER_INSTRUCTIONS:
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PYFOV_COUNTER_L1D_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D |
+      PERF_COUNT_HW_CACHE_OP_READ << 8 |
+      PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    break;
+  case PYFOV_COUNTER_LLC_MISSES:
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  default:
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  }
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void
+pyfov_counters_open(pyfov_counters *counters, bool hardware) {
+  int i;
+
+  for (i = 0; i < PYFOV_COUNTER_COUNT; ++i) {
+    counters->fds[i] = -1;
+#ifdef __linux__
+    if (hardware)
+      counters->fds[i] = counters_open_event((pyfov_counter)i);
+#endif
+  }
+  counters->elapsed = 0;
+  counters->resumed = 0;
+}
+
+void
+pyfov_counters_resume(pyfov_counters *counters) {
+#ifdef __linux__
+  int i;
+
+  for (i = 0; i < PYFOV_COUNTER_COUNT; ++i)
+    if (counters->fds[i] >= 0)
+      ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  counters->resumed = pyfov_clock_ns();
+}
+
+void
+pyfov_counters_pause(pyfov_counters *counters) {
+#ifdef __linux__
+  int i;
+#endif
+
+  counters->elapsed += pyfov_clock_ns() - counters->resumed;
+#ifdef __linux__
+  for (i = 0; i < PYFOV_COUNTER_COUNT; ++i)
+    if (counters->fds[i] >= 0)
+      ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+bool
+pyfov_counters_read(pyfov_counters *counters, pyfov_counter counter,
+                    double *value) {
+#ifdef __linux__
+  // value, time enabled, time running
+  uint64_t data[3];
+
+  if (counters->fds[counter] < 0 ||
+      read(counters->fds[counter], data, sizeof(data)) != sizeof(data) ||
+      data[2] == 0)
+    return false;
+  *value = (double)data[0] * ((double)data[1] / (double)data[2]);
+  return true;
+#else
+  return false;
+#endif
+}
+
+double
+pyfov_counters_seconds(pyfov_counters *counters) {
+  return counters->elapsed / 1e9;
+}
+
+void
+pyfov_counters_close(pyfov_counters *counters) {
+#ifdef __linux__
+  int i;
+
+  for (i = 0; i < PYFOV_COUNTER_COUNT; ++i)
+    if (counters->fds[i] >= 0)
+      close(counters->fds[i]);
+#endif
+  pyfov_counters_open(counters, false);
+}
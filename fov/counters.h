@@ -0,0 +1,68 @@
+#ifndef PYFOV_COUNTERS_H
+#define PYFOV_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Hardware events counted around benchmark sweeps
+ */
+typedef enum {
+  PYFOV_COUNTER_CYCLES,
+  PYFOV_COUNTER_INSTRUCTIONS,
+  /* L1 data cache read misses */
+  PYFOV_COUNTER_L1D_MISSES,
+  /* Last level cache misses */
+  PYFOV_COUNTER_LLC_MISSES,
+  PYFOV_COUNTER_BRANCH_MISSES,
+
+  PYFOV_COUNTER_COUNT
+} pyfov_counter;
+
+/**
+ * The names benchmark results report the counters under
+ */
+extern const char *const pyfov_counter_names[PYFOV_COUNTER_COUNT];
+
+/**
+ * A set of counters and a clock that only run between resume and pause,
+ * so the work done between measured sweeps isn't counted.  The hardware
+ * counters come from perf_event_open on Linux; elsewhere, or where the
+ * kernel or CPU doesn't offer an event, that counter is unavailable.
+ */
+typedef struct {
+  int fds[PYFOV_COUNTER_COUNT];
+  /* Nanoseconds counted so far, and when the clock was last resumed */
+  uint64_t elapsed;
+  uint64_t resumed;
+} pyfov_counters;
+
+/**
+ * Nanoseconds on a monotonic clock
+ */
+uint64_t pyfov_clock_ns(void);
+
+/**
+ * Opens the counters, stopped at zero.  Without `hardware` only the clock
+ * runs.
+ */
+void pyfov_counters_open(pyfov_counters *counters, bool hardware);
+
+void pyfov_counters_resume(pyfov_counters *counters);
+void pyfov_counters_pause(pyfov_counters *counters);
+
+/**
+ * Reads a counter into `value`, scaled up if the kernel had to share the
+ * hardware with other events.  Returns false if it isn't available.
+ */
+bool pyfov_counters_read(pyfov_counters *counters, pyfov_counter counter,
+                         double *value);
+
+/**
+ * Seconds the clock has run
+ */
+double pyfov_counters_seconds(pyfov_counters *counters);
+
+void pyfov_counters_close(pyfov_counters *counters);
+
+#endif
@@ -0,0 +1,168 @@
+#include <Python.h>
+#include "dictmap.h"
+
+/**
+ * fov.DictMap
+ *
+ * Example Usage:
+ *
+ * terrain = {(0, 0): '.', (1, 0): '#'}
+ * m = fov.DictMap(terrain, opaque=frozenset('#'))
+ * s.circle(m, None, 0, 0, 4)
+ */
+
+PyTypeObject pyfov_DictMapType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+static int
+pyfov_DictMap_init(pyfov_DictMap *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"terrain", "opaque", "missing", NULL};
+  PyObject *terrain, *opaque = Py_None;
+  PyObject *tmp;
+  int missing = 1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|Oi", kwlist,
+                                   &PyDict_Type, &terrain, &opaque,
+                                   &missing)) {
+    return -1;
+  }
+  if (opaque != Py_None && !PySequence_Check(opaque) &&
+      !PyAnySet_Check(opaque) && !PyDict_Check(opaque)) {
+    PyErr_SetString(PyExc_TypeError, "opaque must be a container or None");
+    return -1;
+  }
+
+  tmp = self->terrain;
+  Py_INCREF(terrain);
+  self->terrain = terrain;
+  Py_XDECREF(tmp);
+
+  tmp = self->opaque;
+  Py_INCREF(opaque);
+  self->opaque = opaque;
+  Py_XDECREF(tmp);
+
+  self->missing = missing;
+  return 0;
+}
+
+static void
+pyfov_DictMap_dealloc(pyfov_DictMap *self)
+{
+  Py_XDECREF(self->terrain);
+  Py_XDECREF(self->opaque);
+  Py_XDECREF(self->key);
+  self->ob_type->tp_free(self);
+}
+
+/**
+ * Returns the (x, y) key tuple to probe the terrain with.  The cached
+ * tuple is reused unless something else still holds on to it.
+ */
+static PyObject *
+_pyfov_DictMap_key(pyfov_DictMap *self, int x, int y) {
+  PyObject *px, *py;
+
+  if (self->key == NULL || Py_REFCNT(self->key) != 1) {
+    Py_XDECREF(self->key);
+    self->key = PyTuple_New(2);
+    if (self->key == NULL)
+      return NULL;
+  }
+
+  px = PyInt_FromLong(x);
+  py = PyInt_FromLong(y);
+  if (px == NULL || py == NULL) {
+    Py_XDECREF(px);
+    Py_XDECREF(py);
+    return NULL;
+  }
+
+  // PyTuple_SET_ITEM doesn't release the previous probe's items
+  Py_XDECREF(PyTuple_GET_ITEM(self->key, 0));
+  Py_XDECREF(PyTuple_GET_ITEM(self->key, 1));
+  PyTuple_SET_ITEM(self->key, 0, px);
+  PyTuple_SET_ITEM(self->key, 1, py);
+  return self->key;
+}
+
+int
+pyfov_dictmap_opaque(pyfov_DictMap *map, int x, int y) {
+  PyObject *key, *tile;
+  int result;
+
+  if (map->terrain == NULL) {
+    PyErr_SetString(PyExc_ValueError, "DictMap was not initialized");
+    return -1;
+  }
+
+  key = _pyfov_DictMap_key(map, x, y);
+  if (key == NULL)
+    return -1;
+
+  tile = PyDict_GetItem(map->terrain, key);
+  if (tile == NULL)
+    return map->missing;
+
+  // The opacity test may run python code that drops the tile from the dict
+  Py_INCREF(tile);
+  if (map->opaque == Py_None)
+    result = PyObject_IsTrue(tile);
+  else if (PyAnySet_Check(map->opaque))
+    result = PySet_Contains(map->opaque, tile);
+  else if (PyDict_Check(map->opaque))
+    result = PyDict_Contains(map->opaque, tile);
+  else
+    result = PySequence_Contains(map->opaque, tile);
+  Py_DECREF(tile);
+
+  return result;
+}
+
+/**
+ * Property implementations
+ */
+static PyObject *
+pyfov_DictMap_get_terrain(pyfov_DictMap *self, void *data) {
+  PyObject *terrain = self->terrain != NULL ? self->terrain : Py_None;
+
+  Py_INCREF(terrain);
+  return terrain;
+}
+
+static PyObject *
+pyfov_DictMap_get_opaque(pyfov_DictMap *self, void *data) {
+  PyObject *opaque = self->opaque != NULL ? self->opaque : Py_None;
+
+  Py_INCREF(opaque);
+  return opaque;
+}
+
+static PyObject *
+pyfov_DictMap_get_missing(pyfov_DictMap *self, void *data) {
+  return PyBool_FromLong(self->missing);
+}
+
+static PyGetSetDef pyfov_DictMap_properties[] = {
+  {"terrain", (getter)pyfov_DictMap_get_terrain, NULL, "", NULL},
+  {"opaque", (getter)pyfov_DictMap_get_opaque, NULL, "", NULL},
+  {"missing", (getter)pyfov_DictMap_get_missing, NULL, "", NULL},
+  /* Sentinel */
+  {NULL, NULL, NULL, NULL, NULL},
+};
+
+void
+init_fov_dictmap_type(PyTypeObject *t) {
+  t->tp_name = "fov.DictMap";
+  t->tp_basicsize = sizeof(pyfov_DictMap);
+  t->tp_flags = Py_TPFLAGS_DEFAULT;
+  t->tp_doc = "Reads a dict of (x, y) -> tile natively";
+
+  t->tp_init = (initproc)pyfov_DictMap_init;
+  t->tp_dealloc = (destructor)pyfov_DictMap_dealloc;
+
+  // Use a generic new method (inits members to 0/NULL)
+  t->tp_new = PyType_GenericNew;
+  t->tp_getset = pyfov_DictMap_properties;
+}
@@ -0,0 +1,39 @@
+#ifndef PYFOV_DICTMAP_H
+#define PYFOV_DICTMAP_H
+
+#include <Python.h>
+#include <stdbool.h>
+
+/**
+ * Wraps a dict of (x, y) -> tile so circle and beam can probe it without
+ * calling back into python.  Tiles found in `opaque` (or truthy tiles, if
+ * `opaque` is None) are opaque, and so are coordinates missing from the
+ * dict unless `missing` says otherwise.
+ */
+typedef struct {
+  PyObject_HEAD
+
+  PyObject *terrain;
+  PyObject *opaque;
+  bool missing;
+
+  /**
+   * The (x, y) tuple probes look up.  It is refilled in place while we
+   * hold the only reference to it, so most probes allocate no tuple.
+   */
+  PyObject *key;
+} pyfov_DictMap;
+
+extern PyTypeObject pyfov_DictMapType;
+
+#define pyfov_DictMap_Check(op) PyObject_TypeCheck(op, &pyfov_DictMapType)
+
+void init_fov_dictmap_type(PyTypeObject *t);
+
+/**
+ * Returns 1 if (x, y) is opaque, 0 if it isn't, or -1 with an exception
+ * set.
+ */
+int pyfov_dictmap_opaque(pyfov_DictMap *map, int x, int y);
+
+#endif
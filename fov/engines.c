@@ -0,0 +1,1727 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engines.h"
+#include "counters.h"
+
+/**
+ * Alternative FOV engines.
+ *
+ * All engines follow libfov's conventions: the source cell itself is never
+ * lit, opaque cells are lit according to settings->opaque_apply, and the
+ * lighting callback receives the offset of the cell from the source.
+ * corner_peek is ignored, as it is by libfov.
+ */
+
+/**
+ * Per-call state shared by all of the engines.
+ */
+typedef struct {
+  fov_settings_type *settings;
+  void *map;
+  void *source;
+  int source_x;
+  int source_y;
+  unsigned radius;
+
+  /* Only cells inside this cone are lit when beam is set */
+  bool beam;
+  float beam_x;
+  float beam_y;
+  float beam_cos;
+
+  /* Use diamond shaped walls in the shadowcaster */
+  bool diamond;
+
+  /* Cells are axial hex coordinates */
+  bool hex;
+
+  /**
+   * (2 * radius + 1)^2 flags for engines whose scan areas overlap, so that
+   * no cell gets lit twice.  NULL for engines that don't need it.
+   */
+  unsigned char *seen;
+
+  /* See pyfov_engine_extras */
+  float *coverage;
+  pyfov_engine_stats *stats;
+
+  /**
+   * With stats, radius + 2 counts of the intervals each row of the current
+   * section has opened so far
+   */
+  unsigned *intervals;
+} engine_data;
+
+/**
+ * Index of the offset (dx, dy) in the per-cell scratch arrays.
+ */
+static size_t
+engine_index(engine_data *data, int dx, int dy) {
+  size_t side = 2 * data->radius + 1;
+  return (size_t)(dy + (int)data->radius) * side + (dx + (int)data->radius);
+}
+
+static bool
+engine_in_beam(engine_data *data, int dx, int dy) {
+  float fx = (float)dx;
+  float fy = (float)dy;
+  float len;
+
+  if (!data->beam)
+    return true;
+  if (data->hex) {
+    fx = dx + dy * 0.5f;
+    fy = dy * 0.8660254f;
+  }
+  len = sqrtf(fx * fx + fy * fy);
+  return fx * data->beam_x + fy * data->beam_y >= data->beam_cos * len;
+}
+
+static void
+engine_apply(engine_data *data, int x, int y) {
+  int dx = x - data->source_x;
+  int dy = y - data->source_y;
+  size_t i;
+
+  if (data->seen != NULL) {
+    i = engine_index(data, dx, dy);
+    if (data->seen[i])
+      return;
+    data->seen[i] = 1;
+  }
+
+  if (!engine_in_beam(data, dx, dy))
+    return;
+
+  data->settings->apply(data->map, x, y, dx, dy, data->source);
+}
+
+/**
+ * Adds `fraction` of the cell at (x, y) to the visible coverage.
+ */
+static void
+engine_cover(engine_data *data, int x, int y, float fraction) {
+  int dx = x - data->source_x;
+  int dy = y - data->source_y;
+
+  if (engine_in_beam(data, dx, dy))
+    data->coverage[engine_index(data, dx, dy)] += fraction;
+}
+
+/**
+ * Explain mode.  Each octant (or quadrant) of a sweep is a section, timed
+ * on its own.
+ */
+static uint64_t
+engine_section_begin(engine_data *data) {
+  if (data->stats == NULL)
+    return 0;
+  if (data->intervals != NULL)
+    memset(data->intervals, 0, (data->radius + 2) * sizeof(unsigned));
+  return pyfov_clock_ns();
+}
+
+static void
+engine_section_end(engine_data *data, int section, uint64_t start) {
+  if (data->stats == NULL)
+    return;
+  data->stats->section_ns[section] = pyfov_clock_ns() - start;
+  data->stats->sections = section + 1;
+}
+
+/**
+ * Notes that `count` intervals are open at once
+ */
+static void
+engine_note_intervals(engine_data *data, unsigned count) {
+  if (data->stats != NULL && (int)count > data->stats->peak_intervals)
+    data->stats->peak_intervals = (int)count;
+}
+
+/**
+ * Counts one more interval opened in row `row` of the current section
+ */
+static void
+engine_count_interval(engine_data *data, unsigned row) {
+  if (data->intervals != NULL)
+    engine_note_intervals(data, ++data->intervals[row]);
+}
+
+/**
+ * Shapes
+ */
+unsigned
+pyfov_shape_height(fov_shape_type shape, unsigned dx, unsigned radius) {
+  if (dx > radius)
+    return 0;
+
+  switch (shape) {
+  case FOV_SHAPE_CIRCLE_PRECALCULATE:
+  case FOV_SHAPE_CIRCLE:
+    return (unsigned)sqrtf((float)(radius * radius - dx * dx));
+  case FOV_SHAPE_OCTAGON:
+    return (radius - dx) << 1;
+  default:
+    return radius;
+  }
+}
+
+bool
+pyfov_in_shape(fov_shape_type shape, int dx, int dy, unsigned radius) {
+  unsigned major = (unsigned)abs(dx);
+  unsigned minor = (unsigned)abs(dy);
+  unsigned tmp;
+
+  if (major < minor) {
+    tmp = major;
+    major = minor;
+    minor = tmp;
+  }
+  if (major > radius)
+    return false;
+  return minor <= pyfov_shape_height(shape, major, radius);
+}
+
+unsigned long
+pyfov_shape_distance(fov_shape_type shape, int dx, int dy) {
+  unsigned long major = (unsigned long)abs(dx);
+  unsigned long minor = (unsigned long)abs(dy);
+  unsigned long tmp;
+
+  if (major < minor) {
+    tmp = major;
+    major = minor;
+    minor = tmp;
+  }
+  switch (shape) {
+  case FOV_SHAPE_CIRCLE_PRECALCULATE:
+  case FOV_SHAPE_CIRCLE:
+    return major * major + minor * minor;
+  case FOV_SHAPE_OCTAGON:
+    return 2 * major + minor;
+  default:
+    return major;
+  }
+}
+
+/**
+ * Recursive shadowcasting
+ *
+ * This is libfov's octant scan with the octant macros unrolled into a
+ * transform table.  The octants are visited in the same order and use the
+ * same single precision slope arithmetic, so it lights the same cells in
+ * the same order as fov_circle.
+ */
+static const struct {
+  int xx, xy, yx, yy;
+  bool apply_edge;
+  bool apply_diag;
+} octants[8] = {
+  { 1,  0,  0,  1, true,  true},
+  { 0,  1,  1,  0, true,  false},
+  { 1,  0,  0, -1, false, true},
+  { 0, -1,  1,  0, false, false},
+  {-1,  0,  0,  1, true,  true},
+  { 0,  1, -1,  0, true,  false},
+  {-1,  0,  0, -1, false, true},
+  { 0, -1, -1,  0, false, false},
+};
+
+static float
+betweenf(float x, float a, float b) {
+  if (x - a < FLT_EPSILON)
+    return a;
+  else if (b - x < FLT_EPSILON)
+    return b;
+  return x;
+}
+
+/**
+ * Slope of the lowest point of the wall at (dx, dy) that blocks light.
+ */
+static float
+wall_low_slope(engine_data *data, int dx, int dy) {
+  if (data->diamond)
+    return ((float)dy - 0.5f) / (float)dx;
+  return ((float)dy - 0.5f) / ((float)dx + 0.5f);
+}
+
+/**
+ * Slope of the highest point of the wall at (dx, dy) that blocks light.
+ */
+static float
+wall_high_slope(engine_data *data, int dx, int dy) {
+  float tip, side;
+
+  if (data->diamond) {
+    tip = ((float)dy + 0.5f) / (float)dx;
+    side = (float)dy / ((float)dx - 0.5f);
+    return tip > side ? tip : side;
+  }
+  return ((float)dy + 0.5f) / ((float)dx - 0.5f);
+}
+
+/**
+ * Covers the cells dy0..dy1 of row dx with the interval
+ * [start_slope, end_slope].  Every cell owns the slopes through its centre
+ * line, so the rows of the octants that share an edge or a diagonal each
+ * contribute their half of it.
+ */
+static void
+shadowcast_cover(engine_data *data, int octant, int dx, int dy0, int dy1,
+                 float start_slope, float end_slope) {
+  int dy;
+  float low, high;
+
+  for (dy = dy0; dy <= dy1; ++dy) {
+    low = ((float)dy - 0.5f) / (float)dx;
+    high = ((float)dy + 0.5f) / (float)dx;
+    if (low < start_slope)
+      low = start_slope;
+    if (high > end_slope)
+      high = end_slope;
+    if (high > low)
+      engine_cover(data,
+        data->source_x + dx * octants[octant].xx + dy * octants[octant].xy,
+        data->source_y + dx * octants[octant].yx + dy * octants[octant].yy,
+        (high - low) * (float)dx);
+  }
+}
+
+static void
+shadowcast_octant(engine_data *data, int octant, int dx,
+                  float start_slope, float end_slope) {
+  fov_settings_type *settings = data->settings;
+  bool apply_edge = octants[octant].apply_edge;
+  int x, y, dy, dy0, dy1, last;
+  unsigned h;
+  int prev_blocked = -1;
+  float end_slope_next;
+
+  if ((unsigned)dx > data->radius)
+    return;
+
+  dy0 = (int)(0.5f + ((float)dx) * start_slope);
+  dy1 = (int)(0.5f + ((float)dx) * end_slope);
+  last = dy1;
+
+  // Diagonals are only done on every second octant, so they don't get
+  // lit twice.
+  if (!octants[octant].apply_diag && dy1 == dx)
+    --dy1;
+
+  h = pyfov_shape_height(settings->shape, dx, data->radius);
+  if ((unsigned)dy1 > h) {
+    if (h == 0)
+      return;
+    dy1 = (int)h;
+  }
+
+  engine_count_interval(data, (unsigned)dx);
+
+  if (data->coverage != NULL)
+    shadowcast_cover(data, octant, dx, dy0,
+                     (unsigned)last > h ? (int)h : last,
+                     start_slope, end_slope);
+
+  for (dy = dy0; dy <= dy1; ++dy) {
+    x = data->source_x + dx * octants[octant].xx + dy * octants[octant].xy;
+    y = data->source_y + dx * octants[octant].yx + dy * octants[octant].yy;
+
+    if (settings->opaque(data->map, x, y)) {
+      if (settings->opaque_apply == FOV_OPAQUE_APPLY && (apply_edge || dy > 0))
+        engine_apply(data, x, y);
+      if (prev_blocked == 0) {
+        end_slope_next = betweenf(wall_low_slope(data, dx, dy),
+                                  start_slope, end_slope);
+        shadowcast_octant(data, octant, dx + 1, start_slope, end_slope_next);
+      }
+      prev_blocked = 1;
+    } else {
+      if (apply_edge || dy > 0)
+        engine_apply(data, x, y);
+      if (prev_blocked == 1)
+        start_slope = betweenf(wall_high_slope(data, dx, dy - 1),
+                               start_slope, end_slope);
+      prev_blocked = 0;
+    }
+  }
+
+  if (prev_blocked == 0)
+    shadowcast_octant(data, octant, dx + 1, start_slope, end_slope);
+}
+
+static void
+shadowcast(engine_data *data) {
+  uint64_t start;
+  int octant;
+
+  for (octant = 0; octant < 8; ++octant) {
+    start = engine_section_begin(data);
+    shadowcast_octant(data, octant, 1, 0.0f, 1.0f);
+    engine_section_end(data, octant, start);
+  }
+}
+
+/**
+ * Table driven shadowcasting
+ *
+ * shadowcast_octant reaches every row with slopes that are 0, 1, or the
+ * edge of a wall's shadow: (2dy - 1) / (2dx - 1) above the wall at
+ * (dx, dy - 1) and (2dy - 1) / (2dx + 1) below the wall at (dx, dy).  These
+ * are all odd over odd fractions no greater than 1, so the scan below
+ * carries indices into a table of them instead, and reads each slope's
+ * first and last cell of a row from a second table of
+ * (int)(0.5f + dx * slope), rounded in single precision exactly as
+ * shadowcast_octant rounds it.  It lights the same cells as libfov.
+ *
+ * The tables cover radii up to TABLE_MAX_RADIUS and every shape.  They are
+ * filled once at import and only read afterwards, so batch threads share
+ * them without a lock.
+ */
+#define TABLE_MAX_RADIUS 64
+/* Slope 0, then (2n - 1) / (2m - 1) for 1 <= n <= m <= TABLE_MAX_RADIUS + 1 */
+#define TABLE_SLOPES (1 + (TABLE_MAX_RADIUS + 1) * (TABLE_MAX_RADIUS + 2) / 2)
+
+static float table_slopes[TABLE_SLOPES];
+static unsigned char table_rows[TABLE_SLOPES][TABLE_MAX_RADIUS + 1];
+
+/**
+ * Index of the slope (2n - 1) / (2m - 1)
+ */
+static unsigned
+table_slope(int n, int m) {
+  return 1 + (unsigned)(m * (m - 1) / 2 + n - 1);
+}
+
+void
+pyfov_table_init(void) {
+  unsigned i;
+  int n, m, dx;
+
+  for (m = 1; m <= TABLE_MAX_RADIUS + 1; ++m) {
+    for (n = 1; n <= m; ++n) {
+      i = table_slope(n, m);
+      table_slopes[i] = ((float)n - 0.5f) / ((float)m - 0.5f);
+      for (dx = 0; dx <= TABLE_MAX_RADIUS; ++dx)
+        table_rows[i][dx] = (unsigned char)(int)
+          (0.5f + ((float)dx) * table_slopes[i]);
+    }
+  }
+}
+
+/**
+ * betweenf over slope indices
+ */
+static unsigned
+table_between(unsigned x, unsigned a, unsigned b) {
+  if (table_slopes[x] - table_slopes[a] < FLT_EPSILON)
+    return a;
+  else if (table_slopes[b] - table_slopes[x] < FLT_EPSILON)
+    return b;
+  return x;
+}
+
+static void
+table_octant(engine_data *data, const unsigned *heights, int octant, int dx,
+             unsigned start, unsigned end) {
+  fov_settings_type *settings = data->settings;
+  bool apply_edge = octants[octant].apply_edge;
+  int x, y, dy, dy0, dy1;
+  int prev_blocked = -1;
+
+  if ((unsigned)dx > data->radius)
+    return;
+
+  dy0 = table_rows[start][dx];
+  dy1 = table_rows[end][dx];
+
+  if (!octants[octant].apply_diag && dy1 == dx)
+    --dy1;
+
+  if ((unsigned)dy1 > heights[dx]) {
+    if (heights[dx] == 0)
+      return;
+    dy1 = (int)heights[dx];
+  }
+
+  engine_count_interval(data, (unsigned)dx);
+
+  for (dy = dy0; dy <= dy1; ++dy) {
+    x = data->source_x + dx * octants[octant].xx + dy * octants[octant].xy;
+    y = data->source_y + dx * octants[octant].yx + dy * octants[octant].yy;
+
+    if (settings->opaque(data->map, x, y)) {
+      if (settings->opaque_apply == FOV_OPAQUE_APPLY && (apply_edge || dy > 0))
+        engine_apply(data, x, y);
+      if (prev_blocked == 0)
+        table_octant(data, heights, octant, dx + 1, start,
+                     table_between(table_slope(dy, dx + 1), start, end));
+      prev_blocked = 1;
+    } else {
+      if (apply_edge || dy > 0)
+        engine_apply(data, x, y);
+      if (prev_blocked == 1)
+        start = table_between(table_slope(dy, dx), start, end);
+      prev_blocked = 0;
+    }
+  }
+
+  if (prev_blocked == 0)
+    table_octant(data, heights, octant, dx + 1, start, end);
+}
+
+static void
+table(engine_data *data) {
+  unsigned heights[TABLE_MAX_RADIUS + 1];
+  uint64_t start;
+  unsigned dx;
+  int octant;
+
+  for (dx = 0; dx <= data->radius; ++dx)
+    heights[dx] = pyfov_shape_height(data->settings->shape, dx, data->radius);
+
+  for (octant = 0; octant < 8; ++octant) {
+    start = engine_section_begin(data);
+    table_octant(data, heights, octant, 1, 0, table_slope(1, 1));
+    engine_section_end(data, octant, start);
+  }
+}
+
+/**
+ * Incremental sweeps
+ *
+ * The octant scan above with its recursion turned into a queue of pending
+ * intervals, so that a sweep can stop after any cell and carry on later.
+ * Intervals are queued where the recursion would start them, with the
+ * slopes it would pass, so the same cells are lit; and since every
+ * interval of column dx is queued before any of column dx + 1, the cells
+ * come out ring by ring.
+ *
+ * Rewindable sweeps also save the queue as each column starts.  Columns
+ * no higher than they are long are scanned alike for any radius that
+ * reaches them, so a sweep can be rewound to the first column a new
+ * radius clips (or the old one did) and carried on from there.
+ */
+typedef struct {
+  int octant;
+  int dx;
+  float start_slope;
+  float end_slope;
+} iter_interval;
+
+typedef struct {
+  size_t at;
+  size_t count;
+  unsigned long returned;
+} iter_column;
+
+struct pyfov_sweep_iter {
+  fov_settings_type settings;
+  engine_data data;
+
+  /* Pending intervals queue[head..tail) */
+  iter_interval *queue;
+  size_t head, tail, size;
+
+  /* The interval being scanned, and where the scan is in it */
+  bool scanning;
+  iter_interval current;
+  int dy, dy1;
+  int prev_blocked;
+
+  /* Cells returned so far */
+  unsigned long returned;
+
+  /* For rewindable sweeps, the queue as each column 1..last_column
+   * started: column c's intervals are saved[columns[c].at..] */
+  bool rewindable;
+  iter_interval *saved;
+  size_t saved_len, saved_size;
+  iter_column *columns;
+  unsigned last_column, columns_size;
+};
+
+static int
+iter_push(pyfov_sweep_iter *iter, int octant, int dx,
+          float start_slope, float end_slope) {
+  iter_interval *queue;
+
+  if (iter->tail == iter->size) {
+    if (iter->head > 0) {
+      memmove(iter->queue, &iter->queue[iter->head],
+              (iter->tail - iter->head) * sizeof(iter_interval));
+      iter->tail -= iter->head;
+      iter->head = 0;
+    } else {
+      queue = realloc(iter->queue, 2 * iter->size * sizeof(iter_interval));
+      if (queue == NULL)
+        return PYFOV_ENGINE_NOMEM;
+      iter->queue = queue;
+      iter->size *= 2;
+    }
+  }
+
+  iter->queue[iter->tail].octant = octant;
+  iter->queue[iter->tail].dx = dx;
+  iter->queue[iter->tail].start_slope = start_slope;
+  iter->queue[iter->tail].end_slope = end_slope;
+  ++iter->tail;
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * Works out the rows of the current interval as shadowcast_octant does.
+ * Returns false if it has none.
+ */
+static bool
+iter_begin(pyfov_sweep_iter *iter) {
+  iter_interval *cur = &iter->current;
+  unsigned h;
+
+  iter->dy = (int)(0.5f + ((float)cur->dx) * cur->start_slope);
+  iter->dy1 = (int)(0.5f + ((float)cur->dx) * cur->end_slope);
+  if (!octants[cur->octant].apply_diag && iter->dy1 == cur->dx)
+    --iter->dy1;
+
+  h = pyfov_shape_height(iter->settings.shape, cur->dx, iter->data.radius);
+  if ((unsigned)iter->dy1 > h) {
+    if (h == 0)
+      return false;
+    iter->dy1 = (int)h;
+  }
+  iter->prev_blocked = -1;
+  return true;
+}
+
+/**
+ * Saves the queue if it holds a column not saved yet.  Returns one of the
+ * PYFOV_ENGINE_* codes.
+ */
+static int
+iter_checkpoint(pyfov_sweep_iter *iter) {
+  size_t count = iter->tail - iter->head, size;
+  unsigned c = (unsigned)iter->queue[iter->head].dx;
+  iter_interval *saved;
+  iter_column *columns;
+
+  if (c <= iter->last_column)
+    return PYFOV_ENGINE_OK;
+
+  if (c >= iter->columns_size) {
+    size = 2 * (size_t)c;
+    columns = realloc(iter->columns, size * sizeof(iter_column));
+    if (columns == NULL)
+      return PYFOV_ENGINE_NOMEM;
+    iter->columns = columns;
+    iter->columns_size = (unsigned)size;
+  }
+  if (iter->saved_len + count > iter->saved_size) {
+    size = 2 * (iter->saved_len + count);
+    saved = realloc(iter->saved, size * sizeof(iter_interval));
+    if (saved == NULL)
+      return PYFOV_ENGINE_NOMEM;
+    iter->saved = saved;
+    iter->saved_size = size;
+  }
+
+  memcpy(&iter->saved[iter->saved_len], &iter->queue[iter->head],
+         count * sizeof(iter_interval));
+  iter->columns[c].at = iter->saved_len;
+  iter->columns[c].count = count;
+  iter->columns[c].returned = iter->returned;
+  iter->saved_len += count;
+  iter->last_column = c;
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * The first column `shape` clips at `radius`: the first shorter than its
+ * distance from the source, or radius + 1 if none is.
+ */
+static unsigned
+iter_first_clipped(fov_shape_type shape, unsigned radius) {
+  unsigned dx;
+
+  for (dx = 1; dx <= radius; ++dx)
+    if (pyfov_shape_height(shape, dx, radius) < dx)
+      break;
+  return dx;
+}
+
+pyfov_sweep_iter *
+pyfov_sweep_iter_new(const fov_settings_type *settings, void *map,
+                     int source_x, int source_y, unsigned radius,
+                     bool rewindable) {
+  pyfov_sweep_iter *iter = calloc(1, sizeof(pyfov_sweep_iter));
+  int octant;
+
+  if (iter == NULL)
+    return NULL;
+  iter->settings = *settings;
+  iter->data.settings = &iter->settings;
+  iter->data.map = map;
+  iter->data.source_x = source_x;
+  iter->data.source_y = source_y;
+  iter->data.radius = radius;
+  iter->rewindable = rewindable;
+
+  iter->size = 16;
+  if ((iter->queue = malloc(iter->size * sizeof(iter_interval))) == NULL) {
+    free(iter);
+    return NULL;
+  }
+  for (octant = 0; octant < 8; ++octant)
+    iter_push(iter, octant, 1, 0.0f, 1.0f);
+  return iter;
+}
+
+int
+pyfov_sweep_iter_next(pyfov_sweep_iter *iter, int *x, int *y) {
+  fov_settings_type *settings = &iter->settings;
+  iter_interval *cur = &iter->current;
+  int dx, dy, cx, cy;
+  bool apply_edge, lit;
+
+  for (;;) {
+    if (!iter->scanning) {
+      if (iter->head == iter->tail)
+        return 0;
+      if (iter->rewindable && iter_checkpoint(iter) < 0)
+        return PYFOV_ENGINE_NOMEM;
+      // The next column is kept queued past the radius, for rewinds
+      if ((unsigned)iter->queue[iter->head].dx > iter->data.radius)
+        return 0;
+      *cur = iter->queue[iter->head++];
+      if (!iter_begin(iter))
+        continue;
+      iter->scanning = true;
+    }
+
+    dx = cur->dx;
+    apply_edge = octants[cur->octant].apply_edge;
+    while (iter->dy <= iter->dy1) {
+      dy = iter->dy++;
+      cx = iter->data.source_x + dx * octants[cur->octant].xx +
+        dy * octants[cur->octant].xy;
+      cy = iter->data.source_y + dx * octants[cur->octant].yx +
+        dy * octants[cur->octant].yy;
+
+      if (settings->opaque(iter->data.map, cx, cy)) {
+        lit = settings->opaque_apply == FOV_OPAQUE_APPLY &&
+          (apply_edge || dy > 0);
+        if (iter->prev_blocked == 0 &&
+            iter_push(iter, cur->octant, dx + 1, cur->start_slope,
+                      betweenf(wall_low_slope(&iter->data, dx, dy),
+                               cur->start_slope, cur->end_slope)) < 0)
+          return PYFOV_ENGINE_NOMEM;
+        iter->prev_blocked = 1;
+      } else {
+        lit = apply_edge || dy > 0;
+        if (iter->prev_blocked == 1)
+          cur->start_slope =
+            betweenf(wall_high_slope(&iter->data, dx, dy - 1),
+                     cur->start_slope, cur->end_slope);
+        iter->prev_blocked = 0;
+      }
+
+      if (lit) {
+        *x = cx;
+        *y = cy;
+        ++iter->returned;
+        return 1;
+      }
+    }
+
+    iter->scanning = false;
+    if (iter->prev_blocked == 0 &&
+        iter_push(iter, cur->octant, dx + 1, cur->start_slope,
+                  cur->end_slope) < 0)
+      return PYFOV_ENGINE_NOMEM;
+  }
+}
+
+unsigned
+pyfov_sweep_iter_ring(const pyfov_sweep_iter *iter) {
+  return (unsigned)iter->current.dx;
+}
+
+int
+pyfov_sweep_iter_rewind(pyfov_sweep_iter *iter, unsigned radius,
+                        unsigned long *kept) {
+  fov_shape_type shape = iter->settings.shape;
+  unsigned c = iter_first_clipped(shape, iter->data.radius);
+  unsigned clipped = iter_first_clipped(shape, radius);
+  iter_column *column;
+  iter_interval *queue;
+
+  if (clipped < c)
+    c = clipped;
+  // Columns the sweep never reached are swept with the new radius anyway
+  if (c > iter->last_column) {
+    iter->data.radius = radius;
+    *kept = iter->returned;
+    return PYFOV_ENGINE_OK;
+  }
+
+  column = &iter->columns[c];
+  if (column->count > iter->size) {
+    queue = realloc(iter->queue, column->count * sizeof(iter_interval));
+    if (queue == NULL)
+      return PYFOV_ENGINE_NOMEM;
+    iter->queue = queue;
+    iter->size = column->count;
+  }
+  iter->data.radius = radius;
+  memcpy(iter->queue, &iter->saved[column->at],
+         column->count * sizeof(iter_interval));
+  iter->head = 0;
+  iter->tail = column->count;
+  iter->scanning = false;
+  iter->saved_len = column->at;
+  iter->last_column = c - 1;
+  iter->returned = column->returned;
+  *kept = iter->returned;
+  return PYFOV_ENGINE_OK;
+}
+
+void
+pyfov_sweep_iter_free(pyfov_sweep_iter *iter) {
+  if (iter == NULL)
+    return;
+  free(iter->queue);
+  free(iter->saved);
+  free(iter->columns);
+  free(iter);
+}
+
+/**
+ * Symmetric shadowcasting
+ *
+ * Scans four quadrants row by row with exact rational slopes.  Floor cells
+ * are only lit when their centre lies within the visible slope range, which
+ * makes floor-to-floor visibility symmetric.  Diagonals are shared between
+ * neighbouring quadrants, so this engine needs data->seen.
+ */
+typedef struct {
+  int num;
+  int den;
+} fraction;
+
+/* x = source_x + depth * q[0] + col * q[1], y = source_y + ... */
+static const int quadrants[4][4] = {
+  { 0, 1, -1, 0},
+  { 1, 0,  0, 1},
+  { 0, 1,  1, 0},
+  {-1, 0,  0, 1},
+};
+
+static int
+floor_div(int a, int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int
+ceil_div(int a, int b) {
+  return -floor_div(-a, b);
+}
+
+static void
+symmetric_row(engine_data *data, const int *q, int depth,
+              fraction start, fraction end) {
+  fov_settings_type *settings = data->settings;
+  int col, min_col, max_col, x, y;
+  int prev = -1;
+  bool wall, in_shape;
+  fraction next_end;
+  double low, high;
+  double row_start = (double)start.num / start.den;
+  double row_end = (double)end.num / end.den;
+
+  if ((unsigned)depth > data->radius)
+    return;
+  engine_count_interval(data, (unsigned)depth);
+
+  // Round ties towards the centre of the row
+  min_col = floor_div(2 * depth * start.num + start.den, 2 * start.den);
+  max_col = ceil_div(2 * depth * end.num - end.den, 2 * end.den);
+
+  for (col = min_col; col <= max_col; ++col) {
+    x = data->source_x + depth * q[0] + col * q[1];
+    y = data->source_y + depth * q[2] + col * q[3];
+
+    // Cells outside of the shape are never probed, and don't cast shadows
+    in_shape = pyfov_in_shape(settings->shape, x - data->source_x,
+                              y - data->source_y, data->radius);
+    wall = in_shape && settings->opaque(data->map, x, y);
+
+    if (wall) {
+      if (settings->opaque_apply == FOV_OPAQUE_APPLY)
+        engine_apply(data, x, y);
+    } else if (in_shape &&
+               col * start.den >= depth * start.num &&
+               col * end.den <= depth * end.num) {
+      engine_apply(data, x, y);
+    }
+
+    if (in_shape && data->coverage != NULL) {
+      low = (col - 0.5) / depth;
+      high = (col + 0.5) / depth;
+      if (low < row_start)
+        low = row_start;
+      if (high > row_end)
+        high = row_end;
+      if (high > low)
+        engine_cover(data, x, y, (float)((high - low) * depth));
+    }
+
+    if (prev == 1 && !wall) {
+      start.num = 2 * col - 1;
+      start.den = 2 * depth;
+    }
+    if (prev == 0 && wall) {
+      next_end.num = 2 * col - 1;
+      next_end.den = 2 * depth;
+      symmetric_row(data, q, depth + 1, start, next_end);
+    }
+    prev = wall;
+  }
+
+  if (prev == 0)
+    symmetric_row(data, q, depth + 1, start, end);
+}
+
+static void
+symmetric(engine_data *data) {
+  fraction start = {-1, 1};
+  fraction end = {1, 1};
+  uint64_t started;
+  int quadrant;
+
+  for (quadrant = 0; quadrant < 4; ++quadrant) {
+    started = engine_section_begin(data);
+    symmetric_row(data, quadrants[quadrant], 1, start, end);
+    engine_section_end(data, quadrant, started);
+  }
+}
+
+/**
+ * Precise permissive FOV
+ *
+ * A cell is visible if any line from anywhere in the source cell reaches
+ * anywhere in it.  Each quadrant keeps a list of views bounded by a shallow
+ * and a steep line, which get bent around the corners ("bumps") of the
+ * walls they run into.  Axes are shared between neighbouring quadrants, so
+ * this engine needs data->seen.
+ */
+typedef struct {
+  int xi, yi, xf, yf;
+} perm_line;
+
+typedef struct {
+  int x, y;
+  int parent;
+} perm_bump;
+
+typedef struct {
+  perm_line shallow;
+  perm_line steep;
+  int shallow_bump;
+  int steep_bump;
+} perm_view;
+
+typedef struct {
+  perm_view *views;
+  int nviews;
+  perm_bump *bumps;
+  int nbumps;
+} perm_state;
+
+/* > 0 below the line, < 0 above it, 0 on it */
+static int
+line_side(const perm_line *line, int x, int y) {
+  return (line->yf - line->yi) * (line->xf - x) -
+         (line->xf - line->xi) * (line->yf - y);
+}
+
+static void
+perm_add_shallow_bump(perm_state *st, int index, int x, int y) {
+  perm_view *view = &st->views[index];
+  int b;
+
+  view->shallow.xf = x;
+  view->shallow.yf = y;
+  st->bumps[st->nbumps].x = x;
+  st->bumps[st->nbumps].y = y;
+  st->bumps[st->nbumps].parent = view->shallow_bump;
+  view->shallow_bump = st->nbumps++;
+
+  for (b = view->steep_bump; b >= 0; b = st->bumps[b].parent) {
+    if (line_side(&view->shallow, st->bumps[b].x, st->bumps[b].y) < 0) {
+      view->shallow.xi = st->bumps[b].x;
+      view->shallow.yi = st->bumps[b].y;
+    }
+  }
+}
+
+static void
+perm_add_steep_bump(perm_state *st, int index, int x, int y) {
+  perm_view *view = &st->views[index];
+  int b;
+
+  view->steep.xf = x;
+  view->steep.yf = y;
+  st->bumps[st->nbumps].x = x;
+  st->bumps[st->nbumps].y = y;
+  st->bumps[st->nbumps].parent = view->steep_bump;
+  view->steep_bump = st->nbumps++;
+
+  for (b = view->shallow_bump; b >= 0; b = st->bumps[b].parent) {
+    if (line_side(&view->steep, st->bumps[b].x, st->bumps[b].y) > 0) {
+      view->steep.xi = st->bumps[b].x;
+      view->steep.yi = st->bumps[b].y;
+    }
+  }
+}
+
+static void
+perm_remove_view(perm_state *st, int index) {
+  memmove(&st->views[index], &st->views[index + 1],
+          (st->nviews - index - 1) * sizeof(perm_view));
+  --st->nviews;
+}
+
+/**
+ * Drops the view if its lines have collapsed onto each other through one
+ * of the source cell's corners.  Returns false if the view was dropped.
+ */
+static bool
+perm_check_view(perm_state *st, int index) {
+  perm_line *shallow = &st->views[index].shallow;
+  perm_line *steep = &st->views[index].steep;
+
+  if (line_side(shallow, steep->xi, steep->yi) == 0 &&
+      line_side(shallow, steep->xf, steep->yf) == 0 &&
+      (line_side(shallow, 0, 1) == 0 || line_side(shallow, 1, 0) == 0)) {
+    perm_remove_view(st, index);
+    return false;
+  }
+  return true;
+}
+
+static void
+perm_visit(engine_data *data, perm_state *st, int qx, int qy,
+           int x, int y, int *index) {
+  fov_settings_type *settings = data->settings;
+  perm_view *view;
+  int real_x, real_y, shallow_index, steep_index;
+  bool blocked;
+
+  // Skip the views that pass entirely below this cell
+  while (*index < st->nviews &&
+         line_side(&st->views[*index].steep, x + 1, y) >= 0)
+    ++*index;
+
+  if (*index == st->nviews ||
+      line_side(&st->views[*index].shallow, x, y + 1) <= 0)
+    return;
+
+  if (!pyfov_in_shape(settings->shape, x, y, data->radius))
+    return;
+
+  real_x = data->source_x + x * qx;
+  real_y = data->source_y + y * qy;
+  blocked = settings->opaque(data->map, real_x, real_y);
+  if (!blocked || settings->opaque_apply == FOV_OPAQUE_APPLY)
+    engine_apply(data, real_x, real_y);
+  if (!blocked)
+    return;
+
+  view = &st->views[*index];
+  if (line_side(&view->shallow, x + 1, y) < 0 &&
+      line_side(&view->steep, x, y + 1) > 0) {
+    // The wall fills the whole view
+    perm_remove_view(st, *index);
+  } else if (line_side(&view->shallow, x + 1, y) < 0) {
+    perm_add_shallow_bump(st, *index, x, y + 1);
+    perm_check_view(st, *index);
+  } else if (line_side(&view->steep, x, y + 1) > 0) {
+    perm_add_steep_bump(st, *index, x + 1, y);
+    perm_check_view(st, *index);
+  } else {
+    // The wall splits the view in two
+    shallow_index = *index;
+    steep_index = ++*index;
+    memmove(&st->views[shallow_index + 1], &st->views[shallow_index],
+            (st->nviews - shallow_index) * sizeof(perm_view));
+    ++st->nviews;
+
+    perm_add_steep_bump(st, shallow_index, x + 1, y);
+    if (!perm_check_view(st, shallow_index)) {
+      --*index;
+      --steep_index;
+    }
+    perm_add_shallow_bump(st, steep_index, x, y + 1);
+    perm_check_view(st, steep_index);
+  }
+}
+
+static void
+permissive_quadrant(engine_data *data, perm_state *st, int qx, int qy) {
+  int r = (int)data->radius;
+  int i, j, index;
+
+  st->nviews = 1;
+  st->nbumps = 0;
+  st->views[0].shallow.xi = 0;
+  st->views[0].shallow.yi = 1;
+  st->views[0].shallow.xf = r;
+  st->views[0].shallow.yf = 0;
+  st->views[0].steep.xi = 1;
+  st->views[0].steep.yi = 0;
+  st->views[0].steep.xf = 0;
+  st->views[0].steep.yf = r;
+  st->views[0].shallow_bump = -1;
+  st->views[0].steep_bump = -1;
+
+  // Walk the quadrant one anti-diagonal at a time
+  for (i = 1; i <= 2 * r && st->nviews > 0; ++i) {
+    engine_note_intervals(data, (unsigned)st->nviews);
+    index = 0;
+    for (j = i > r ? i - r : 0; j <= (i < r ? i : r) && index < st->nviews;
+         ++j)
+      perm_visit(data, st, qx, qy, i - j, j, &index);
+  }
+}
+
+static int
+permissive(engine_data *data) {
+  static const int signs[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+  size_t cells = (size_t)(data->radius + 1) * (data->radius + 1);
+  perm_state st;
+  uint64_t start;
+  int quadrant;
+
+  // Every wall adds at most one view and two bumps
+  st.views = malloc((cells + 2) * sizeof(perm_view));
+  st.bumps = malloc((2 * cells + 2) * sizeof(perm_bump));
+  if (st.views == NULL || st.bumps == NULL) {
+    free(st.views);
+    free(st.bumps);
+    return PYFOV_ENGINE_NOMEM;
+  }
+
+  for (quadrant = 0; quadrant < 4; ++quadrant) {
+    start = engine_section_begin(data);
+    permissive_quadrant(data, &st, signs[quadrant][0], signs[quadrant][1]);
+    engine_section_end(data, quadrant, start);
+  }
+
+  free(st.views);
+  free(st.bumps);
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * Hex grids
+ *
+ * Cells are addressed by axial coordinates (q, r) and are in range when
+ * their hex distance from the source is at most the radius; the shape
+ * setting doesn't apply.  A cell is lit when either of the two hex lines
+ * to it, nudged to opposite sides of any ties, crosses no opaque cell.
+ * Every cell in range is probed at most once.
+ */
+#define HEX_NUDGE 1e-4f
+
+static int
+hex_distance(int dq, int dr) {
+  return (abs(dq) + abs(dr) + abs(dq + dr)) / 2;
+}
+
+static void
+hex_round(float q, float r, int *rq, int *rr) {
+  float s = -q - r;
+  float fq = floorf(q + 0.5f);
+  float fr = floorf(r + 0.5f);
+  float fs = floorf(s + 0.5f);
+  float dq = fabsf(fq - q);
+  float dr = fabsf(fr - r);
+  float ds = fabsf(fs - s);
+
+  if (dq > dr && dq > ds)
+    fq = -fr - fs;
+  else if (dr > ds)
+    fr = -fq - fs;
+  *rq = (int)fq;
+  *rr = (int)fr;
+}
+
+static bool
+hex_opaque(engine_data *data, signed char *cache, int dq, int dr) {
+  signed char *cell = &cache[engine_index(data, dq, dr)];
+
+  if (*cell < 0)
+    *cell = data->settings->opaque(data->map, data->source_x + dq,
+                                   data->source_y + dr);
+  return *cell;
+}
+
+static bool
+hex_line_clear(engine_data *data, signed char *cache, int dq, int dr,
+               float nudge) {
+  int n = hex_distance(dq, dr);
+  int i, q, r;
+  float t;
+
+  for (i = 1; i < n; ++i) {
+    t = (float)i / (float)n;
+    hex_round(dq * t + nudge, dr * t + nudge, &q, &r);
+    if (hex_opaque(data, cache, q, r))
+      return false;
+  }
+  return true;
+}
+
+static int
+hex_sweep(engine_data *data) {
+  fov_settings_type *settings = data->settings;
+  int r = (int)data->radius;
+  size_t side = 2 * data->radius + 1;
+  signed char *cache;
+  int dq, dr;
+
+  if ((cache = malloc(side * side)) == NULL)
+    return PYFOV_ENGINE_NOMEM;
+  memset(cache, -1, side * side);
+
+  for (dr = -r; dr <= r; ++dr) {
+    for (dq = -r; dq <= r; ++dq) {
+      if (hex_distance(dq, dr) > r || (dq == 0 && dr == 0))
+        continue;
+      if (!hex_line_clear(data, cache, dq, dr, HEX_NUDGE) &&
+          !hex_line_clear(data, cache, dq, dr, -HEX_NUDGE))
+        continue;
+      if (settings->opaque_apply == FOV_OPAQUE_APPLY ||
+          !hex_opaque(data, cache, dq, dr))
+        engine_apply(data, data->source_x + dq, data->source_y + dr);
+    }
+  }
+
+  free(cache);
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * Flood fill
+ *
+ * Dijkstra over the 8-connected grid, bounded by the radius.  Each step
+ * costs 1 (sqrt(2) diagonally) times one plus the cost of the cell it
+ * enters.  Opaque cells are reached according to opaque_apply but never
+ * pass the flood on, and diagonal steps can't squeeze between two opaque
+ * cells.
+ */
+typedef struct {
+  float distance;
+  int index;
+} flood_node;
+
+static void
+flood_push(flood_node *heap, int *size, float distance, int index) {
+  int i = (*size)++;
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (heap[parent].distance <= distance)
+      break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i].distance = distance;
+  heap[i].index = index;
+}
+
+static flood_node
+flood_pop(flood_node *heap, int *size) {
+  flood_node top = heap[0];
+  flood_node last = heap[--*size];
+  int i = 0;
+  int child;
+
+  while ((child = 2 * i + 1) < *size) {
+    if (child + 1 < *size && heap[child + 1].distance < heap[child].distance)
+      ++child;
+    if (last.distance <= heap[child].distance)
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+static bool
+flood_opaque(fov_settings_type *settings, void *map, signed char *cache,
+             int left, int top, int side, int index) {
+  if (cache[index] < 0)
+    cache[index] = settings->opaque(map, left + index % side,
+                                    top + index / side);
+  return cache[index];
+}
+
+int
+pyfov_flood(fov_settings_type *settings, void *map,
+            int source_x, int source_y, unsigned radius,
+            const unsigned char *costs, float *distances) {
+  static const int steps[8][2] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1},
+  };
+  int left = source_x - (int)radius;
+  int top = source_y - (int)radius;
+  int size = 0;
+  int side, cells, k, i, j, ni, nj, next;
+  float step, distance;
+  flood_node *heap;
+  flood_node node;
+  signed char *cache;
+
+  if (radius > PYFOV_FLOOD_MAX_RADIUS)
+    return PYFOV_ENGINE_UNSUPPORTED;
+  side = 2 * (int)radius + 1;
+  cells = side * side;
+
+  // A cell can only get closer once per neighbour
+  heap = malloc((8 * (size_t)cells + 1) * sizeof(flood_node));
+  cache = malloc((size_t)cells);
+  if (heap == NULL || cache == NULL) {
+    free(heap);
+    free(cache);
+    return PYFOV_ENGINE_NOMEM;
+  }
+  memset(cache, -1, cells);
+  for (k = 0; k < cells; ++k)
+    distances[k] = -1.0f;
+
+  distances[cells / 2] = 0.0f;
+  flood_push(heap, &size, 0.0f, cells / 2);
+
+  while (size > 0) {
+    node = flood_pop(heap, &size);
+    if (node.distance > distances[node.index])
+      continue;
+    if (node.index != cells / 2 &&
+        flood_opaque(settings, map, cache, left, top, side, node.index))
+      continue;
+
+    i = node.index % side;
+    j = node.index / side;
+    for (k = 0; k < 8; ++k) {
+      ni = i + steps[k][0];
+      nj = j + steps[k][1];
+      if (ni < 0 || nj < 0 || ni >= side || nj >= side)
+        continue;
+      next = nj * side + ni;
+
+      step = 1.0f;
+      if (k >= 4) {
+        if (flood_opaque(settings, map, cache, left, top, side,
+                         j * side + ni) &&
+            flood_opaque(settings, map, cache, left, top, side,
+                         nj * side + i))
+          continue;
+        step = (float)M_SQRT2;
+      }
+      if (costs != NULL)
+        step *= 1.0f + costs[next];
+
+      distance = node.distance + step;
+      if (distance > (float)radius ||
+          (distances[next] >= 0.0f && distance >= distances[next]))
+        continue;
+      if (settings->opaque_apply == FOV_OPAQUE_NOAPPLY &&
+          flood_opaque(settings, map, cache, left, top, side, next))
+        continue;
+
+      distances[next] = distance;
+      flood_push(heap, &size, distance, next);
+    }
+  }
+
+  free(heap);
+  free(cache);
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * Bitboard shadowcasting
+ *
+ * The same octant scan as above for maps of at most 64x64 cells, reading
+ * each row segment of an octant as one word cut from the row or column
+ * bitboards.  Clear runs are found with bit scans rather than per-cell
+ * opacity tests, and lit cells are or'ed into the result a run at a time.
+ * The slopes are computed exactly as in shadowcast_octant, so it lights
+ * the same cells (corner_peek is ignored here too).
+ */
+typedef struct {
+  const fov_settings_type *settings;
+  const pyfov_bitboard *board;
+  int source_x;
+  int source_y;
+  unsigned radius;
+
+  /* Lit cells by row, and lit cells by column for the octants that scan
+   * along columns; the two are merged at the end */
+  uint64_t *lit_rows;
+  uint64_t lit_cols[64];
+} bitboard_data;
+
+#define BITBOARD_ONES (~(uint64_t)0)
+
+static uint64_t
+bitboard_reverse(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  v = ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+  v = ((v >> 16) & 0x0000FFFF0000FFFFULL) |
+      ((v & 0x0000FFFF0000FFFFULL) << 16);
+  return (v >> 32) | (v << 32);
+}
+
+/**
+ * Transposes the 64x64 bit matrix `m` in place, so bit x of word y moves
+ * to bit y of word x.
+ */
+static void
+bitboard_transpose(uint64_t *m) {
+  uint64_t mask = 0x00000000FFFFFFFFULL;
+  uint64_t t;
+  int j, k;
+
+  for (j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+    for (k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      t = ((m[k] >> j) ^ m[k | j]) & mask;
+      m[k] ^= t << j;
+      m[k | j] ^= t;
+    }
+  }
+}
+
+void
+pyfov_bitboard_fill(pyfov_bitboard *board) {
+  int i;
+
+  memcpy(board->cols, board->rows, sizeof(board->cols));
+  bitboard_transpose(board->cols);
+  for (i = 0; i < 64; ++i) {
+    board->reversed_rows[i] = bitboard_reverse(board->rows[i]);
+    board->reversed_cols[i] = bitboard_reverse(board->cols[i]);
+  }
+}
+
+/**
+ * Bits lo..hi
+ */
+static uint64_t
+bitboard_span(int lo, int hi) {
+  return (BITBOARD_ONES >> (63 - hi)) & (BITBOARD_ONES << lo);
+}
+
+/**
+ * Returns the opacity of the cells of row `dx` of `octant` as a word whose
+ * bit dy is the cell at minor offset dy.  Cells off the board are opaque.
+ */
+static uint64_t
+bitboard_line(bitboard_data *data, int octant, int dx) {
+  const pyfov_bitboard *board = data->board;
+  int major, minor, sign;
+  const uint64_t *lines, *reversed;
+
+  if (octants[octant].xy != 0) {
+    major = data->source_y + dx * octants[octant].yx;
+    minor = data->source_x;
+    sign = octants[octant].xy;
+    lines = board->rows;
+    reversed = board->reversed_rows;
+  } else {
+    major = data->source_x + dx * octants[octant].xx;
+    minor = data->source_y;
+    sign = octants[octant].yy;
+    lines = board->cols;
+    reversed = board->reversed_cols;
+  }
+
+  if (major < 0 || major > 63)
+    return BITBOARD_ONES;
+  if (sign > 0)
+    return (lines[major] >> minor) |
+      (minor > 0 ? BITBOARD_ONES << (64 - minor) : 0);
+  return (reversed[major] >> (63 - minor)) |
+    (minor < 63 ? BITBOARD_ONES << (minor + 1) : 0);
+}
+
+/**
+ * Lights the cells of row `dx` of `octant` whose bits are set in `cells`.
+ */
+static void
+bitboard_light(bitboard_data *data, int octant, int dx, uint64_t cells) {
+  int major, minor, sign;
+  uint64_t *lit;
+
+  if (octants[octant].xy != 0) {
+    major = data->source_y + dx * octants[octant].yx;
+    minor = data->source_x;
+    sign = octants[octant].xy;
+    lit = data->lit_rows;
+  } else {
+    major = data->source_x + dx * octants[octant].xx;
+    minor = data->source_y;
+    sign = octants[octant].yy;
+    lit = data->lit_cols;
+  }
+
+  if (major < 0 || major > 63)
+    return;
+  if (sign > 0)
+    lit[major] |= cells << minor;
+  else
+    lit[major] |= bitboard_reverse(cells) >> (63 - minor);
+}
+
+static void
+bitboard_octant(bitboard_data *data, int octant, int dx,
+                float start_slope, float end_slope) {
+  const fov_settings_type *settings = data->settings;
+  int dy0, dy1, a, b;
+  unsigned h;
+  uint64_t line, span, clear, lit, run;
+
+  if ((unsigned)dx > data->radius)
+    return;
+
+  dy0 = (int)(0.5f + ((float)dx) * start_slope);
+  dy1 = (int)(0.5f + ((float)dx) * end_slope);
+
+  if (!octants[octant].apply_diag && dy1 == dx)
+    --dy1;
+
+  h = pyfov_shape_height(settings->shape, dx, data->radius);
+  if ((unsigned)dy1 > h) {
+    if (h == 0)
+      return;
+    dy1 = (int)h;
+  }
+  if (dy0 > dy1 || dy0 > 63)
+    return;
+
+  // Offsets past 63 are off the board, and so opaque
+  line = bitboard_line(data, octant, dx);
+  span = bitboard_span(dy0, dy1 > 63 ? 63 : dy1);
+  clear = ~line & span;
+
+  lit = settings->opaque_apply == FOV_OPAQUE_APPLY ? span : clear;
+  if (!octants[octant].apply_edge)
+    lit &= ~(uint64_t)1;
+  bitboard_light(data, octant, dx, lit);
+
+  // Every clear run a..b continues into the next row between the walls
+  // that bound it
+  while (clear != 0) {
+    a = __builtin_ctzll(clear);
+    run = ~(clear >> a);
+    b = run != 0 ? a + __builtin_ctzll(run) - 1 : 63;
+    clear &= ~bitboard_span(a, b);
+
+    if (a > dy0)
+      start_slope = betweenf(((float)(a - 1) + 0.5f) / ((float)dx - 0.5f),
+                             start_slope, end_slope);
+    if (b < dy1)
+      bitboard_octant(data, octant, dx + 1, start_slope,
+                      betweenf(((float)(b + 1) - 0.5f) / ((float)dx + 0.5f),
+                               start_slope, end_slope));
+    else
+      bitboard_octant(data, octant, dx + 1, start_slope, end_slope);
+  }
+}
+
+int
+pyfov_bitboard_circle(const fov_settings_type *settings,
+                      const pyfov_bitboard *board, int source_x,
+                      int source_y, unsigned radius, uint64_t *lit) {
+  bitboard_data data;
+  int octant, i;
+
+  if (source_x < 0 || source_x > 63 || source_y < 0 || source_y > 63)
+    return PYFOV_ENGINE_UNSUPPORTED;
+
+  data.settings = settings;
+  data.board = board;
+  data.source_x = source_x;
+  data.source_y = source_y;
+  data.radius = radius;
+  data.lit_rows = lit;
+  memset(lit, 0, 64 * sizeof(uint64_t));
+  memset(data.lit_cols, 0, sizeof(data.lit_cols));
+
+  for (octant = 0; octant < 8; ++octant)
+    bitboard_octant(&data, octant, 1, 0.0f, 1.0f);
+
+  bitboard_transpose(data.lit_cols);
+  for (i = 0; i < 64; ++i)
+    lit[i] |= data.lit_cols[i];
+  return PYFOV_ENGINE_OK;
+}
+
+/**
+ * Dispatch
+ */
+static int
+engine_run(pyfov_engine_type engine, engine_data *data,
+           pyfov_engine_extras *extras) {
+  size_t side = 2 * data->radius + 1;
+  int result = PYFOV_ENGINE_OK;
+
+  data->diamond = false;
+  data->hex = false;
+  data->seen = NULL;
+  data->coverage = extras != NULL ? extras->coverage : NULL;
+  data->stats = extras != NULL ? extras->stats : NULL;
+  data->intervals = NULL;
+
+  // Permissive FOV and the hex kernel don't track shadow intervals
+  if ((engine == PYFOV_ENGINE_PERMISSIVE || engine == PYFOV_ENGINE_HEX) &&
+      data->coverage != NULL)
+    return PYFOV_ENGINE_UNSUPPORTED;
+
+  if (data->stats != NULL && engine != PYFOV_ENGINE_HEX) {
+    data->intervals = malloc((data->radius + 2) * sizeof(unsigned));
+    if (data->intervals == NULL)
+      return PYFOV_ENGINE_NOMEM;
+    data->stats->peak_intervals = 0;
+  }
+
+  switch (engine) {
+  case PYFOV_ENGINE_DIAMOND_WALLS:
+    data->diamond = true;
+    shadowcast(data);
+    break;
+  case PYFOV_ENGINE_SYMMETRIC_SHADOWCAST:
+    if ((data->seen = calloc(side * side, 1)) == NULL)
+      result = PYFOV_ENGINE_NOMEM;
+    else
+      symmetric(data);
+    break;
+  case PYFOV_ENGINE_PERMISSIVE:
+    if ((data->seen = calloc(side * side, 1)) == NULL)
+      result = PYFOV_ENGINE_NOMEM;
+    else
+      result = permissive(data);
+    break;
+  case PYFOV_ENGINE_TABLE:
+    // Coverage is measured along the slopes themselves
+    if (data->radius > TABLE_MAX_RADIUS || data->coverage != NULL)
+      shadowcast(data);
+    else
+      table(data);
+    break;
+  case PYFOV_ENGINE_HEX:
+    data->hex = true;
+    result = hex_sweep(data);
+    break;
+  default:
+    shadowcast(data);
+    break;
+  }
+
+  free(data->seen);
+  free(data->intervals);
+  return result;
+}
+
+/**
+ * libfov can't report on its sweep, so runs that want extras fall back to
+ * the port of its scan.  Circles light exactly the same cells; beams use
+ * the port's cone.
+ */
+static bool
+wants_extras(pyfov_engine_extras *extras) {
+  return extras != NULL && extras->coverage != NULL;
+}
+
+int
+pyfov_engine_circle(pyfov_engine_type engine, fov_settings_type *settings,
+                    void *map, void *source, int source_x, int source_y,
+                    unsigned radius, pyfov_engine_extras *extras) {
+  engine_data data;
+
+  if (engine == PYFOV_ENGINE_LIBFOV) {
+    if (wants_extras(extras)) {
+      engine = PYFOV_ENGINE_RECURSIVE_SHADOWCAST;
+    } else {
+      fov_circle(settings, map, source, source_x, source_y, radius);
+      return PYFOV_ENGINE_OK;
+    }
+  }
+
+  data.settings = settings;
+  data.map = map;
+  data.source = source;
+  data.source_x = source_x;
+  data.source_y = source_y;
+  data.radius = radius;
+  data.beam = false;
+
+  return engine_run(engine, &data, extras);
+}
+
+int
+pyfov_engine_beam(pyfov_engine_type engine, fov_settings_type *settings,
+                  void *map, void *source, int source_x, int source_y,
+                  unsigned radius, fov_direction_type direction,
+                  float angle, pyfov_engine_extras *extras) {
+  static const float directions[8][2] = {
+    { 1.0f,  0.0f},  /* FOV_EAST */
+    { 1.0f, -1.0f},  /* FOV_NORTHEAST */
+    { 0.0f, -1.0f},  /* FOV_NORTH */
+    {-1.0f, -1.0f},  /* FOV_NORTHWEST */
+    {-1.0f,  0.0f},  /* FOV_WEST */
+    {-1.0f,  1.0f},  /* FOV_SOUTHWEST */
+    { 0.0f,  1.0f},  /* FOV_SOUTH */
+    { 1.0f,  1.0f},  /* FOV_SOUTHEAST */
+  };
+  engine_data data;
+  float len;
+
+  if (engine == PYFOV_ENGINE_LIBFOV) {
+    if (wants_extras(extras)) {
+      engine = PYFOV_ENGINE_RECURSIVE_SHADOWCAST;
+    } else {
+      fov_beam(settings, map, source, source_x, source_y, radius,
+               direction, angle);
+      return PYFOV_ENGINE_OK;
+    }
+  }
+
+  data.settings = settings;
+  data.map = map;
+  data.source = source;
+  data.source_x = source_x;
+  data.source_y = source_y;
+  data.radius = radius;
+
+  // The alternative engines sweep the full circle and only light the cells
+  // that fall within `angle` degrees around the beam's direction.
+  data.beam = angle < 360.0f && (unsigned)direction < 8;
+  if (data.beam) {
+    len = sqrtf(directions[direction][0] * directions[direction][0] +
+                directions[direction][1] * directions[direction][1]);
+    data.beam_x = directions[direction][0] / len;
+    data.beam_y = directions[direction][1] / len;
+    data.beam_cos = cosf((angle > 0.0f ? angle : 0.0f) *
+                         (float)M_PI / 360.0f);
+  }
+
+  return engine_run(engine, &data, extras);
+}
@@ -0,0 +1,209 @@
+#ifndef PYFOV_ENGINES_H
+#define PYFOV_ENGINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fov/fov.h"
+
+/**
+ * Native FOV engines that can stand in for libfov's own fov_circle and
+ * fov_beam.
+ *
+ * Every engine talks to the map exclusively through the opacity and
+ * lighting callbacks stored on the fov_settings_type, exactly like libfov,
+ * so anything that can back a libfov call can back any engine.
+ */
+typedef enum {
+  /* libfov's own implementation */
+  PYFOV_ENGINE_LIBFOV,
+  /* Recursive shadowcasting; a port of libfov's octant scan */
+  PYFOV_ENGINE_RECURSIVE_SHADOWCAST,
+  /* Symmetric shadowcasting (floor visibility is symmetric) */
+  PYFOV_ENGINE_SYMMETRIC_SHADOWCAST,
+  /* Precise permissive FOV */
+  PYFOV_ENGINE_PERMISSIVE,
+  /* Shadowcasting where walls only block their inscribed diamond */
+  PYFOV_ENGINE_DIAMOND_WALLS,
+  /* libfov's octant scan driven by a table of its slopes */
+  PYFOV_ENGINE_TABLE,
+
+  PYFOV_ENGINE_COUNT,
+
+  /**
+   * Line of sight kernel for axial hex grids.  It is picked by the map's
+   * layout rather than by Settings.engine.
+   */
+  PYFOV_ENGINE_HEX = PYFOV_ENGINE_COUNT,
+  /**
+   * fov_circle over a fov.Map's bitboards.  Only ENGINE_AUTO picks it, for
+   * circles on square maps of at most 64x64 cells.
+   */
+  PYFOV_ENGINE_BITBOARD,
+  /**
+   * Not an engine: Settings picks one per call from the engine profile
+   */
+  PYFOV_ENGINE_AUTO
+} pyfov_engine_type;
+
+/**
+ * Engine return codes
+ */
+#define PYFOV_ENGINE_OK 0
+/* Scratch memory couldn't be allocated */
+#define PYFOV_ENGINE_NOMEM -1
+/* The engine can't produce one of the requested extras */
+#define PYFOV_ENGINE_UNSUPPORTED -2
+
+/**
+ * What a sweep did, for Settings' explain mode.  The caller sets sections
+ * to 0 and peak_intervals to -1, and engines fill in what they track;
+ * libfov tracks nothing.
+ */
+typedef struct {
+  /**
+   * Nanoseconds spent in each octant, or each quadrant for the engines
+   * that sweep quadrants
+   */
+  uint64_t section_ns[8];
+  int sections;
+  /* Most slope intervals (or views) open at once in one row of a section */
+  int peak_intervals;
+} pyfov_engine_stats;
+
+/**
+ * Optional results an engine produces alongside the lighting callbacks.
+ * Per-cell arrays hold (2 * radius + 1)^2 entries in row major order,
+ * centred on the source.
+ */
+typedef struct {
+  /**
+   * Accumulates the fraction of each cell that is visible from the source,
+   * measured along the cell's centre line from the shadow intervals of the
+   * sweep.  Only the shadowcasting engines track intervals.
+   */
+  float *coverage;
+
+  /* Filled in as described above, when not NULL */
+  pyfov_engine_stats *stats;
+} pyfov_engine_extras;
+
+/**
+ * Returns the largest offset along the minor axis that is still inside
+ * `shape` at major axis offset `dx`, mirroring libfov's row heights.
+ */
+unsigned pyfov_shape_height(fov_shape_type shape, unsigned dx,
+                            unsigned radius);
+
+/**
+ * Returns true if the offset (dx, dy) from the source lies within `shape`.
+ */
+bool pyfov_in_shape(fov_shape_type shape, int dx, int dy, unsigned radius);
+
+/**
+ * Orders offsets from the source by distance under `shape`'s metric: the
+ * squared euclidean distance for circles, twice the major plus the minor
+ * axis offset for octagons, and the major axis offset for squares.
+ */
+unsigned long pyfov_shape_distance(fov_shape_type shape, int dx, int dy);
+
+/**
+ * Drop-in replacements for fov_circle and fov_beam that run `engine`.
+ * `extras` may be NULL.  Returns one of the PYFOV_ENGINE_* codes.
+ */
+int pyfov_engine_circle(pyfov_engine_type engine,
+                        fov_settings_type *settings, void *map,
+                        void *source, int source_x, int source_y,
+                        unsigned radius, pyfov_engine_extras *extras);
+
+int pyfov_engine_beam(pyfov_engine_type engine,
+                      fov_settings_type *settings, void *map,
+                      void *source, int source_x, int source_y,
+                      unsigned radius, fov_direction_type direction,
+                      float angle, pyfov_engine_extras *extras);
+
+/**
+ * Fills ENGINE_TABLE's slope tables.  Called once, at import.
+ */
+void pyfov_table_init(void);
+
+/**
+ * A circle sweep that can be stopped after any cell and resumed later.  It
+ * lights the same cells as ENGINE_RECURSIVE_SHADOWCAST (and so libfov),
+ * every octant's column dx before any column dx + 1, and returns them
+ * instead of calling settings->apply.
+ */
+typedef struct pyfov_sweep_iter pyfov_sweep_iter;
+
+/**
+ * Starts a sweep; `settings` is copied.  Rewindable sweeps save their
+ * progress as they go, so they can be rewound to a new radius.  Returns
+ * NULL if it can't be allocated.
+ */
+pyfov_sweep_iter *pyfov_sweep_iter_new(const fov_settings_type *settings,
+                                       void *map, int source_x,
+                                       int source_y, unsigned radius,
+                                       bool rewindable);
+
+/**
+ * Sweeps on to the next lit cell.  Returns 1 with the cell in (x, y), 0
+ * once the sweep is done, or PYFOV_ENGINE_NOMEM.
+ */
+int pyfov_sweep_iter_next(pyfov_sweep_iter *iter, int *x, int *y);
+
+/**
+ * The column of the cell last returned: its distance from the source
+ * along the major axis of its octant.  No cell after it is nearer.
+ */
+unsigned pyfov_sweep_iter_ring(const pyfov_sweep_iter *iter);
+
+/**
+ * Changes the radius of a rewindable sweep, taking it back to the first
+ * column the change can light differently.  `kept` is set to how many of
+ * the cells returned so far still stand; the sweep carries on with the
+ * cells after them.  Returns one of the PYFOV_ENGINE_* codes.
+ */
+int pyfov_sweep_iter_rewind(pyfov_sweep_iter *iter, unsigned radius,
+                            unsigned long *kept);
+void pyfov_sweep_iter_free(pyfov_sweep_iter *iter);
+
+/**
+ * Floods out from the source over the (2 * radius + 1)^2 window around it,
+ * writing the cost of reaching each cell to `distances`, or -1 if it
+ * can't be reached within `radius`.  `costs` holds an extra cost per
+ * window cell, or is NULL.  Returns one of the PYFOV_ENGINE_* codes, and
+ * PYFOV_ENGINE_UNSUPPORTED for radii over PYFOV_FLOOD_MAX_RADIUS.
+ */
+/* The flood's heap holds 8 entries per window cell, counted in an int */
+#define PYFOV_FLOOD_MAX_RADIUS 8191
+int pyfov_flood(fov_settings_type *settings, void *map,
+                int source_x, int source_y, unsigned radius,
+                const unsigned char *costs, float *distances);
+
+/**
+ * Opacity of a map of at most 64x64 cells as bitboards: bit x of rows[y]
+ * is set if (x, y) is opaque, and cells off the map are set.  cols holds
+ * the transpose, and the reversed_* words the same lines bit-reversed.
+ */
+typedef struct {
+  uint64_t rows[64];
+  uint64_t cols[64];
+  uint64_t reversed_rows[64];
+  uint64_t reversed_cols[64];
+} pyfov_bitboard;
+
+/**
+ * Derives cols and the reversed lines from rows.
+ */
+void pyfov_bitboard_fill(pyfov_bitboard *board);
+
+/**
+ * fov_circle over a bitboard, writing the lit cells to the 64 row words of
+ * `lit` instead of calling settings->apply.  The source must be on the
+ * board.  Returns one of the PYFOV_ENGINE_* codes.
+ */
+int pyfov_bitboard_circle(const fov_settings_type *settings,
+                          const pyfov_bitboard *board,
+                          int source_x, int source_y, unsigned radius,
+                          uint64_t *lit);
+
+#endif
@@ -1,5 +1,16 @@
 #include <Python.h>
+#include <structseq.h>
+#include <math.h>
 #include "fov/fov.h"
+#include "engines.h"
+#include "map.h"
+#include "dictmap.h"
+#include "profile.h"
+#include "counters.h"
+#include "slowlog.h"
+#include "metrics.h"
+#include "watch.h"
+#include "batch.h"
 
 #define SET_INCREF(A, B) \
   Py_INCREF(B); \
@@ -23,6 +34,20 @@
  * s.circle(None, None, 4, 4, 3)
  */
 
+/**
+ * How opacity is read from maps that aren't fov.Map or fov.DictMap.
+ */
+typedef enum {
+  /* Call opacity_test_function(map, x, y) */
+  PYFOV_LOOKUP_CALLBACK,
+  /* map[x, y] */
+  PYFOV_LOOKUP_ITEM,
+  /* map[y][x], for lists of rows */
+  PYFOV_LOOKUP_ROWS,
+
+  PYFOV_LOOKUP_COUNT
+} pyfov_lookup_type;
+
 /**
  * Define the wrapper around the core C settings,
  * since our python callbacks won't match the signatures
@@ -46,8 +71,45 @@ typedef struct {
    * Python callback for applying lighting
    */
   PyObject *apply_lighting_function;
+
+  /**
+   * Which engine circle and beam run; one of the ENGINE_* constants
+   */
+  pyfov_engine_type engine;
+
+  /**
+   * The engine the last circle or beam ran, which ENGINE_AUTO picks per
+   * call
+   */
+  pyfov_engine_type last_engine;
+
+  /**
+   * How cells are read from the map; one of the LOOKUP_* constants
+   */
+  pyfov_lookup_type lookup;
+
+  /**
+   * When not None, a frozenset of tile values.  The opacity test function
+   * (or lookup) then returns tiles, which are opaque if they're in the
+   * set.  Small int and single character tiles are looked up in the
+   * tables below instead of hashed.
+   */
+  PyObject *opaque_tiles;
+  unsigned char opaque_ints[256];
+  unsigned char opaque_chars[256];
 } pyfov_Settings;
 
+#define PYFOV_ROW_CACHE 64
+
+/**
+ * A cell and its distance from the source, for the outputs that order
+ * cells by distance
+ */
+typedef struct {
+  int x, y;
+  unsigned long distance;
+} pyfov_target;
+
 /**
  * Ugly hack to sneak the PyObject into the C API
  * so that we can properly route the callbacks back
@@ -57,8 +119,150 @@ typedef struct {
   void *orig_map;
   pyfov_Settings *settings;
   bool threw_exception;
+
+  /**
+   * Set when orig_map is a fov.Map.  Its cells are then read natively, and
+   * the engines sweep its grid rather than its storage coordinates.
+   */
+  pyfov_Map *native;
+
+  /**
+   * Set when orig_map is a fov.DictMap, whose terrain dict is probed
+   * directly instead of through the opacity test function.
+   */
+  pyfov_DictMap *dict;
+
+  /**
+   * For LOOKUP_ITEM, the map's mp_subscript slot, looked up once per sweep
+   */
+  binaryfunc subscript;
+
+  /**
+   * For LOOKUP_ROWS, the rows fetched so far this sweep, slotted by
+   * y % PYFOV_ROW_CACHE.  The octant scans hop between rows, so keeping
+   * only the last one would miss on most probes.
+   */
+  PyObject *rows[PYFOV_ROW_CACHE];
+  int row_y[PYFOV_ROW_CACHE];
+
+  /**
+   * A set or dict that lit cells are added to as (x, y) tuples instead of
+   * calling apply_lighting_function, or NULL.
+   */
+  PyObject *into;
+
+  /**
+   * When set, lit cells are only counted here, and neither added to `into`
+   * nor passed to apply_lighting_function.
+   */
+  unsigned long *lit;
+
+  /**
+   * Opacity tests and lit cells so far this sweep
+   */
+  unsigned long probes;
+  unsigned long applied;
+
+  /**
+   * Set while the slow log is on, to add the time spent calling into
+   * python (callbacks and lookups) to python_ns
+   */
+  bool timed;
+  uint64_t python_ns;
+
+  /**
+   * For explain mode, a flag per cell of the (2 * radius + 1)^2 window
+   * around the source (in the engines' coordinates) that has been probed,
+   * and how many probes hit a flagged cell.  NULL otherwise.
+   */
+  unsigned char *probed;
+  int probe_x, probe_y;
+  unsigned probe_radius;
+  unsigned long duplicates;
+
+  /**
+   * With watch=, each lit cell that is in `watch`, or nonzero in
+   * `watch_mask` (rows of `watch_width` bytes), is appended to `watched`
+   * as an (x, y) tuple the first time it's lit; `fired` holds those
+   * already appended.  `watch` may point at `watch_cells`, built for the
+   * call from an iterable.  `watched` is NULL without watch=.
+   */
+  PyObject *watched;
+  const pyfov_cellset *watch;
+  const unsigned char *watch_mask;
+  Py_ssize_t watch_len;
+  int watch_width;
+  pyfov_cellset watch_cells;
+  pyfov_cellset fired;
+
+  /**
+   * With ordered=, each cell lit, in storage coordinates, and its distance
+   * from the source under the sweep's metric, bucketed by distance once
+   * the sweep is done.  `ordered_seen` flags the cells of the
+   * (2 * radius + 1)^2 window around the source (in the engines'
+   * coordinates) already recorded.  NULL otherwise.
+   */
+  pyfov_target *ordered;
+  size_t ordered_count, ordered_size;
+  unsigned char *ordered_seen;
+  unsigned ordered_radius;
+  unsigned long ordered_max;
 } map_wrapper;
 
+static void
+_pyfov_init_wrap(map_wrapper *wrap, pyfov_Settings *settings, PyObject *map) {
+  wrap->orig_map = map;
+  wrap->settings = settings;
+  wrap->threw_exception = false;
+  wrap->native = pyfov_Map_Check(map) ? (pyfov_Map *)map : NULL;
+  wrap->dict = pyfov_DictMap_Check(map) ? (pyfov_DictMap *)map : NULL;
+
+  wrap->subscript = NULL;
+  if (settings->lookup == PYFOV_LOOKUP_ITEM &&
+      map->ob_type->tp_as_mapping != NULL)
+    wrap->subscript = map->ob_type->tp_as_mapping->mp_subscript;
+  memset(wrap->rows, 0, sizeof(wrap->rows));
+  wrap->into = NULL;
+  wrap->lit = NULL;
+  wrap->probes = 0;
+  wrap->applied = 0;
+  wrap->timed = false;
+  wrap->python_ns = 0;
+  wrap->probed = NULL;
+  wrap->duplicates = 0;
+  wrap->watched = NULL;
+  wrap->watch = NULL;
+  wrap->watch_mask = NULL;
+  memset(&wrap->watch_cells, 0, sizeof(wrap->watch_cells));
+  memset(&wrap->fired, 0, sizeof(wrap->fired));
+  wrap->ordered = NULL;
+  wrap->ordered_seen = NULL;
+  wrap->ordered_count = 0;
+  wrap->ordered_max = 0;
+}
+
+/**
+ * Drops the rows the wrapper cached for LOOKUP_ROWS
+ */
+static void
+_pyfov_release_rows(map_wrapper *wrap) {
+  int i;
+
+  for (i = 0; i < PYFOV_ROW_CACHE; ++i)
+    Py_CLEAR(wrap->rows[i]);
+}
+
+/**
+ * Drops whatever the wrapper cached during the sweep.
+ */
+static void
+_pyfov_release_wrap(map_wrapper *wrap) {
+  _pyfov_release_rows(wrap);
+  Py_CLEAR(wrap->watched);
+  pyfov_cellset_clear(&wrap->watch_cells);
+  pyfov_cellset_clear(&wrap->fired);
+}
+
 // Global pyfov callbacks for all calls to fov_beam, etc
 static bool _pyfov_opacity_test_function(void *map, int x, int y);
 static void _pyfov_apply_lighting_function(void *map, int x, int y,
@@ -78,6 +282,11 @@ pyfov_Settings_init(pyfov_Settings *self, PyObject *args, PyObject *kwargs) {
 
   SET_INCREF(self->opacity_test_function, Py_None);
   SET_INCREF(self->apply_lighting_function, Py_None);
+  self->engine = PYFOV_ENGINE_LIBFOV;
+  self->last_engine = PYFOV_ENGINE_LIBFOV;
+  self->lookup = PYFOV_LOOKUP_CALLBACK;
+  Py_XDECREF(self->opaque_tiles);
+  SET_INCREF(self->opaque_tiles, Py_None);
 
   // Init the underlying settings datastructure
   fov_settings_init(&self->settings);
@@ -97,6 +306,7 @@ pyfov_Settings_dealloc(pyfov_Settings *self)
 {
   // Free the underlying implementation
   fov_settings_free(&self->settings);
+  Py_XDECREF(self->opaque_tiles);
   self->ob_type->tp_free(self);
 }
 
@@ -193,6 +403,110 @@ pyfov_Settings_set_opaque_apply(pyfov_Settings *self, PyObject *opaque_apply,
   return 0;
 }
 
+/**
+ * engine
+ */
+static PyObject *
+pyfov_Settings_get_engine(pyfov_Settings *self, void *data) {
+  return PyInt_FromLong(self->engine);
+}
+
+static int
+pyfov_Settings_set_engine(pyfov_Settings *self, PyObject *engine,
+                          void *data) {
+  long lengine = PyInt_AsLong(engine);
+  if (PyErr_Occurred()) {
+    return -1;
+  }
+  if ((lengine < 0 || lengine >= PYFOV_ENGINE_COUNT) &&
+      lengine != PYFOV_ENGINE_AUTO) {
+    PyErr_SetString(PyExc_ValueError, "unknown engine");
+    return -1;
+  }
+  self->engine = (pyfov_engine_type)lengine;
+  return 0;
+}
+
+static PyObject *
+pyfov_Settings_get_last_engine(pyfov_Settings *self, void *data) {
+  return PyInt_FromLong(self->last_engine);
+}
+
+/**
+ * lookup
+ */
+static PyObject *
+pyfov_Settings_get_lookup(pyfov_Settings *self, void *data) {
+  return PyInt_FromLong(self->lookup);
+}
+
+static int
+pyfov_Settings_set_lookup(pyfov_Settings *self, PyObject *lookup,
+                          void *data) {
+  long llookup = PyInt_AsLong(lookup);
+  if (PyErr_Occurred()) {
+    return -1;
+  }
+  if (llookup < 0 || llookup >= PYFOV_LOOKUP_COUNT) {
+    PyErr_SetString(PyExc_ValueError, "unknown lookup");
+    return -1;
+  }
+  self->lookup = (pyfov_lookup_type)llookup;
+  return 0;
+}
+
+/**
+ * opaque_tiles
+ */
+static PyObject *
+pyfov_Settings_get_opaque_tiles(pyfov_Settings *self, void *data) {
+  Py_INCREF(self->opaque_tiles);
+  return self->opaque_tiles;
+}
+
+static int
+pyfov_Settings_set_opaque_tiles(pyfov_Settings *self, PyObject *tiles,
+                                void *data) {
+  PyObject *set, *iter, *tile;
+  long value;
+
+  if (tiles == NULL || tiles == Py_None) {
+    ASSIGN_REFS(self->opaque_tiles, Py_None);
+    return 0;
+  }
+
+  set = PyFrozenSet_New(tiles);
+  if (set == NULL)
+    return -1;
+
+  memset(self->opaque_ints, 0, sizeof(self->opaque_ints));
+  memset(self->opaque_chars, 0, sizeof(self->opaque_chars));
+
+  iter = PyObject_GetIter(set);
+  if (iter == NULL) {
+    Py_DECREF(set);
+    return -1;
+  }
+  while ((tile = PyIter_Next(iter)) != NULL) {
+    if (PyInt_CheckExact(tile)) {
+      value = PyInt_AS_LONG(tile);
+      if (value >= 0 && value < 256)
+        self->opaque_ints[value] = 1;
+    } else if (PyString_CheckExact(tile) && PyString_GET_SIZE(tile) == 1) {
+      self->opaque_chars[(unsigned char)PyString_AS_STRING(tile)[0]] = 1;
+    } else if (PyUnicode_CheckExact(tile) && PyUnicode_GET_SIZE(tile) == 1 &&
+               PyUnicode_AS_UNICODE(tile)[0] < 256) {
+      self->opaque_chars[PyUnicode_AS_UNICODE(tile)[0]] = 1;
+    }
+    Py_DECREF(tile);
+  }
+  Py_DECREF(iter);
+
+  Py_DECREF(self->opaque_tiles);
+  self->opaque_tiles = set;
+  return 0;
+}
+
 static PyGetSetDef pyfov_Settings_properties[] = {
   {"opacity_test_function",
    (getter)pyfov_Settings_get_opacity_test_function,
@@ -214,132 +528,2513 @@ static PyGetSetDef pyfov_Settings_properties[] = {
    (getter)pyfov_Settings_get_opaque_apply,
    (setter)pyfov_Settings_set_opaque_apply,
    "", NULL},
+  {"engine",
+   (getter)pyfov_Settings_get_engine,
+   (setter)pyfov_Settings_set_engine,
+   "", NULL},
+  {"last_engine",
+   (getter)pyfov_Settings_get_last_engine,
+   NULL,
+   "", NULL},
+  {"lookup",
+   (getter)pyfov_Settings_get_lookup,
+   (setter)pyfov_Settings_set_lookup,
+   "", NULL},
+  {"opaque_tiles",
+   (getter)pyfov_Settings_get_opaque_tiles,
+   (setter)pyfov_Settings_set_opaque_tiles,
+   "", NULL},
   /* Sentinel */
   {NULL, NULL, NULL, NULL, NULL},
 };
 
 /**
- * Wrapper for fov_beam
+ * Engine selection
  */
-static PyObject *
-pyfov_Settings_beam(pyfov_Settings *self, PyObject *args) {
-  void *map, *src;
-  int source_x, source_y;
-  unsigned radius;
-  fov_direction_type direction;
-  float angle;
-  map_wrapper wrap;
-
-  if (!PyArg_ParseTuple(args, "OOiiIIf", &map, &src,
-                        &source_x, &source_y, &radius,
-                        &direction, &angle))
-    return NULL;
 
-  // Initialize wrap to pass as map instead of *map.
-  wrap.orig_map = map;
-  wrap.settings = self;
-  wrap.threw_exception = false;
-
-  fov_beam(&self->settings, &wrap, src,
-           source_x, source_y, radius,
-           direction, angle);
+/**
+ * Samples the cells around the source for ENGINE_AUTO: eight directions at
+ * a third and at two thirds of the radius.  Returns the fraction that are
+ * opaque, or -1 for maps read through opacity_test_function, which aren't
+ * sampled since that would call back into python.
+ */
+static float
+_pyfov_density(pyfov_Settings *self, map_wrapper *wrap,
+               int source_x, int source_y, unsigned radius) {
+  static const int dirs[8][2] = {
+    {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1},
+  };
+  int i, k, d, opaque = 0;
+
+  if (wrap->native == NULL && wrap->dict == NULL &&
+      self->lookup == PYFOV_LOOKUP_CALLBACK)
+    return -1.0f;
+
+  for (k = 1; k <= 2; ++k) {
+    d = (int)(radius * k + 2) / 3;
+    for (i = 0; i < 8; ++i)
+      opaque += self->settings.opaque(wrap, source_x + dirs[i][0] * d,
+                                      source_y + dirs[i][1] * d);
+  }
+  return opaque / 16.0f;
+}
 
-  if (wrap.threw_exception)
-    return NULL;
+/**
+ * The engine a sweep of `radius` around the source runs.  `bitboard` says
+ * whether the sweep could run on the map's bitboards.
+ */
+static pyfov_engine_type
+_pyfov_pick_engine(pyfov_Settings *self, map_wrapper *wrap,
+                   int source_x, int source_y, unsigned radius,
+                   bool bitboard) {
+  pyfov_map_kind kind;
+
+  if (self->engine != PYFOV_ENGINE_AUTO)
+    return self->engine;
+
+  if (wrap->native != NULL)
+    kind = PYFOV_KIND_MAP;
+  else if (wrap->dict != NULL)
+    kind = PYFOV_KIND_DICT;
+  else if (self->lookup != PYFOV_LOOKUP_CALLBACK)
+    kind = PYFOV_KIND_LOOKUP;
+  else
+    kind = PYFOV_KIND_CALLBACK;
+
+  return pyfov_profile_choose(kind, radius,
+                              _pyfov_density(self, wrap, source_x, source_y,
+                                             radius),
+                              bitboard);
+}
 
-  Py_INCREF(Py_None);
-  return Py_None;
+/**
+ * Runs fov_circle on a square fov.Map's bitboards, and masks the lit cells
+ * to the map.  Returns -1 with an exception set if the map has no
+ * bitboards.
+ */
+static int
+_pyfov_bitboard_lit(pyfov_Settings *self, pyfov_Map *native,
+                    int source_x, int source_y, unsigned radius,
+                    uint64_t *lit) {
+  pyfov_bitboard *board;
+  uint64_t mask;
+  int y;
+
+  if ((board = pyfov_map_bitboard(native)) == NULL)
+    return -1;
+  pyfov_bitboard_circle(&self->settings, board, source_x, source_y,
+                        radius, lit);
+
+  // Opaque cells off the map may have been lit
+  mask = native->width == 64 ? ~(uint64_t)0 :
+    ((uint64_t)1 << native->width) - 1;
+  for (y = 0; y < 64; ++y)
+    lit[y] = y < native->height ? lit[y] & mask : 0;
+  return 0;
 }
 
 /**
- * Wrapper for fov_circle
+ * Whether a circle can be swept on the bitboards of `native` (which may be
+ * NULL) and light the same cells as the other engines.  Those light the
+ * walls just off the edge of the map, which bitboards can't hold, unless
+ * they stay inside the map or opaque cells aren't lit.  Halos aren't held
+ * either.
  */
-static PyObject *
-pyfov_Settings_circle(pyfov_Settings *self, PyObject *args) {
-  void *map, *src;
-  int source_x, source_y;
-  unsigned radius;
-  map_wrapper wrap;
+static bool
+_pyfov_bitboard_fits(pyfov_Settings *self, pyfov_Map *native,
+                     int source_x, int source_y, unsigned radius) {
+  int r = (int)radius;
+
+  if (native == NULL || native->cells == NULL ||
+      native->layout != PYFOV_MAP_SQUARE || native->halo > 0 ||
+      native->width > 64 || native->height > 64 ||
+      source_x < 0 || source_y < 0 ||
+      source_x >= native->width || source_y >= native->height)
+    return false;
+  return self->settings.opaque_apply == FOV_OPAQUE_NOAPPLY ||
+    (source_x - r >= 0 && source_y - r >= 0 &&
+     source_x + r < native->width && source_y + r < native->height);
+}
 
-  if (!PyArg_ParseTuple(args, "OOiiI", &map, &src,
-                        &source_x, &source_y, &radius))
-    return NULL;
+/**
+ * A circle picked by ENGINE_AUTO to run on the map's bitboards.  The lit
+ * cells are applied row by row once the sweep is done.
+ */
+static void
+_pyfov_bitboard_sweep(pyfov_Settings *self, map_wrapper *wrap,
+                      PyObject *src, int source_x, int source_y,
+                      unsigned radius) {
+  uint64_t lit[64], word;
+  int x, y;
+
+  if (_pyfov_bitboard_lit(self, wrap->native, source_x, source_y, radius,
+                          lit) < 0) {
+    wrap->threw_exception = true;
+    return;
+  }
+  for (y = 0; y < 64 && !wrap->threw_exception; ++y) {
+    for (word = lit[y]; word != 0 && !wrap->threw_exception;
+         word &= word - 1) {
+      x = __builtin_ctzll(word);
+      self->settings.apply(wrap, x, y, x - source_x, y - source_y, src);
+    }
+  }
+}
 
-  // Initialize wrap to pass as map instead of *map.
-  wrap.orig_map = map;
-  wrap.settings = self;
-  wrap.threw_exception = false;
+/**
+ * Output helpers shared by beam and circle
+ */
 
-  fov_circle(&self->settings, &wrap, src,
-             source_x, source_y, radius);
+/**
+ * Checks that `visibility` is None or a writable buffer with rows of
+ * `width` bytes.
+ */
+static int
+_pyfov_check_visibility(PyObject *visibility, int width) {
+  void *buf;
+  Py_ssize_t len;
 
-  if (wrap.threw_exception)
-    return NULL;
+  if (visibility == Py_None)
+    return 0;
+  if (PyObject_AsWriteBuffer(visibility, &buf, &len) < 0)
+    return -1;
+  if (width <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "visibility requires a positive width");
+    return -1;
+  }
+  return 0;
+}
 
-  Py_INCREF(Py_None);
-  return Py_None;
+/**
+ * Writes the coverage of a sweep into the uint8 `visibility` buffer as
+ * 0-255 per cell.  Each cell keeps the larger of its old and new value, so
+ * several sources can share one buffer.  Cells outside of the buffer are
+ * dropped.
+ *
+ * The buffer is only fetched after the sweep, since callbacks may have
+ * resized it in the meantime.
+ */
+static int
+_pyfov_write_visibility(PyObject *visibility, int width, float *coverage,
+                        map_wrapper *wrap,
+                        int source_x, int source_y, unsigned radius) {
+  unsigned char *buf;
+  Py_ssize_t len, height;
+  int side = 2 * (int)radius + 1;
+  int i, j, x, y;
+  float c;
+  unsigned char value;
+
+  if (PyObject_AsWriteBuffer(visibility, (void **)&buf, &len) < 0)
+    return -1;
+  height = len / width;
+
+  // The source can always see all of itself
+  coverage[radius * side + radius] = 1.0f;
+
+  for (j = 0; j < side; ++j) {
+    for (i = 0; i < side; ++i) {
+      x = source_x - (int)radius + i;
+      y = source_y - (int)radius + j;
+      if (wrap->native != NULL)
+        pyfov_map_to_storage(wrap->native, x, y, &x, &y);
+      if (x < 0 || y < 0 || x >= width || y >= height)
+        continue;
+      c = coverage[j * side + i];
+      value = (unsigned char)((c < 1.0f ? c : 1.0f) * 255.0f + 0.5f);
+      if (value > buf[y * width + x])
+        buf[y * width + x] = value;
+    }
+  }
+  return 0;
 }
 
+/**
+ * Sets up `wrap` to watch the cells of `watch`: a fov.WatchSet, a uint8
+ * mask with rows of `width` bytes, or an iterable of (x, y) cells.
+ * Returns 0, or -1 with an exception set.
+ */
+static int
+_pyfov_init_watch(map_wrapper *wrap, PyObject *watch, int width) {
+  const void *mask;
+
+  if (pyfov_WatchSet_Check(watch)) {
+    wrap->watch = &((pyfov_WatchSet *)watch)->cells;
+  } else if (PyObject_CheckReadBuffer(watch)) {
+    if (width <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "a watch mask requires a positive width");
+      return -1;
+    }
+    if (PyObject_AsReadBuffer(watch, &mask, &wrap->watch_len) < 0)
+      return -1;
+    wrap->watch_mask = mask;
+    wrap->watch_width = width;
+  } else {
+    if (pyfov_cellset_update(&wrap->watch_cells, watch) < 0)
+      return -1;
+    wrap->watch = &wrap->watch_cells;
+  }
+  return (wrap->watched = PyList_New(0)) != NULL ? 0 : -1;
+}
 
 /**
- * Stub for SettingsType
+ * Appends the lit cell (x, y), in storage coordinates, to the watched
+ * cells if it's watched and hasn't been appended yet.  Returns 0, or -1
+ * with an exception set.
  */
-static PyTypeObject pyfov_SettingsType = {
-  PyObject_HEAD_INIT(NULL)
-};
+static int
+_pyfov_watch_cell(map_wrapper *wrap, int x, int y) {
+  PyObject *cell;
+  int added, result;
+
+  if (wrap->watch_mask != NULL) {
+    if (x < 0 || y < 0 || x >= wrap->watch_width ||
+        (Py_ssize_t)y * wrap->watch_width + x >= wrap->watch_len ||
+        wrap->watch_mask[y * wrap->watch_width + x] == 0)
+      return 0;
+  } else if (!pyfov_cellset_contains(wrap->watch, x, y)) {
+    return 0;
+  }
 
+  if ((added = pyfov_cellset_add(&wrap->fired, x, y)) <= 0) {
+    if (added < 0)
+      PyErr_NoMemory();
+    return added;
+  }
+  if ((cell = Py_BuildValue("(ii)", x, y)) == NULL)
+    return -1;
+  result = PyList_Append(wrap->watched, cell);
+  Py_DECREF(cell);
+  return result;
+}
 
-static bool
-_pyfov_opacity_test_function(void *map, int x, int y) {
-  PyObject *arglist;
-  PyObject *result;
-  map_wrapper *wrap = (map_wrapper *)map;
-  bool test_func_result;
+/**
+ * Sets up `wrap` to record the lit cells for ordered=, `ordered` being a
+ * writable buffer.  Returns 0, or -1 with an exception set.
+ */
+static int
+_pyfov_init_ordered(map_wrapper *wrap, PyObject *ordered, unsigned radius) {
+  size_t side = 2 * (size_t)radius + 1;
+  void *buf;
+  Py_ssize_t len;
 
-  // Early out if no user-callback was set
-  if (wrap->settings->opacity_test_function == Py_None)
-    return false;
+  if (PyObject_AsWriteBuffer(ordered, &buf, &len) < 0)
+    return -1;
+  wrap->ordered_size = 64;
+  wrap->ordered = malloc(wrap->ordered_size * sizeof(pyfov_target));
+  wrap->ordered_seen = calloc(side * side, 1);
+  wrap->ordered_radius = radius;
+  if (wrap->ordered == NULL || wrap->ordered_seen == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
 
-  // Pack up the C return values to python objects
-  arglist = Py_BuildValue("(Oii)", (PyObject *)wrap->orig_map, x, y);
-  result = PyObject_CallObject(wrap->settings->opacity_test_function,
-                               arglist);
+/**
+ * Records the cell (x, y), lit at (dx, dy) from the source in the
+ * engines' coordinates, for ordered=.  Returns 0, or -1 with an exception
+ * set.
+ */
+static int
+_pyfov_order_cell(map_wrapper *wrap, int x, int y, int dx, int dy) {
+  size_t side = 2 * (size_t)wrap->ordered_radius + 1, size;
+  unsigned char *seen = NULL;
+  pyfov_target *cell, *ordered;
+
+  if ((unsigned)abs(dx) <= wrap->ordered_radius &&
+      (unsigned)abs(dy) <= wrap->ordered_radius) {
+    seen = &wrap->ordered_seen[(dy + wrap->ordered_radius) * side +
+                               dx + wrap->ordered_radius];
+    if (*seen)
+      return 0;
+  }
+  if (wrap->ordered_count == wrap->ordered_size) {
+    size = 2 * wrap->ordered_size;
+    ordered = realloc(wrap->ordered, size * sizeof(pyfov_target));
+    if (ordered == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    wrap->ordered = ordered;
+    wrap->ordered_size = size;
+  }
+  if (seen != NULL)
+    *seen = 1;
+
+  cell = &wrap->ordered[wrap->ordered_count++];
+  // Hex maps are swept in axial coordinates, where the radius is a hex
+  // distance
+  if (wrap->native != NULL && wrap->native->layout == PYFOV_MAP_HEX)
+    cell->distance = (abs(dx) + abs(dy) + abs(dx + dy)) / 2;
+  else
+    cell->distance = pyfov_shape_distance(wrap->settings->settings.shape,
+                                          dx, dy);
+  if (cell->distance > wrap->ordered_max)
+    wrap->ordered_max = cell->distance;
+  if (wrap->native != NULL)
+    pyfov_map_to_storage(wrap->native, x, y, &x, &y);
+  cell->x = x;
+  cell->y = y;
+  return 0;
+}
 
-  Py_DECREF(arglist);
+/**
+ * Writes the recorded cells to the int32 buffer `ordered` as (x, y)
+ * pairs, nearest first, by counting them into one bucket per distance.
+ * Cells at the same distance keep the order they were lit in, and cells
+ * that don't fit are dropped.  Returns the number of cells written, or -1
+ * with an exception set.
+ */
+static Py_ssize_t
+_pyfov_write_ordered(PyObject *ordered, map_wrapper *wrap) {
+  size_t *starts, i, n, at;
+  int32_t *buf;
+  Py_ssize_t len, capacity;
 
-  // If the callback threw an exception, we trace back through the C code...
-  // We should really stop the execution of additional callbacks, but I'm not
-  // sure if this can be done without doing something super gnarly with the
-  // raw C settings object.
-  if (result == NULL) {
-    wrap->threw_exception = true;
-    return false;
+  if (PyObject_AsWriteBuffer(ordered, (void **)&buf, &len) < 0)
+    return -1;
+  capacity = len / (2 * (Py_ssize_t)sizeof(int32_t));
+  n = wrap->ordered_count < (size_t)capacity ? wrap->ordered_count :
+    (size_t)capacity;
+  if (n == 0)
+    return 0;
+  if ((starts = calloc(wrap->ordered_max + 2, sizeof(size_t))) == NULL) {
+    PyErr_NoMemory();
+    return -1;
   }
 
-  test_func_result = (bool)PyInt_AsLong(result);
-  Py_DECREF(result);
+  for (i = 0; i < wrap->ordered_count; ++i)
+    ++starts[wrap->ordered[i].distance + 1];
+  for (i = 1; i <= wrap->ordered_max; ++i)
+    starts[i] += starts[i - 1];
+  for (i = 0; i < wrap->ordered_count; ++i) {
+    at = starts[wrap->ordered[i].distance]++;
+    if (at >= n)
+      continue;
+    buf[2 * at] = wrap->ordered[i].x;
+    buf[2 * at + 1] = wrap->ordered[i].y;
+  }
+  free(starts);
+  return (Py_ssize_t)n;
+}
 
-  return test_func_result;
+/**
+ * Turns an engine's return code into a python exception
+ */
+static PyObject *
+_pyfov_engine_error(int result) {
+  if (result == PYFOV_ENGINE_UNSUPPORTED) {
+    PyErr_SetString(PyExc_ValueError,
+                    "this engine can't produce the requested output");
+    return NULL;
+  }
+  return PyErr_NoMemory();
 }
 
-static void
-_pyfov_apply_lighting_function(void *map, int x, int y, int dx, int dy,
-                               void *src) {
-  PyObject *arglist;
-  PyObject *result;
-  map_wrapper *wrap = (map_wrapper *)map;
+/**
+ * Optional outputs of a beam or circle call, on top of the lighting
+ * callback.
+ */
+typedef struct {
+  /* uint8 buffer for the visible fraction of each cell, or Py_None */
+  PyObject *visibility;
+  /* Cells per row of the output buffers */
+  int width;
+  /* set or dict to add lit cells to, or Py_None */
+  PyObject *into;
+  /* Counts the lit cells instead of applying them, when set */
+  unsigned long *lit;
+  /* Describe the sweep in the result's explain */
+  int explain;
+  /* WatchSet, iterable of cells or uint8 mask to watch, or Py_None */
+  PyObject *watch;
+  /* int32 buffer for lit cells nearest first, or Py_None */
+  PyObject *ordered;
+} pyfov_outputs;
+
+/**
+ * Lazy sweeps
+ *
+ * Iterators over the lit cells of a circle, which only sweep as far as
+ * they are consumed
+ */
+typedef struct {
+  PyObject_HEAD
+  pyfov_Settings *settings;
+  PyObject *map;
+  map_wrapper wrap;
+  /* NULL once the sweep is done */
+  pyfov_sweep_iter *sweep;
+} pyfov_SweepIter;
+
+static PyTypeObject pyfov_SweepIterType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+/**
+ * Stops the sweep, counting as much of it as was taken and dropping
+ * whatever it held on to
+ */
+static void
+_pyfov_SweepIter_finish(pyfov_SweepIter *self) {
+  if (self->sweep == NULL)
+    return;
+  pyfov_metrics_sweep(PYFOV_ENGINE_RECURSIVE_SHADOWCAST, self->wrap.probes,
+                      self->wrap.applied);
+  pyfov_sweep_iter_free(self->sweep);
+  self->sweep = NULL;
+  _pyfov_release_wrap(&self->wrap);
+}
+
+static void
+pyfov_SweepIter_dealloc(pyfov_SweepIter *self) {
+  _pyfov_SweepIter_finish(self);
+  Py_XDECREF(self->settings);
+  Py_XDECREF(self->map);
+  self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyObject *
+pyfov_SweepIter_next(pyfov_SweepIter *self) {
+  int x, y, result;
+
+  if (self->sweep == NULL)
+    return NULL;
+
+  // The map's rows may have changed since the last cell was taken
+  _pyfov_release_rows(&self->wrap);
+  result = pyfov_sweep_iter_next(self->sweep, &x, &y);
+  if (result <= 0 || self->wrap.threw_exception) {
+    _pyfov_SweepIter_finish(self);
+    if (result < 0 && !PyErr_Occurred())
+      PyErr_NoMemory();
+    return NULL;
+  }
+
+  ++self->wrap.applied;
+  if (self->wrap.native != NULL)
+    pyfov_map_to_storage(self->wrap.native, x, y, &x, &y);
+  return Py_BuildValue("(ii)", x, y);
+}
+
+/**
+ * Returns an iterator over the (x, y) cells fov_circle lights, which
+ * sweeps on only as cells are taken from it, ring by ring.  No lighting
+ * callbacks are made, and Settings.engine doesn't apply.
+ */
+static PyObject *
+pyfov_Settings_iter_circle(pyfov_Settings *self, PyObject *args,
+                           PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source_x", "source_y", "radius", NULL};
+  PyObject *map;
+  int source_x, source_y;
+  unsigned radius;
+  pyfov_SweepIter *iter;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OiiI", kwlist,
+                                   &map, &source_x, &source_y, &radius))
+    return NULL;
+
+  iter = PyObject_New(pyfov_SweepIter, &pyfov_SweepIterType);
+  if (iter == NULL)
+    return NULL;
+  Py_INCREF(self);
+  iter->settings = self;
+  Py_INCREF(map);
+  iter->map = map;
+  iter->sweep = NULL;
+  _pyfov_init_wrap(&iter->wrap, self, map);
+
+  if (iter->wrap.native != NULL) {
+    if (iter->wrap.native->layout == PYFOV_MAP_HEX) {
+      PyErr_SetString(PyExc_ValueError,
+                      "iter_circle can't sweep hex maps");
+      Py_DECREF(iter);
+      return NULL;
+    }
+    pyfov_map_from_storage(iter->wrap.native, source_x, source_y,
+                           &source_x, &source_y);
+  }
+
+  iter->sweep = pyfov_sweep_iter_new(&self->settings, &iter->wrap,
+                                     source_x, source_y, radius, false);
+  if (iter->sweep == NULL) {
+    Py_DECREF(iter);
+    return PyErr_NoMemory();
+  }
+  return (PyObject *)iter;
+}
+
+/**
+ * Stub for SettingsType
+ */
+static PyTypeObject pyfov_SettingsType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+/**
+ * Viewers
+ *
+ * A circle kept lit for one source, whose radius can be changed without
+ * sweeping again from scratch: a rewindable sweep is taken back to the
+ * first column the new radius lights differently, the cells lit from
+ * there on are dropped, and the sweep carries on with the new radius.
+ */
+typedef struct {
+  PyObject_HEAD
+  pyfov_Settings *settings;
+  PyObject *map;
+  map_wrapper wrap;
+  /* The source in storage and in the engines' coordinates */
+  int source_x, source_y;
+  int sweep_x, sweep_y;
+  unsigned radius;
+  /* NULL until the first sweep, and after a sweep fails */
+  pyfov_sweep_iter *sweep;
+  /* The lit cells in storage coordinates as (x, y) pairs, in the order
+   * they were lit, and as a set */
+  int *cells;
+  size_t count, size;
+  pyfov_cellset lit;
+  /* What to watch as for circle's watch=, or Py_None, and the watched
+   * cells the last sweep lit that weren't lit before it, or NULL */
+  PyObject *watch;
+  int width;
+  PyObject *watched;
+  /* While sweeping with watch=, the cells lit before the sweep that it
+   * may light again */
+  pyfov_cellset before;
+} pyfov_Viewer;
+
+static PyTypeObject pyfov_ViewerType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+/**
+ * Drops the sweep and the cells lit so far
+ */
+static void
+_pyfov_Viewer_reset(pyfov_Viewer *self) {
+  pyfov_sweep_iter_free(self->sweep);
+  self->sweep = NULL;
+  self->count = 0;
+  pyfov_cellset_clear(&self->lit);
+}
+
+/**
+ * Lights the circle of `radius`, rewinding the sweep if there is one, and
+ * collects the watched cells it newly lights.  Returns 0, or -1 with an
+ * exception set and the viewer reset.
+ */
+static int
+_pyfov_Viewer_sweep(pyfov_Viewer *self, unsigned radius) {
+  unsigned long kept;
+  size_t size;
+  int *cells;
+  int x, y, result;
+  PyObject *watched;
+
+  if (self->watch != Py_None &&
+      _pyfov_init_watch(&self->wrap, self->watch, self->width) < 0) {
+    _pyfov_release_wrap(&self->wrap);
+    pyfov_cellset_clear(&self->before);
+    _pyfov_Viewer_reset(self);
+    return -1;
+  }
+
+  if (self->sweep == NULL) {
+    self->sweep = pyfov_sweep_iter_new(&self->settings->settings,
+                                       &self->wrap, self->sweep_x,
+                                       self->sweep_y, radius, true);
+    if (self->sweep == NULL) {
+      result = PYFOV_ENGINE_NOMEM;
+      goto done;
+    }
+  } else {
+    if (pyfov_sweep_iter_rewind(self->sweep, radius, &kept) < 0) {
+      result = PYFOV_ENGINE_NOMEM;
+      goto done;
+    }
+    for (; self->count > kept; --self->count) {
+      x = self->cells[2 * self->count - 2];
+      y = self->cells[2 * self->count - 1];
+      pyfov_cellset_remove(&self->lit, x, y);
+      if (self->wrap.watched != NULL &&
+          pyfov_cellset_add(&self->before, x, y) < 0) {
+        result = PYFOV_ENGINE_NOMEM;
+        goto done;
+      }
+    }
+  }
+  self->radius = radius;
+
+  self->wrap.threw_exception = false;
+  while ((result = pyfov_sweep_iter_next(self->sweep, &x, &y)) > 0 &&
+         !self->wrap.threw_exception) {
+    if (self->wrap.native != NULL)
+      pyfov_map_to_storage(self->wrap.native, x, y, &x, &y);
+    if (self->count == self->size) {
+      size = self->size == 0 ? 64 : 2 * self->size;
+      if ((cells = realloc(self->cells, 2 * size * sizeof(int))) == NULL) {
+        result = PYFOV_ENGINE_NOMEM;
+        break;
+      }
+      self->cells = cells;
+      self->size = size;
+    }
+    if (pyfov_cellset_add(&self->lit, x, y) < 0) {
+      result = PYFOV_ENGINE_NOMEM;
+      break;
+    }
+    self->cells[2 * self->count] = x;
+    self->cells[2 * self->count + 1] = y;
+    ++self->count;
+    if (self->wrap.watched != NULL &&
+        !pyfov_cellset_contains(&self->before, x, y) &&
+        _pyfov_watch_cell(&self->wrap, x, y) < 0)
+      self->wrap.threw_exception = true;
+  }
+
+done:
+  watched = self->wrap.watched;
+  self->wrap.watched = NULL;
+  // Rows are fetched again next sweep, in case the map changed
+  _pyfov_release_wrap(&self->wrap);
+  pyfov_cellset_clear(&self->before);
+
+  if (self->wrap.threw_exception || result < 0) {
+    Py_XDECREF(watched);
+    _pyfov_Viewer_reset(self);
+    if (!PyErr_Occurred())
+      PyErr_NoMemory();
+    return -1;
+  }
+  Py_XDECREF(self->watched);
+  self->watched = watched;
+  return 0;
+}
+
+static int
+pyfov_Viewer_init(pyfov_Viewer *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"settings", "map", "source_x", "source_y",
+                           "radius", "watch", "width", NULL};
+  pyfov_Settings *settings;
+  PyObject *map, *watch = Py_None, *tmp;
+  int source_x, source_y, width = 0;
+  unsigned radius;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!OiiI|Oi", kwlist,
+                                   &pyfov_SettingsType, &settings, &map,
+                                   &source_x, &source_y, &radius,
+                                   &watch, &width))
+    return -1;
+  if (pyfov_Map_Check(map) &&
+      ((pyfov_Map *)map)->layout == PYFOV_MAP_HEX) {
+    PyErr_SetString(PyExc_ValueError, "viewers can't sweep hex maps");
+    return -1;
+  }
+
+  _pyfov_Viewer_reset(self);
+  tmp = (PyObject *)self->settings;
+  Py_INCREF(settings);
+  self->settings = settings;
+  Py_XDECREF(tmp);
+  tmp = self->map;
+  Py_INCREF(map);
+  self->map = map;
+  Py_XDECREF(tmp);
+  tmp = self->watch;
+  Py_INCREF(watch);
+  self->watch = watch;
+  Py_XDECREF(tmp);
+  self->width = width;
+  Py_CLEAR(self->watched);
+
+  _pyfov_init_wrap(&self->wrap, settings, map);
+  self->source_x = self->sweep_x = source_x;
+  self->source_y = self->sweep_y = source_y;
+  if (self->wrap.native != NULL)
+    pyfov_map_from_storage(self->wrap.native, source_x, source_y,
+                           &self->sweep_x, &self->sweep_y);
+  return _pyfov_Viewer_sweep(self, radius);
+}
+
+static void
+pyfov_Viewer_dealloc(pyfov_Viewer *self) {
+  _pyfov_Viewer_reset(self);
+  free(self->cells);
+  if (self->settings != NULL)
+    _pyfov_release_wrap(&self->wrap);
+  Py_XDECREF(self->settings);
+  Py_XDECREF(self->map);
+  Py_XDECREF(self->watch);
+  Py_XDECREF(self->watched);
+  self->ob_type->tp_free((PyObject *)self);
+}
+
+/**
+ * Lights the circle again from scratch, after the map or settings change
+ */
+static PyObject *
+pyfov_Viewer_refresh(pyfov_Viewer *self) {
+  if (self->settings == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Viewer.__init__ wasn't called");
+    return NULL;
+  }
+  // Watched cells that stay lit aren't reported again
+  if (self->watch != Py_None) {
+    self->before = self->lit;
+    memset(&self->lit, 0, sizeof(self->lit));
+  }
+  _pyfov_Viewer_reset(self);
+  if (_pyfov_Viewer_sweep(self, self->radius) < 0)
+    return NULL;
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pyfov_Viewer_get_radius(pyfov_Viewer *self, void *data) {
+  return PyInt_FromSize_t(self->radius);
+}
+
+static int
+pyfov_Viewer_set_radius(pyfov_Viewer *self, PyObject *value, void *data) {
+  long radius;
+
+  if (value == NULL) {
+    PyErr_SetString(PyExc_TypeError, "can't delete radius");
+    return -1;
+  }
+  radius = PyInt_AsLong(value);
+  if (radius == -1 && PyErr_Occurred())
+    return -1;
+  if (radius < 0) {
+    PyErr_SetString(PyExc_ValueError, "radius can't be negative");
+    return -1;
+  }
+  if (self->settings == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Viewer.__init__ wasn't called");
+    return -1;
+  }
+  return _pyfov_Viewer_sweep(self, (unsigned)radius);
+}
+
+static PyObject *
+pyfov_Viewer_get_watched(pyfov_Viewer *self, void *data) {
+  PyObject *watched = self->watched != NULL ? self->watched : Py_None;
+
+  Py_INCREF(watched);
+  return watched;
+}
+
+static PyObject *
+pyfov_Viewer_get_source_x(pyfov_Viewer *self, void *data) {
+  return PyInt_FromLong(self->source_x);
+}
+
+static PyObject *
+pyfov_Viewer_get_source_y(pyfov_Viewer *self, void *data) {
+  return PyInt_FromLong(self->source_y);
+}
+
+static Py_ssize_t
+pyfov_Viewer_len(pyfov_Viewer *self) {
+  return (Py_ssize_t)self->count;
+}
+
+static int
+pyfov_Viewer_contains(pyfov_Viewer *self, PyObject *cell) {
+  int x, y;
+
+  if (!PyTuple_Check(cell) || PyTuple_GET_SIZE(cell) != 2)
+    return 0;
+  x = (int)PyInt_AsLong(PyTuple_GET_ITEM(cell, 0));
+  y = (int)PyInt_AsLong(PyTuple_GET_ITEM(cell, 1));
+  if (PyErr_Occurred()) {
+    PyErr_Clear();
+    return 0;
+  }
+  return pyfov_cellset_contains(&self->lit, x, y);
+}
+
+/**
+ * Iterates over a list of the lit cells, ring by ring
+ */
+static PyObject *
+pyfov_Viewer_iter(pyfov_Viewer *self) {
+  PyObject *cells = PyList_New(self->count), *cell, *iter;
+  size_t i;
+
+  if (cells == NULL)
+    return NULL;
+  for (i = 0; i < self->count; ++i) {
+    cell = Py_BuildValue("(ii)", self->cells[2 * i], self->cells[2 * i + 1]);
+    if (cell == NULL) {
+      Py_DECREF(cells);
+      return NULL;
+    }
+    PyList_SET_ITEM(cells, i, cell);
+  }
+  iter = PyObject_GetIter(cells);
+  Py_DECREF(cells);
+  return iter;
+}
+
+static PyMethodDef pyfov_Viewer_methods[] = {
+  {"refresh", (PyCFunction)pyfov_Viewer_refresh, METH_NOARGS, NULL},
+  {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+static PyGetSetDef pyfov_Viewer_properties[] = {
+  {"radius",
+   (getter)pyfov_Viewer_get_radius,
+   (setter)pyfov_Viewer_set_radius,
+   "", NULL},
+  {"source_x", (getter)pyfov_Viewer_get_source_x, NULL, "", NULL},
+  {"source_y", (getter)pyfov_Viewer_get_source_y, NULL, "", NULL},
+  {"watched", (getter)pyfov_Viewer_get_watched, NULL, "", NULL},
+  /* Sentinel */
+  {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PySequenceMethods pyfov_Viewer_sequence = {
+  (lenfunc)pyfov_Viewer_len,
+  0, 0, 0, 0, 0, 0,
+  (objobjproc)pyfov_Viewer_contains,
+};
+
+/**
+ * Whether the cell (x, y) is a target: a nonzero byte of `mask`, rows of
+ * `width` bytes, or else in the container `targets`.  Returns 1 or 0, or
+ * -1 with an exception set.
+ */
+static int
+_pyfov_is_target(PyObject *targets, const unsigned char *mask,
+                 Py_ssize_t mask_len, int width, int x, int y) {
+  PyObject *key;
+  int found;
+
+  if (mask != NULL)
+    return x >= 0 && y >= 0 && x < width &&
+      (Py_ssize_t)y * width + x < mask_len && mask[y * width + x] != 0;
+  if ((key = Py_BuildValue("(ii)", x, y)) == NULL)
+    return -1;
+  found = PySequence_Contains(targets, key);
+  Py_DECREF(key);
+  return found;
+}
+
+/**
+ * Returns the `k` visible targets nearest the source, nearest first, as a
+ * list of (x, y).  The circle is swept lazily, ring by ring, and stops
+ * once no ring further out can hold a nearer target than the k found.
+ */
+static PyObject *
+pyfov_Settings_nearest(pyfov_Settings *self, PyObject *args,
+                       PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source_x", "source_y", "radius",
+                           "targets", "k", "width", NULL};
+  PyObject *map, *targets, *result = NULL, *cell;
+  int source_x, source_y, k = 1, width = 0;
+  int x, y, sx, sy, found = 0, i, status;
+  unsigned radius, ring;
+  unsigned long distance;
+  const void *mask = NULL;
+  Py_ssize_t mask_len = 0;
+  pyfov_target *best = NULL;
+  pyfov_sweep_iter *sweep = NULL;
+  map_wrapper wrap;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OiiIO|ii", kwlist,
+                                   &map, &source_x, &source_y, &radius,
+                                   &targets, &k, &width))
+    return NULL;
+  if (k < 1) {
+    PyErr_SetString(PyExc_ValueError, "k must be positive");
+    return NULL;
+  }
+  if (width > 0 && PyObject_AsReadBuffer(targets, &mask, &mask_len) < 0)
+    return NULL;
+
+  _pyfov_init_wrap(&wrap, self, map);
+  if (wrap.native != NULL) {
+    if (wrap.native->layout == PYFOV_MAP_HEX) {
+      PyErr_SetString(PyExc_ValueError, "nearest can't sweep hex maps");
+      goto done;
+    }
+    pyfov_map_from_storage(wrap.native, source_x, source_y,
+                           &source_x, &source_y);
+  }
+
+  // No more targets than cells in range can be found
+  if ((unsigned long)k > 4UL * ((unsigned long)radius + 1) * (radius + 1))
+    k = (int)(4UL * ((unsigned long)radius + 1) * (radius + 1));
+  best = PyMem_Malloc(k * sizeof(pyfov_target));
+  sweep = pyfov_sweep_iter_new(&self->settings, &wrap, source_x, source_y,
+                               radius, false);
+  if (best == NULL || sweep == NULL) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  while ((status = pyfov_sweep_iter_next(sweep, &x, &y)) > 0 &&
+         !wrap.threw_exception) {
+    ring = pyfov_sweep_iter_ring(sweep);
+    if (found == k && (unsigned long)ring * ring >= best[k - 1].distance)
+      break;
+    ++wrap.applied;
+
+    sx = x;
+    sy = y;
+    if (wrap.native != NULL)
+      pyfov_map_to_storage(wrap.native, x, y, &sx, &sy);
+    status = _pyfov_is_target(targets, mask, mask_len, width, sx, sy);
+    if (status < 0)
+      goto done;
+    if (status == 0)
+      continue;
+
+    distance = (unsigned long)(x - source_x) * (x - source_x) +
+      (unsigned long)(y - source_y) * (y - source_y);
+    if (found == k && distance >= best[k - 1].distance)
+      continue;
+    // Insert in order, after any target as near
+    i = found < k ? found++ : k - 1;
+    for (; i > 0 && best[i - 1].distance > distance; --i)
+      best[i] = best[i - 1];
+    best[i].x = sx;
+    best[i].y = sy;
+    best[i].distance = distance;
+  }
+  pyfov_metrics_sweep(PYFOV_ENGINE_RECURSIVE_SHADOWCAST, wrap.probes,
+                      wrap.applied);
+  if (wrap.threw_exception)
+    goto done;
+  if (status < 0) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  if ((result = PyList_New(found)) == NULL)
+    goto done;
+  for (i = 0; i < found; ++i) {
+    if ((cell = Py_BuildValue("(ii)", best[i].x, best[i].y)) == NULL) {
+      Py_CLEAR(result);
+      goto done;
+    }
+    PyList_SET_ITEM(result, i, cell);
+  }
+
+done:
+  pyfov_sweep_iter_free(sweep);
+  PyMem_Free(best);
+  _pyfov_release_wrap(&wrap);
+  return result;
+}
+
+/**
+ * Adds `value` (a new reference, or NULL) to the dict `dict` under `key`.
+ * Returns 0, or -1 with an exception set.
+ */
+static int
+_pyfov_dict_steal(PyObject *dict, const char *key, PyObject *value) {
+  int result;
+
+  if (value == NULL)
+    return -1;
+  result = PyDict_SetItemString(dict, key, value);
+  Py_DECREF(value);
+  return result;
+}
+
+/**
+ * Describes a sweep for explain mode: the engine run and the path the map
+ * was read through, what the sweep probed and lit, and where its time
+ * went.
+ */
+static PyObject *
+_pyfov_explain(pyfov_Settings *self, map_wrapper *wrap,
+               pyfov_engine_stats *stats, uint64_t ns) {
+  PyObject *dict, *octants, *peak;
+  const char *path;
+  int i;
+
+  if (self->last_engine == PYFOV_ENGINE_BITBOARD)
+    path = "bitboard";
+  else if (wrap->native != NULL)
+    path = "map";
+  else if (wrap->dict != NULL)
+    path = "dict";
+  else if (self->lookup != PYFOV_LOOKUP_CALLBACK)
+    path = "lookup";
+  else
+    path = "callback";
+
+  if ((dict = PyDict_New()) == NULL)
+    return NULL;
+
+  if (stats->sections > 0) {
+    if ((octants = PyList_New(stats->sections)) == NULL)
+      goto fail;
+    for (i = 0; i < stats->sections; ++i)
+      PyList_SET_ITEM(octants, i,
+                      PyFloat_FromDouble(stats->section_ns[i] / 1e9));
+    for (i = 0; i < stats->sections; ++i)
+      if (PyList_GET_ITEM(octants, i) == NULL) {
+        Py_DECREF(octants);
+        goto fail;
+      }
+  } else {
+    Py_INCREF(Py_None);
+    octants = Py_None;
+  }
+  if (_pyfov_dict_steal(dict, "octant_seconds", octants) < 0)
+    goto fail;
+
+  if (stats->peak_intervals >= 0) {
+    peak = PyInt_FromLong(stats->peak_intervals);
+  } else {
+    Py_INCREF(Py_None);
+    peak = Py_None;
+  }
+  if (_pyfov_dict_steal(dict, "peak_intervals", peak) < 0 ||
+      _pyfov_dict_steal(dict, "engine",
+                        PyInt_FromLong(self->last_engine)) < 0 ||
+      _pyfov_dict_steal(dict, "path", PyString_FromString(path)) < 0 ||
+      _pyfov_dict_steal(dict, "probes",
+                        PyInt_FromSize_t(wrap->probes)) < 0 ||
+      _pyfov_dict_steal(dict, "duplicate_probes",
+                        PyInt_FromSize_t(wrap->duplicates)) < 0 ||
+      _pyfov_dict_steal(dict, "lit", PyInt_FromSize_t(wrap->applied)) < 0 ||
+      _pyfov_dict_steal(dict, "seconds", PyFloat_FromDouble(ns / 1e9)) < 0 ||
+      _pyfov_dict_steal(dict, "python_seconds",
+                        PyFloat_FromDouble(wrap->python_ns / 1e9)) < 0)
+    goto fail;
+  return dict;
+
+fail:
+  Py_DECREF(dict);
+  return NULL;
+}
+
+/**
+ * Sweep results
+ *
+ * What circle and beam return: the cells lit, and whichever of watch=,
+ * ordered= and explain= were asked for, None otherwise
+ */
+static PyTypeObject pyfov_SweepResultType;
+
+static PyStructSequence_Field pyfov_SweepResult_fields[] = {
+  {"lit", "cells lit"},
+  {"watched", "the watched cells lit, in the order they were lit"},
+  {"ordered", "cells written to ordered=, fewer than lit if it was short"},
+  {"explain", "a dict describing the sweep"},
+  {NULL}
+};
+
+static PyStructSequence_Desc pyfov_SweepResult_desc = {
+  "fov.SweepResult",
+  "What a circle or beam lit",
+  pyfov_SweepResult_fields,
+  4
+};
+
+/**
+ * Builds a sweep's result, stealing `watched` and `explained` (each NULL
+ * when not asked for).  `ordered` is negative without ordered=.
+ */
+static PyObject *
+_pyfov_sweep_result(unsigned long lit, PyObject *watched,
+                    Py_ssize_t ordered, PyObject *explained) {
+  PyObject *result, *count, *written;
+
+  if (watched == NULL) {
+    Py_INCREF(Py_None);
+    watched = Py_None;
+  }
+  if (explained == NULL) {
+    Py_INCREF(Py_None);
+    explained = Py_None;
+  }
+  if (ordered < 0) {
+    Py_INCREF(Py_None);
+    written = Py_None;
+  } else {
+    written = PyInt_FromSsize_t(ordered);
+  }
+  count = PyInt_FromSize_t(lit);
+  result = PyStructSequence_New(&pyfov_SweepResultType);
+  if (result == NULL || count == NULL || written == NULL) {
+    Py_XDECREF(result);
+    Py_XDECREF(count);
+    Py_XDECREF(written);
+    Py_DECREF(watched);
+    Py_DECREF(explained);
+    return NULL;
+  }
+  PyStructSequence_SET_ITEM(result, 0, count);
+  PyStructSequence_SET_ITEM(result, 1, watched);
+  PyStructSequence_SET_ITEM(result, 2, written);
+  PyStructSequence_SET_ITEM(result, 3, explained);
+  return result;
+}
+
+/**
+ * Fills in the slow log's record of a sweep that took `ns`
+ */
+static void
+_pyfov_slow_call(pyfov_slow_call *call, pyfov_Settings *self,
+                 map_wrapper *wrap, PyObject *map, uint64_t ns) {
+  call->engine = self->last_engine;
+  call->map_id = (uintptr_t)map;
+  strncpy(call->map_type, map->ob_type->tp_name,
+          sizeof(call->map_type) - 1);
+  call->map_type[sizeof(call->map_type) - 1] = '\0';
+  call->probes = wrap->probes;
+  call->lit = wrap->applied;
+  call->ns = ns;
+  call->python_ns = wrap->python_ns;
+}
+
+/**
+ * Runs one beam (if `beam` is set) or circle sweep, fills in the requested
+ * outputs and returns a SweepResult.  Sweeps that take at least the slow
+ * log's threshold are logged.
+ */
+static PyObject *
+_pyfov_sweep(pyfov_Settings *self, PyObject *map, PyObject *src,
+             int source_x, int source_y, unsigned radius,
+             bool beam, fov_direction_type direction, float angle,
+             pyfov_outputs *outputs) {
+  size_t side = 2 * (size_t)radius + 1;
+  map_wrapper wrap;
+  pyfov_engine_type engine = self->engine;
+  pyfov_engine_extras extras;
+  pyfov_engine_stats stats;
+  pyfov_slow_call slow = {beam, false, source_x, source_y, radius,
+                          beam ? (int)direction : 0, beam ? angle : 0.0f};
+  uint64_t start = 0, elapsed;
+  PyObject *explained = NULL, *watched, *out = NULL;
+  Py_ssize_t ordered = -1;
+  int result = PYFOV_ENGINE_OK;
+
+  if (pyfov_slowlog_threshold != 0 || outputs->explain)
+    start = pyfov_clock_ns();
+
+  // Initialize wrap to pass as map instead of *map.
+  _pyfov_init_wrap(&wrap, self, map);
+  extras.coverage = NULL;
+  extras.stats = NULL;
+
+  if (_pyfov_check_visibility(outputs->visibility, outputs->width) < 0)
+    goto done;
+  if (outputs->into != Py_None && !PySet_Check(outputs->into) &&
+      !PyDict_Check(outputs->into)) {
+    PyErr_SetString(PyExc_TypeError, "into must be a set or a dict");
+    goto done;
+  }
+
+  if (outputs->visibility != Py_None) {
+    extras.coverage = calloc(side * side, sizeof(float));
+    if (extras.coverage == NULL) {
+      PyErr_NoMemory();
+      goto done;
+    }
+  }
+  if (outputs->explain) {
+    stats.sections = 0;
+    stats.peak_intervals = -1;
+    extras.stats = &stats;
+  }
+
+  if (outputs->into != Py_None)
+    wrap.into = outputs->into;
+  wrap.lit = outputs->lit;
+  wrap.timed = pyfov_slowlog_threshold != 0 || outputs->explain;
+  if ((outputs->watch != Py_None &&
+       _pyfov_init_watch(&wrap, outputs->watch, outputs->width) < 0) ||
+      (outputs->ordered != Py_None &&
+       _pyfov_init_ordered(&wrap, outputs->ordered, radius) < 0))
+    goto done;
+
+  // Native maps are swept in their own grid, which for hex maps needs its
+  // own kernel.
+  if (wrap.native != NULL) {
+    pyfov_map_from_storage(wrap.native, source_x, source_y,
+                           &source_x, &source_y);
+    if (wrap.native->layout == PYFOV_MAP_HEX)
+      engine = PYFOV_ENGINE_HEX;
+  }
+
+  if (outputs->explain) {
+    wrap.probed = calloc(side * side, 1);
+    if (wrap.probed == NULL) {
+      PyErr_NoMemory();
+      goto done;
+    }
+    wrap.probe_x = source_x;
+    wrap.probe_y = source_y;
+    wrap.probe_radius = radius;
+  }
+
+  if (engine == PYFOV_ENGINE_AUTO)
+    engine = _pyfov_pick_engine(self, &wrap, source_x, source_y, radius,
+                                !beam && extras.coverage == NULL &&
+                                _pyfov_bitboard_fits(self, wrap.native,
+                                                     source_x, source_y,
+                                                     radius));
+  self->last_engine = engine;
+
+  if (wrap.threw_exception)
+    ;
+  else if (engine == PYFOV_ENGINE_BITBOARD)
+    _pyfov_bitboard_sweep(self, &wrap, src, source_x, source_y, radius);
+  else if (beam)
+    result = pyfov_engine_beam(engine, &self->settings, &wrap, src,
+                               source_x, source_y, radius,
+                               direction, angle, &extras);
+  else
+    result = pyfov_engine_circle(engine, &self->settings, &wrap, src,
+                                 source_x, source_y, radius, &extras);
+
+  if (!wrap.threw_exception && result == PYFOV_ENGINE_OK &&
+      outputs->visibility != Py_None &&
+      _pyfov_write_visibility(outputs->visibility, outputs->width,
+                              extras.coverage, &wrap,
+                              source_x, source_y, radius) < 0)
+    wrap.threw_exception = true;
+  if (!wrap.threw_exception && result == PYFOV_ENGINE_OK &&
+      outputs->ordered != Py_None &&
+      (ordered = _pyfov_write_ordered(outputs->ordered, &wrap)) < 0)
+    wrap.threw_exception = true;
+
+  if (wrap.threw_exception)
+    goto done;
+  if (result != PYFOV_ENGINE_OK) {
+    _pyfov_engine_error(result);
+    goto done;
+  }
+
+  pyfov_metrics_sweep(self->last_engine, wrap.probes, wrap.applied);
+  if (wrap.timed) {
+    elapsed = pyfov_clock_ns() - start;
+    if (outputs->explain &&
+        (explained = _pyfov_explain(self, &wrap, &stats, elapsed)) == NULL)
+      goto done;
+    if (pyfov_slowlog_threshold != 0 &&
+        elapsed >= pyfov_slowlog_threshold) {
+      _pyfov_slow_call(&slow, self, &wrap, map, elapsed);
+      if (pyfov_slowlog_record(&slow) < 0) {
+        Py_CLEAR(explained);
+        goto done;
+      }
+    }
+  }
+
+  watched = wrap.watched;
+  wrap.watched = NULL;
+  out = _pyfov_sweep_result(wrap.applied, watched, ordered, explained);
+
+done:
+  free(extras.coverage);
+  free(wrap.probed);
+  free(wrap.ordered);
+  free(wrap.ordered_seen);
+  _pyfov_release_wrap(&wrap);
+  return out;
+}
+
+/**
+ * Wrapper for fov_beam
+ */
+static PyObject *
+pyfov_Settings_beam(pyfov_Settings *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source", "source_x", "source_y",
+                           "radius", "direction", "angle",
+                           "visibility", "width", "into", "explain",
+                           "watch", "ordered", NULL};
+  PyObject *map, *src;
+  int source_x, source_y;
+  unsigned radius;
+  fov_direction_type direction;
+  float angle;
+  pyfov_outputs outputs = {Py_None, 0, Py_None, NULL, 0, Py_None,
+                           Py_None};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOiiIIf|OiOiOO", kwlist,
+                                   &map, &src,
+                                   &source_x, &source_y, &radius,
+                                   &direction, &angle,
+                                   &outputs.visibility, &outputs.width,
+                                   &outputs.into, &outputs.explain,
+                                   &outputs.watch, &outputs.ordered))
+    return NULL;
+
+  return _pyfov_sweep(self, map, src, source_x, source_y, radius,
+                      true, direction, angle, &outputs);
+}
+
+/**
+ * Wrapper for fov_circle
+ */
+static PyObject *
+pyfov_Settings_circle(pyfov_Settings *self, PyObject *args,
+                      PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source", "source_x", "source_y",
+                           "radius", "visibility", "width", "into",
+                           "explain", "watch", "ordered", NULL};
+  PyObject *map, *src;
+  int source_x, source_y;
+  unsigned radius;
+  pyfov_outputs outputs = {Py_None, 0, Py_None, NULL, 0, Py_None,
+                           Py_None};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOiiI|OiOiOO", kwlist,
+                                   &map, &src,
+                                   &source_x, &source_y, &radius,
+                                   &outputs.visibility, &outputs.width,
+                                   &outputs.into, &outputs.explain,
+                                   &outputs.watch, &outputs.ordered))
+    return NULL;
+
+  return _pyfov_sweep(self, map, src, source_x, source_y, radius,
+                      false, FOV_EAST, 0.0f, &outputs);
+}
+
+/**
+ * Times `repeat` circles, or beams if `direction` is given, and counts the
+ * hardware events they cost where perf_event_open allows it.  Opacity is
+ * read as circle reads it, but lit cells are only counted, so neither
+ * apply_lighting_function nor any other output is measured.
+ *
+ * Returns a dict of the engine run, the lit cells and seconds per sweep,
+ * and each counter per lit cell, or None where it isn't available.
+ */
+static PyObject *
+pyfov_Settings_benchmark(pyfov_Settings *self, PyObject *args,
+                         PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source_x", "source_y", "radius",
+                           "direction", "angle", "repeat", "counters",
+                           NULL};
+  PyObject *map, *direction = Py_None, *swept, *stats = NULL;
+  int source_x, source_y, repeat = 100, hardware = 1, i;
+  unsigned radius;
+  float angle = 90.0f;
+  long beam_direction = FOV_EAST;
+  unsigned long lit = 0;
+  pyfov_outputs outputs = {Py_None, 0, Py_None, &lit, 0, Py_None,
+                           Py_None};
+  pyfov_counters counters;
+  double cells, count;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OiiI|Ofii", kwlist,
+                                   &map, &source_x, &source_y, &radius,
+                                   &direction, &angle, &repeat, &hardware))
+    return NULL;
+  if (direction != Py_None) {
+    beam_direction = PyInt_AsLong(direction);
+    if (beam_direction == -1 && PyErr_Occurred())
+      return NULL;
+  }
+  if (repeat < 1) {
+    PyErr_SetString(PyExc_ValueError, "repeat must be positive");
+    return NULL;
+  }
+
+  // Only the sweeps themselves run the counters
+  pyfov_counters_open(&counters, hardware);
+  for (i = 0; i < repeat; ++i) {
+    lit = 0;
+    pyfov_counters_resume(&counters);
+    swept = _pyfov_sweep(self, map, Py_None, source_x, source_y, radius,
+                         direction != Py_None,
+                         (fov_direction_type)beam_direction, angle,
+                         &outputs);
+    pyfov_counters_pause(&counters);
+    if (swept == NULL)
+      goto done;
+    Py_DECREF(swept);
+  }
+
+  if ((stats = PyDict_New()) == NULL)
+    goto done;
+  cells = (double)repeat * (lit > 0 ? lit : 1);
+  if (_pyfov_dict_steal(stats, "engine",
+                        PyInt_FromLong(self->last_engine)) < 0 ||
+      _pyfov_dict_steal(stats, "sweeps", PyInt_FromLong(repeat)) < 0 ||
+      _pyfov_dict_steal(stats, "cells", PyInt_FromSize_t(lit)) < 0 ||
+      _pyfov_dict_steal(stats, "seconds",
+                        PyFloat_FromDouble(
+                          pyfov_counters_seconds(&counters) / repeat)) < 0)
+    goto fail;
+  for (i = 0; i < PYFOV_COUNTER_COUNT; ++i) {
+    if (pyfov_counters_read(&counters, (pyfov_counter)i, &count)) {
+      if (_pyfov_dict_steal(stats, pyfov_counter_names[i],
+                            PyFloat_FromDouble(count / cells)) < 0)
+        goto fail;
+    } else {
+      Py_INCREF(Py_None);
+      if (_pyfov_dict_steal(stats, pyfov_counter_names[i], Py_None) < 0)
+        goto fail;
+    }
+  }
+  goto done;
+
+fail:
+  Py_CLEAR(stats);
+done:
+  pyfov_counters_close(&counters);
+  return stats;
+}
+
+/**
+ * fov_circle for square fov.Maps of at most 64x64 cells, run on the map's
+ * opacity bitboards.  No callbacks are made; the lit cells come back as 64
+ * row masks (bit x of word y is (x, y)), either as a tuple of ints or
+ * written to `out`, a writable buffer of 64 uint64 words.
+ */
+static PyObject *
+pyfov_Settings_circle_bits(pyfov_Settings *self, PyObject *args,
+                           PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source_x", "source_y", "radius", "out",
+                           NULL};
+  PyObject *map, *out = Py_None, *bits, *word;
+  int source_x, source_y, y;
+  unsigned radius;
+  uint64_t lit[64];
+  void *buf;
+  Py_ssize_t len;
+  pyfov_Map *native;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!iiI|O", kwlist,
+                                   &pyfov_MapType, &map,
+                                   &source_x, &source_y, &radius, &out))
+    return NULL;
+
+  native = (pyfov_Map *)map;
+  if (source_x < 0 || source_y < 0 ||
+      source_x >= native->width || source_y >= native->height) {
+    PyErr_SetString(PyExc_ValueError, "source is off the map");
+    return NULL;
+  }
+  if (out != Py_None) {
+    if (PyObject_AsWriteBuffer(out, &buf, &len) < 0)
+      return NULL;
+    if (len < (Py_ssize_t)sizeof(lit)) {
+      PyErr_SetString(PyExc_ValueError, "out must hold 64 uint64 words");
+      return NULL;
+    }
+  }
+
+  if (_pyfov_bitboard_lit(self, native, source_x, source_y, radius,
+                          lit) < 0)
+    return NULL;
+
+  if (out != Py_None) {
+    memcpy(buf, lit, sizeof(lit));
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  if ((bits = PyTuple_New(64)) == NULL)
+    return NULL;
+  for (y = 0; y < 64; ++y) {
+    word = PyLong_FromUnsignedLongLong(lit[y]);
+    if (word == NULL) {
+      Py_DECREF(bits);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(bits, y, word);
+  }
+  return bits;
+}
+
+/**
+ * Sets up the job for source `i` of a batch: parses it, checks its map and
+ * gives it the mask it lights, which goes in `masks` and whose buffer is
+ * held in `view` until the batch is done.  Returns 0, or -1 with an
+ * exception set and no buffer held.
+ */
+static int
+_pyfov_batch_job(pyfov_Settings *self, pyfov_batch_job *job,
+                 PyObject *maps, PyObject *source, PyObject *out,
+                 PyObject *masks, Py_ssize_t i, Py_buffer *view) {
+  Py_ssize_t index, size;
+  PyObject *mask;
+  map_wrapper wrap;
+
+  if (!PyTuple_Check(source) ||
+      !PyArg_ParseTuple(source, "niiI;sources must be (map_index, "
+                        "source_x, source_y, radius) tuples", &index,
+                        &job->source_x, &job->source_y, &job->radius)) {
+    if (!PyErr_Occurred())
+      PyErr_SetString(PyExc_TypeError, "sources must be (map_index, "
+                      "source_x, source_y, radius) tuples");
+    return -1;
+  }
+  if (index < 0 || index >= PySequence_Fast_GET_SIZE(maps)) {
+    PyErr_SetString(PyExc_IndexError, "map index out of range");
+    return -1;
+  }
+  job->map = (pyfov_Map *)PySequence_Fast_GET_ITEM(maps, index);
+  size = (Py_ssize_t)job->map->width * job->map->height;
+
+  if (out != NULL) {
+    mask = PySequence_Fast_GET_ITEM(out, i);
+    Py_INCREF(mask);
+  } else if ((mask = PyByteArray_FromStringAndSize(NULL, size)) == NULL) {
+    return -1;
+  }
+  PyList_SET_ITEM(masks, i, mask);
+  // Holding the buffer keeps it from being resized or freed while the
+  // threads write to it
+  if (PyObject_GetBuffer(mask, view, PyBUF_WRITABLE) < 0)
+    return -1;
+  if (view->len < size) {
+    PyBuffer_Release(view);
+    PyErr_SetString(PyExc_ValueError, "out buffers must hold a byte per "
+                    "cell of their map");
+    return -1;
+  }
+  job->lit = view->buf;
+
+  pyfov_map_from_storage(job->map, job->source_x, job->source_y,
+                         &job->source_x, &job->source_y);
+  if (job->map->layout == PYFOV_MAP_HEX) {
+    job->engine = PYFOV_ENGINE_HEX;
+  } else {
+    _pyfov_init_wrap(&wrap, self, (PyObject *)job->map);
+    job->engine = _pyfov_pick_engine(self, &wrap, job->source_x,
+                                     job->source_y, job->radius, false);
+    _pyfov_release_wrap(&wrap);
+  }
+  // Bitboards light what libfov does
+  if (job->engine == PYFOV_ENGINE_BITBOARD)
+    job->engine = PYFOV_ENGINE_LIBFOV;
+  return 0;
+}
+
+/**
+ * Memory a batch writes (a mask) or reads (a map's cells)
+ */
+typedef struct {
+  const unsigned char *start;
+  const unsigned char *end;
+  bool mask;
+} batch_span;
+
+static int
+_pyfov_batch_span_cmp(const void *a, const void *b) {
+  const unsigned char *x = ((const batch_span *)a)->start;
+  const unsigned char *y = ((const batch_span *)b)->start;
+
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Raises ValueError if the mask of any job shares memory with another
+ * job's mask or with the cells of any map of the batch, as the threads
+ * would race writing them, or sweep cells as they are cleared and lit.
+ * Returns 0, or -1 with an exception set.
+ */
+static int
+_pyfov_batch_check_masks(pyfov_batch_job *jobs, Py_ssize_t count) {
+  const unsigned char *mask_end = NULL, *map_end = NULL;
+  const pyfov_Map *map;
+  batch_span *spans;
+  Py_ssize_t i;
+  const char *error = NULL;
+
+  if ((spans = PyMem_Malloc((count > 0 ? 2 * count : 1) *
+                            sizeof(*spans))) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (i = 0; i < count; ++i) {
+    map = jobs[i].map;
+    spans[2 * i].start = jobs[i].lit;
+    spans[2 * i].end = jobs[i].lit + (size_t)map->width * map->height;
+    spans[2 * i].mask = true;
+    spans[2 * i + 1].start = map->cells;
+    spans[2 * i + 1].end = map->cells;
+    if (map->width > 0 && map->height > 0)
+      spans[2 * i + 1].end += (map->height - 1) * map->stride + map->width;
+    spans[2 * i + 1].mask = false;
+  }
+
+  // Spans in order of their start overlap an earlier one when they start
+  // before it ends
+  qsort(spans, 2 * count, sizeof(*spans), _pyfov_batch_span_cmp);
+  for (i = 0; i < 2 * count && error == NULL; ++i) {
+    if (spans[i].start == spans[i].end)
+      continue;
+    if (mask_end != NULL && spans[i].start < mask_end)
+      error = spans[i].mask ? "out buffers can't be shared between sources"
+        : "out buffers can't share memory with the maps";
+    else if (spans[i].mask && map_end != NULL && spans[i].start < map_end)
+      error = "out buffers can't share memory with the maps";
+    if (spans[i].mask && (mask_end == NULL || spans[i].end > mask_end))
+      mask_end = spans[i].end;
+    if (!spans[i].mask && (map_end == NULL || spans[i].end > map_end))
+      map_end = spans[i].end;
+  }
+  PyMem_Free(spans);
+  if (error != NULL) {
+    PyErr_SetString(PyExc_ValueError, error);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Logs a job of a batch that took at least the slow log's threshold.
+ * Returns 0, or -1 with an exception set.
+ */
+static int
+_pyfov_batch_slow(const pyfov_batch_job *job) {
+  pyfov_slow_call call;
+
+  memset(&call, 0, sizeof(call));
+  call.batch = true;
+  pyfov_map_to_storage(job->map, job->source_x, job->source_y,
+                       &call.source_x, &call.source_y);
+  call.radius = job->radius;
+  call.engine = job->engine;
+  call.map_id = (uintptr_t)job->map;
+  strncpy(call.map_type, job->map->ob_type->tp_name,
+          sizeof(call.map_type) - 1);
+  call.map_type[sizeof(call.map_type) - 1] = '\0';
+  call.probes = job->probes;
+  call.lit = job->applied;
+  call.ns = job->ns;
+  return pyfov_slowlog_record(&call);
+}
+
+/**
+ * The cells of `watch` that the job lit, row by row, as a list of (x, y).
+ * Returns NULL with an exception set on failure.
+ */
+static PyObject *
+_pyfov_batch_watched(const pyfov_batch_job *job,
+                     const pyfov_cellset *watch) {
+  PyObject *cells = PyList_New(0), *cell;
+  int x, y;
+
+  if (cells == NULL)
+    return NULL;
+  for (y = 0; y < job->map->height; ++y) {
+    for (x = 0; x < job->map->width; ++x) {
+      if (!job->lit[(size_t)y * job->map->width + x] ||
+          !pyfov_cellset_contains(watch, x, y))
+        continue;
+      if ((cell = Py_BuildValue("(ii)", x, y)) == NULL ||
+          PyList_Append(cells, cell) < 0) {
+        Py_XDECREF(cell);
+        Py_DECREF(cells);
+        return NULL;
+      }
+      Py_DECREF(cell);
+    }
+  }
+  return cells;
+}
+
+/**
+ * Lights a circle for each (map_index, source_x, source_y, radius) of
+ * `sources` on its map in `maps`, a sequence of fov.Maps, all in one call
+ * spread over `threads` threads (one per CPU if 0) with the GIL released.
+ * No callbacks are made.  Returns a list of uint8 masks, one per source
+ * and laid out like its map, that are 1 where it lit; they are bytearrays
+ * unless `out` gives buffers to clear and write them to.
+ *
+ * With `watch`, a WatchSet or iterable of cells, the list `watched` is
+ * filled with a list per source of the watched cells it lit.
+ */
+static PyObject *
+pyfov_Settings_circle_batch(pyfov_Settings *self, PyObject *args,
+                            PyObject *kwargs) {
+  static char *kwlist[] = {"maps", "sources", "threads", "out", "watch",
+                           "watched", NULL};
+  PyObject *maps, *sources, *out = Py_None, *result = NULL;
+  PyObject *watch = Py_None, *watched = Py_None, *cells;
+  PyObject *map_seq = NULL, *source_seq = NULL, *out_seq = NULL;
+  PyObject *masks = NULL;
+  pyfov_batch_job *jobs = NULL;
+  Py_buffer *views = NULL;
+  pyfov_cellset watch_cells = {NULL, 0, 0};
+  const pyfov_cellset *watching = NULL;
+  Py_ssize_t count, viewed = 0, busy = 0, i;
+  int threads = 0;
+  bool timed = pyfov_slowlog_threshold != 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|iOOO", kwlist,
+                                   &maps, &sources, &threads, &out,
+                                   &watch, &watched))
+    return NULL;
+  if ((watch == Py_None) != (watched == Py_None) ||
+      (watched != Py_None && !PyList_Check(watched))) {
+    PyErr_SetString(PyExc_TypeError,
+                    "watch needs a list to fill as watched");
+    return NULL;
+  }
+
+  map_seq = PySequence_Fast(maps, "maps must be a sequence");
+  source_seq = PySequence_Fast(sources, "sources must be a sequence");
+  if (map_seq == NULL || source_seq == NULL)
+    goto done;
+  for (i = 0; i < PySequence_Fast_GET_SIZE(map_seq); ++i) {
+    if (!pyfov_Map_Check(PySequence_Fast_GET_ITEM(map_seq, i))) {
+      PyErr_SetString(PyExc_TypeError, "maps must be fov.Maps");
+      goto done;
+    }
+  }
+  count = PySequence_Fast_GET_SIZE(source_seq);
+  if (out != Py_None) {
+    if ((out_seq = PySequence_Fast(out, "out must be a sequence")) == NULL)
+      goto done;
+    if (PySequence_Fast_GET_SIZE(out_seq) != count) {
+      PyErr_SetString(PyExc_ValueError,
+                      "out must hold a buffer per source");
+      goto done;
+    }
+  }
+  if (pyfov_WatchSet_Check(watch)) {
+    watching = &((pyfov_WatchSet *)watch)->cells;
+  } else if (watch != Py_None) {
+    if (pyfov_cellset_update(&watch_cells, watch) < 0)
+      goto done;
+    watching = &watch_cells;
+  }
+
+  masks = PyList_New(count);
+  jobs = PyMem_Malloc((count > 0 ? count : 1) * sizeof(pyfov_batch_job));
+  views = PyMem_Malloc((count > 0 ? count : 1) * sizeof(Py_buffer));
+  if (masks == NULL || jobs == NULL || views == NULL) {
+    if (masks != NULL)
+      PyErr_NoMemory();
+    goto done;
+  }
+  for (viewed = 0; viewed < count; ++viewed) {
+    if (_pyfov_batch_job(self, &jobs[viewed], map_seq,
+                         PySequence_Fast_GET_ITEM(source_seq, viewed),
+                         out_seq, masks, viewed, &views[viewed]) < 0)
+      goto done;
+  }
+  if (_pyfov_batch_check_masks(jobs, count) < 0)
+    goto done;
+  for (i = 0; i < count; ++i)
+    memset(jobs[i].lit, 0, (size_t)jobs[i].map->width * jobs[i].map->height);
+
+  // Other threads may run while the GIL is released, so each job keeps
+  // its map alive and unchanged until the sweeps are done
+  for (busy = 0; busy < count; ++busy) {
+    Py_INCREF(jobs[busy].map);
+    ++jobs[busy].map->busy;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  pyfov_batch_run(&self->settings, jobs, count, threads, timed);
+  Py_END_ALLOW_THREADS
+
+  for (i = 0; i < count; ++i) {
+    if (jobs[i].result != PYFOV_ENGINE_OK) {
+      _pyfov_engine_error(jobs[i].result);
+      goto done;
+    }
+    pyfov_metrics_sweep(jobs[i].engine, jobs[i].probes, jobs[i].applied);
+    self->last_engine = jobs[i].engine;
+    if (timed && jobs[i].ns >= pyfov_slowlog_threshold &&
+        _pyfov_batch_slow(&jobs[i]) < 0)
+      goto done;
+  }
+
+  if (watching != NULL) {
+    if (PyList_SetSlice(watched, 0, PyList_GET_SIZE(watched), NULL) < 0)
+      goto done;
+    for (i = 0; i < count; ++i) {
+      if ((cells = _pyfov_batch_watched(&jobs[i], watching)) == NULL)
+        goto done;
+      if (PyList_Append(watched, cells) < 0) {
+        Py_DECREF(cells);
+        goto done;
+      }
+      Py_DECREF(cells);
+    }
+  }
+  result = masks;
+  masks = NULL;
+
+done:
+  for (i = 0; i < viewed; ++i)
+    PyBuffer_Release(&views[i]);
+  for (i = 0; i < busy; ++i) {
+    --jobs[i].map->busy;
+    Py_DECREF(jobs[i].map);
+  }
+  PyMem_Free(views);
+  PyMem_Free(jobs);
+  pyfov_cellset_clear(&watch_cells);
+  Py_XDECREF(masks);
+  Py_XDECREF(map_seq);
+  Py_XDECREF(source_seq);
+  Py_XDECREF(out_seq);
+  return result;
+}
+
+
+/**
+ * Float lightmaps
+ */
+
+/**
+ * Checks that `lightmap` is a writable buffer with rows of `width` floats.
+ */
+static int
+_pyfov_check_lightmap(PyObject *lightmap, int width) {
+  void *buf;
+  Py_ssize_t len;
+
+  if (PyObject_AsWriteBuffer(lightmap, &buf, &len) < 0)
+    return -1;
+  if (width <= 0) {
+    PyErr_SetString(PyExc_ValueError, "lightmap requires a positive width");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Area lights
+ */
+
+/**
+ * Caches the opacity of a window of the map, so that several sweeps over
+ * the same area only call the opacity test function once per cell.
+ */
+typedef struct {
+  map_wrapper *wrap;
+  /* -1 for cells that haven't been probed yet */
+  signed char *cells;
+  int left;
+  int top;
+  int side;
+} opacity_cache;
+
+static bool
+_pyfov_cached_opacity(void *map, int x, int y) {
+  opacity_cache *cache = (opacity_cache *)map;
+  int i = x - cache->left;
+  int j = y - cache->top;
+  signed char *cell;
+
+  if (i < 0 || j < 0 || i >= cache->side || j >= cache->side)
+    return _pyfov_opacity_test_function(cache->wrap, x, y);
+
+  cell = &cache->cells[j * cache->side + i];
+  if (*cell < 0)
+    *cell = _pyfov_opacity_test_function(cache->wrap, x, y);
+  return *cell;
+}
+
+static void
+_pyfov_ignore_lighting(void *map, int x, int y, int dx, int dy, void *src) {
+}
+
+#define PYFOV_GOLDEN_ANGLE 2.39996323f
+
+/**
+ * Lights a float lightmap from a disc shaped light.
+ *
+ * The disc is sampled at `samples` stratified points (a sunflower spiral),
+ * which are snapped to cells and merged.  Each distinct cell gets one
+ * fractional visibility sweep, weighted by the share of samples that
+ * landed on it, and all of the sweeps share one opacity cache.  Samples
+ * that land inside walls don't emit light.
+ */
+static PyObject *
+pyfov_Settings_area_light(pyfov_Settings *self, PyObject *args,
+                          PyObject *kwargs) {
+  static char *kwlist[] = {"map", "source_x", "source_y", "radius",
+                           "light_radius", "lightmap", "width",
+                           "samples", "intensity", NULL};
+  PyObject *map, *lightmap;
+  int source_x, source_y, width;
+  unsigned radius, samples = 16;
+  float light_radius, intensity = 1.0f;
+  float *light;
+  Py_ssize_t len, height;
+  int reach, side, wside, nsites, n, k, i, j, x, y, ox, oy;
+  int *site_x = NULL, *site_y = NULL, *site_weight = NULL;
+  float *coverage = NULL;
+  float r, a;
+  map_wrapper wrap;
+  opacity_cache cache;
+  fov_settings_type settings;
+  pyfov_engine_type engine;
+  pyfov_engine_extras extras;
+  int result = PYFOV_ENGINE_OK;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OiiIfOi|If", kwlist,
+                                   &map, &source_x, &source_y, &radius,
+                                   &light_radius, &lightmap, &width,
+                                   &samples, &intensity))
+    return NULL;
+
+  if (_pyfov_check_lightmap(lightmap, width) < 0)
+    return NULL;
+  if (light_radius < 0.0f || samples == 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "light_radius must be >= 0 and samples > 0");
+    return NULL;
+  }
+
+  _pyfov_init_wrap(&wrap, self, map);
+  if (wrap.native != NULL && wrap.native->layout != PYFOV_MAP_SQUARE) {
+    PyErr_SetString(PyExc_ValueError,
+                    "area lights need a square map layout");
+    return NULL;
+  }
+
+  reach = (int)ceilf(light_radius);
+  side = 2 * (int)radius + 1;
+  wside = side + 2 * reach;
+
+  site_x = malloc(samples * sizeof(int));
+  site_y = malloc(samples * sizeof(int));
+  site_weight = malloc(samples * sizeof(int));
+  coverage = malloc((size_t)side * side * sizeof(float));
+  cache.cells = malloc((size_t)wside * wside);
+  if (site_x == NULL || site_y == NULL || site_weight == NULL ||
+      coverage == NULL || cache.cells == NULL) {
+    result = PYFOV_ENGINE_NOMEM;
+    goto done;
+  }
+
+  // Stratify the samples over the disc, and merge the ones that land on the
+  // same cell.
+  nsites = 0;
+  for (n = 0; n < (int)samples; ++n) {
+    r = light_radius * sqrtf((n + 0.5f) / samples);
+    a = n * PYFOV_GOLDEN_ANGLE;
+    ox = (int)floorf(r * cosf(a) + 0.5f);
+    oy = (int)floorf(r * sinf(a) + 0.5f);
+    for (k = 0; k < nsites; ++k)
+      if (site_x[k] == ox && site_y[k] == oy)
+        break;
+    if (k == nsites) {
+      site_x[k] = ox;
+      site_y[k] = oy;
+      site_weight[k] = 0;
+      ++nsites;
+    }
+    ++site_weight[k];
+  }
+
+  memset(cache.cells, -1, (size_t)wside * wside);
+  cache.wrap = &wrap;
+  cache.left = source_x - (int)radius - reach;
+  cache.top = source_y - (int)radius - reach;
+  cache.side = wside;
+
+  settings = self->settings;
+  settings.opaque = _pyfov_cached_opacity;
+  settings.apply = _pyfov_ignore_lighting;
+  extras.coverage = coverage;
+  extras.stats = NULL;
+  engine = _pyfov_pick_engine(self, &wrap, source_x, source_y, radius,
+                              false);
+  self->last_engine = engine;
+
+  for (k = 0; k < nsites && result == PYFOV_ENGINE_OK; ++k) {
+    ox = source_x + site_x[k];
+    oy = source_y + site_y[k];
+    if (_pyfov_cached_opacity(&cache, ox, oy))
+      continue;
+
+    memset(coverage, 0, (size_t)side * side * sizeof(float));
+    coverage[radius * side + radius] = 1.0f;
+    result = pyfov_engine_circle(engine, &settings, &cache, NULL,
+                                 ox, oy, radius, &extras);
+    if (wrap.threw_exception)
+      break;
+
+    // The callbacks may have resized the lightmap
+    if (PyObject_AsWriteBuffer(lightmap, (void **)&light, &len) < 0) {
+      wrap.threw_exception = true;
+      break;
+    }
+    height = len / sizeof(float) / width;
+
+    for (j = 0; j < side; ++j) {
+      y = oy - (int)radius + j;
+      if (y < 0 || y >= height)
+        continue;
+      for (i = 0; i < side; ++i) {
+        x = ox - (int)radius + i;
+        if (x < 0 || x >= width || coverage[j * side + i] <= 0.0f)
+          continue;
+        light[y * width + x] += intensity * site_weight[k] / samples *
+          (coverage[j * side + i] < 1.0f ? coverage[j * side + i] : 1.0f);
+      }
+    }
+  }
+
+done:
+  free(site_x);
+  free(site_y);
+  free(site_weight);
+  free(coverage);
+  free(cache.cells);
+  _pyfov_release_wrap(&wrap);
+
+  if (wrap.threw_exception)
+    return NULL;
+  if (result != PYFOV_ENGINE_OK)
+    return _pyfov_engine_error(result);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+/**
+ * Floods light (or sound, or anything else that seeps around corners) out
+ * from each of `sources` and adds it to a float lightmap.
+ *
+ * Sources are (x, y) or (x, y, intensity) tuples.  A cell reached at cost
+ * d gets intensity * (1 - d / (radius + 1)).  `costs` is an optional uint8
+ * buffer laid out like the lightmap, holding the extra cost of stepping
+ * into each cell.
+ */
+static PyObject *
+pyfov_Settings_flood(pyfov_Settings *self, PyObject *args,
+                     PyObject *kwargs) {
+  static char *kwlist[] = {"map", "sources", "radius", "lightmap", "width",
+                           "costs", NULL};
+  PyObject *map, *sources, *lightmap, *item;
+  PyObject *costs = Py_None;
+  PyObject *seq = NULL;
+  unsigned radius;
+  int width;
+  float *light;
+  const unsigned char *cost_buf;
+  Py_ssize_t len, height, cost_len, n;
+  unsigned char *window = NULL;
+  float *distances = NULL;
+  size_t cells;
+  int side, source_x, source_y, i, j, x, y;
+  float intensity, d;
+  map_wrapper wrap;
+  int result = PYFOV_ENGINE_OK;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOIOi|O", kwlist,
+                                   &map, &sources, &radius, &lightmap,
+                                   &width, &costs))
+    return NULL;
+
+  if (_pyfov_check_lightmap(lightmap, width) < 0)
+    return NULL;
+  if (radius > PYFOV_FLOOD_MAX_RADIUS) {
+    PyErr_Format(PyExc_ValueError, "floods take radii up to %d",
+                 PYFOV_FLOOD_MAX_RADIUS);
+    return NULL;
+  }
+
+  _pyfov_init_wrap(&wrap, self, map);
+  if (wrap.native != NULL && wrap.native->layout != PYFOV_MAP_SQUARE) {
+    PyErr_SetString(PyExc_ValueError, "floods need a square map layout");
+    return NULL;
+  }
+
+  seq = PySequence_Fast(sources, "sources must be a sequence");
+  if (seq == NULL)
+    return NULL;
+
+  side = 2 * (int)radius + 1;
+  cells = (size_t)side * side;
+  distances = malloc(cells * sizeof(float));
+  if (costs != Py_None)
+    window = malloc(cells);
+  if (distances == NULL || (costs != Py_None && window == NULL)) {
+    result = PYFOV_ENGINE_NOMEM;
+    goto done;
+  }
+
+  for (n = 0; n < PySequence_Fast_GET_SIZE(seq); ++n) {
+    item = PySequence_Fast_GET_ITEM(seq, n);
+    intensity = 1.0f;
+    if (!PyTuple_Check(item)) {
+      PyErr_SetString(PyExc_TypeError,
+                      "sources are (x, y) or (x, y, intensity) tuples");
+      wrap.threw_exception = true;
+      break;
+    }
+    if (!PyArg_ParseTuple(item, "ii|f", &source_x, &source_y, &intensity)) {
+      wrap.threw_exception = true;
+      break;
+    }
+
+    // Copy the window's costs, since callbacks could resize the buffer
+    if (window != NULL) {
+      if (PyObject_AsReadBuffer(costs, (const void **)&cost_buf,
+                                &cost_len) < 0) {
+        wrap.threw_exception = true;
+        break;
+      }
+      for (j = 0; j < side; ++j) {
+        for (i = 0; i < side; ++i) {
+          x = source_x - (int)radius + i;
+          y = source_y - (int)radius + j;
+          window[j * side + i] =
+            x >= 0 && y >= 0 && x < width && y * width + x < cost_len ?
+            cost_buf[y * width + x] : 0;
+        }
+      }
+    }
+
+    result = pyfov_flood(&self->settings, &wrap, source_x, source_y, radius,
+                         window, distances);
+    if (wrap.threw_exception || result != PYFOV_ENGINE_OK)
+      break;
+
+    if (PyObject_AsWriteBuffer(lightmap, (void **)&light, &len) < 0) {
+      wrap.threw_exception = true;
+      break;
+    }
+    height = len / sizeof(float) / width;
+
+    for (j = 0; j < side; ++j) {
+      y = source_y - (int)radius + j;
+      if (y < 0 || y >= height)
+        continue;
+      for (i = 0; i < side; ++i) {
+        x = source_x - (int)radius + i;
+        d = distances[j * side + i];
+        if (x < 0 || x >= width || d < 0.0f)
+          continue;
+        light[y * width + x] += intensity * (1.0f - d / (radius + 1));
+      }
+    }
+  }
+
+done:
+  Py_DECREF(seq);
+  free(distances);
+  free(window);
+  _pyfov_release_wrap(&wrap);
+
+  if (wrap.threw_exception)
+    return NULL;
+  if (result != PYFOV_ENGINE_OK)
+    return _pyfov_engine_error(result);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+/**
+ * Fetches `seq`[`i`] like PySequence_GetItem, reading lists and tuples
+ * directly.  Returns a new reference, or NULL with IndexError set if `i`
+ * is out of range.
+ */
+static PyObject *
+_pyfov_sequence_item(PyObject *seq, int i) {
+  PyObject *item;
+
+  if (PyList_CheckExact(seq)) {
+    if (i >= PyList_GET_SIZE(seq))
+      goto out_of_range;
+    item = PyList_GET_ITEM(seq, i);
+    Py_INCREF(item);
+    return item;
+  }
+  if (PyTuple_CheckExact(seq)) {
+    if (i >= PyTuple_GET_SIZE(seq))
+      goto out_of_range;
+    item = PyTuple_GET_ITEM(seq, i);
+    Py_INCREF(item);
+    return item;
+  }
+  return PySequence_GetItem(seq, i);
+
+out_of_range:
+  PyErr_SetNone(PyExc_IndexError);
+  return NULL;
+}
+
+/**
+ * Reads the cell at (x, y) for the LOOKUP_ITEM and LOOKUP_ROWS modes.
+ * Returns a new reference, or NULL with an exception set.  Under
+ * LOOKUP_ROWS negative coordinates raise IndexError rather than wrapping
+ * around; mapping keys may be negative.
+ */
+static PyObject *
+_pyfov_lookup_cell(map_wrapper *wrap, int x, int y) {
+  PyObject *map = (PyObject *)wrap->orig_map;
+  PyObject *key, *cell;
+  int slot;
+
+  if (wrap->settings->lookup == PYFOV_LOOKUP_ITEM) {
+    key = Py_BuildValue("(ii)", x, y);
+    if (key == NULL)
+      return NULL;
+    if (wrap->subscript != NULL)
+      cell = wrap->subscript(map, key);
+    else
+      cell = PyObject_GetItem(map, key);
+    Py_DECREF(key);
+    return cell;
+  }
+
+  if (x < 0 || y < 0) {
+    PyErr_SetNone(PyExc_IndexError);
+    return NULL;
+  }
+  slot = y % PYFOV_ROW_CACHE;
+  if (wrap->rows[slot] == NULL || wrap->row_y[slot] != y) {
+    Py_CLEAR(wrap->rows[slot]);
+    wrap->rows[slot] = _pyfov_sequence_item(map, y);
+    if (wrap->rows[slot] == NULL)
+      return NULL;
+    wrap->row_y[slot] = y;
+  }
+  return _pyfov_sequence_item(wrap->rows[slot], x);
+}
+
+/**
+ * Converts what the opacity test function (or lookup) returned to 1 if
+ * the cell is opaque, 0 if it isn't, or -1 with an exception set.
+ *
+ * The common results are recognised by identity before falling back to
+ * the full truth test.  With opaque_tiles set the result is a tile, and
+ * its opacity comes from the tile tables.
+ */
+static int
+_pyfov_opacity_result(pyfov_Settings *settings, PyObject *result) {
+  long value;
+
+  if (settings->opaque_tiles != Py_None) {
+    if (PyInt_CheckExact(result)) {
+      value = PyInt_AS_LONG(result);
+      if (value >= 0 && value < 256)
+        return settings->opaque_ints[value];
+    } else if (PyString_CheckExact(result) &&
+               PyString_GET_SIZE(result) == 1) {
+      return settings->opaque_chars[
+        (unsigned char)PyString_AS_STRING(result)[0]];
+    } else if (PyUnicode_CheckExact(result) &&
+               PyUnicode_GET_SIZE(result) == 1 &&
+               PyUnicode_AS_UNICODE(result)[0] < 256) {
+      return settings->opaque_chars[PyUnicode_AS_UNICODE(result)[0]];
+    }
+    return PySet_Contains(settings->opaque_tiles, result);
+  }
+
+  if (result == Py_True)
+    return 1;
+  if (result == Py_False || result == Py_None)
+    return 0;
+  if (PyInt_CheckExact(result))
+    return PyInt_AS_LONG(result) != 0;
+  return PyObject_IsTrue(result);
+}
+
+/**
+ * Flags the probed cell for explain mode, counting it if it was probed
+ * before
+ */
+static void
+_pyfov_note_probe(map_wrapper *wrap, int x, int y) {
+  int r = (int)wrap->probe_radius, side = 2 * r + 1;
+  int i = x - wrap->probe_x + r, j = y - wrap->probe_y + r;
+
+  if (i < 0 || j < 0 || i >= side || j >= side)
+    return;
+  if (wrap->probed[j * side + i])
+    ++wrap->duplicates;
+  else
+    wrap->probed[j * side + i] = 1;
+}
+
+static bool
+_pyfov_opacity_test_function(void *map, int x, int y) {
+  PyObject *arglist;
+  PyObject *result;
+  map_wrapper *wrap = (map_wrapper *)map;
+  uint64_t start = 0;
+  int opaque;
+
+  ++wrap->probes;
+  if (wrap->probed != NULL)
+    _pyfov_note_probe(wrap, x, y);
+
+  // Native maps never call back into python
+  if (wrap->native != NULL)
+    return pyfov_map_opaque(wrap->native, x, y);
+
+  if (wrap->dict != NULL) {
+    opaque = pyfov_dictmap_opaque(wrap->dict, x, y);
+    if (opaque < 0) {
+      wrap->threw_exception = true;
+      return false;
+    }
+    return opaque;
+  }
+
+  // Cells read straight off the map are converted like callback results,
+  // and everything off the edge of it is opaque
+  if (wrap->settings->lookup != PYFOV_LOOKUP_CALLBACK) {
+    if (wrap->timed)
+      start = pyfov_clock_ns();
+    result = _pyfov_lookup_cell(wrap, x, y);
+    if (wrap->timed)
+      wrap->python_ns += pyfov_clock_ns() - start;
+    if (result == NULL) {
+      if (PyErr_ExceptionMatches(PyExc_LookupError)) {
+        PyErr_Clear();
+        return true;
+      }
+      wrap->threw_exception = true;
+      return false;
+    }
+    opaque = _pyfov_opacity_result(wrap->settings, result);
+    Py_DECREF(result);
+    if (opaque < 0) {
+      wrap->threw_exception = true;
+      return false;
+    }
+    return opaque;
+  }
+
+  // Early out if no user-callback was set
+  if (wrap->settings->opacity_test_function == Py_None)
+    return false;
+
+  // Pack up the C return values to python objects
+  if (wrap->timed)
+    start = pyfov_clock_ns();
+  arglist = Py_BuildValue("(Oii)", (PyObject *)wrap->orig_map, x, y);
+  result = PyObject_CallObject(wrap->settings->opacity_test_function,
+                               arglist);
+
+  Py_DECREF(arglist);
+  if (wrap->timed)
+    wrap->python_ns += pyfov_clock_ns() - start;
+
+  // If the callback threw an exception, we trace back through the C code...
+  // We should really stop the execution of additional callbacks, but I'm not
+  // sure if this can be done without doing something super gnarly with the
+  // raw C settings object.
+  if (result == NULL) {
+    wrap->threw_exception = true;
+    return false;
+  }
+
+  opaque = _pyfov_opacity_result(wrap->settings, result);
+  Py_DECREF(result);
+
+  if (opaque < 0) {
+    wrap->threw_exception = true;
+    return false;
+  }
+  return opaque;
+}
+
+/**
+ * Adds (x, y) to the set `into`, or maps it to `src` in the dict `into`.
+ */
+static int
+_pyfov_add_cell(PyObject *into, int x, int y, PyObject *src) {
+  PyObject *key, *item;
+  int result;
+
+  // Build the key by hand; Py_BuildValue would parse its format each time
+  key = PyTuple_New(2);
+  if (key == NULL)
+    return -1;
+  if ((item = PyInt_FromLong(x)) == NULL) {
+    Py_DECREF(key);
+    return -1;
+  }
+  PyTuple_SET_ITEM(key, 0, item);
+  if ((item = PyInt_FromLong(y)) == NULL) {
+    Py_DECREF(key);
+    return -1;
+  }
+  PyTuple_SET_ITEM(key, 1, item);
+
+  if (PyDict_Check(into))
+    result = PyDict_SetItem(into, key, src);
+  else
+    result = PySet_Add(into, key);
+
+  Py_DECREF(key);
+  return result;
+}
+
+static void
+_pyfov_apply_lighting_function(void *map, int x, int y, int dx, int dy,
+                               void *src) {
+  PyObject *arglist;
+  PyObject *result;
+  map_wrapper *wrap = (map_wrapper *)map;
+  int source_x, source_y;
+  uint64_t start = 0;
+
+  ++wrap->applied;
+  if (wrap->lit != NULL) {
+    ++*wrap->lit;
+    return;
+  }
+
+  if (wrap->ordered != NULL && _pyfov_order_cell(wrap, x, y, dx, dy) < 0) {
+    wrap->threw_exception = true;
+    return;
+  }
 
   // Early out if no user-callback was set
+  if (wrap->into == NULL && wrap->watched == NULL &&
+      wrap->settings->apply_lighting_function == Py_None)
+    return;
+
+  // Report cells of native maps in storage coordinates
+  if (wrap->native != NULL) {
+    pyfov_map_to_storage(wrap->native, x - dx, y - dy, &source_x, &source_y);
+    pyfov_map_to_storage(wrap->native, x, y, &x, &y);
+    dx = x - source_x;
+    dy = y - source_y;
+  }
+
+  if (wrap->watched != NULL && _pyfov_watch_cell(wrap, x, y) < 0) {
+    wrap->threw_exception = true;
+    return;
+  }
+
+  if (wrap->into != NULL) {
+    if (_pyfov_add_cell(wrap->into, x, y, (PyObject *)src) < 0)
+      wrap->threw_exception = true;
+    return;
+  }
   if (wrap->settings->apply_lighting_function == Py_None)
     return;
 
   // Pack up the C return values to python objects
+  if (wrap->timed)
+    start = pyfov_clock_ns();
   arglist = Py_BuildValue("(OiiiiO)", (PyObject *)wrap->orig_map, x, y,
                           dx, dy, (PyObject *)src);
   result = PyObject_CallObject(wrap->settings->apply_lighting_function,
                                arglist);
 
   Py_DECREF(arglist);
+  if (wrap->timed)
+    wrap->python_ns += pyfov_clock_ns() - start;
 
   // If the callback threw an exception, we trace back through the C code...
   // We should really stop the execution of additional callbacks, but I'm not
@@ -353,28 +3048,194 @@ _pyfov_apply_lighting_function(void *map, int x, int y, int dx, int dy,
   Py_DECREF(result);
 }
 
+/**
+ * Engine profiles
+ */
+
+/**
+ * Replaces the rules ENGINE_AUTO picks engines by with a profile file
+ */
+static PyObject *
+pyfov_load_profile(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"path", NULL};
+  const char *path;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &path))
+    return NULL;
+  if (pyfov_profile_load(path) < 0)
+    return NULL;
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/**
+ * Returns the active engine profile as the text of a profile file
+ */
+static PyObject *
+pyfov_profile(PyObject *self, PyObject *args) {
+  return pyfov_profile_text();
+}
+
+/**
+ * Times the engines on this host, makes the winners the active profile and
+ * returns it.  If `path` is given the profile is also written there, so
+ * PYFOV_PROFILE can load it at import.
+ */
+static PyObject *
+pyfov_autotune(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"path", "repeat", NULL};
+  const char *path = NULL;
+  int repeat = 3;
+  PyObject *text;
+  FILE *f;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zi", kwlist,
+                                   &path, &repeat))
+    return NULL;
+  if (repeat < 1) {
+    PyErr_SetString(PyExc_ValueError, "repeat must be > 0");
+    return NULL;
+  }
+
+  if (pyfov_profile_autotune(repeat) < 0)
+    return NULL;
+  if ((text = pyfov_profile_text()) == NULL)
+    return NULL;
+
+  if (path != NULL) {
+    if ((f = fopen(path, "w")) == NULL) {
+      Py_DECREF(text);
+      return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+    }
+    fputs("# written by fov.autotune()\n", f);
+    fputs(PyString_AS_STRING(text), f);
+    if (fclose(f) != 0) {
+      Py_DECREF(text);
+      return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+    }
+  }
+  return text;
+}
+
+/**
+ * Metrics
+ */
+
+/**
+ * The module's counters, histograms and caches in the Prometheus text
+ * exposition format
+ */
+static PyObject *
+pyfov_metrics_export(PyObject *self, PyObject *args) {
+  return pyfov_metrics_text();
+}
+
+/**
+ * Slow-query log
+ */
+
+/**
+ * Logs circle and beam calls taking at least `threshold` nanoseconds (0
+ * turns logging off) in a ring of the last `capacity` calls, and passes
+ * each to `hook`.  Clears the log.
+ */
+static PyObject *
+pyfov_set_slow_log(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"threshold", "capacity", "hook", NULL};
+  unsigned PY_LONG_LONG threshold;
+  int capacity = 64;
+  PyObject *hook = Py_None;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K|iO", kwlist,
+                                   &threshold, &capacity, &hook))
+    return NULL;
+  if (pyfov_slowlog_configure(threshold, capacity, hook) < 0)
+    return NULL;
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+/**
+ * The logged calls, oldest first, optionally clearing the log
+ */
+static PyObject *
+pyfov_slow_log(PyObject *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"clear", NULL};
+  int clear = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &clear))
+    return NULL;
+  return pyfov_slowlog_entries(clear);
+}
+
 static PyMethodDef pyfov_methods[];
 
 static void init_fov_settings_type(PyTypeObject *t);
+static void init_fov_sweep_iter_type(PyTypeObject *t);
+static void init_fov_viewer_type(PyTypeObject *t);
 
 PyMODINIT_FUNC
 initfov(void)
 {
   PyObject *m;
+  const char *profile;
 
   // Register module global functions
   m = Py_InitModule("fov", pyfov_methods);
   if (m == NULL)
     return;
 
+  // Batches read the slope tables without the GIL, so they are filled
+  // before anything can sweep
+  pyfov_table_init();
+
   // Type definition
   init_fov_settings_type(&pyfov_SettingsType);
 
   if (PyType_Ready(&pyfov_SettingsType) < 0)
     return;
 
-  // Add the custom type to this module
+  init_fov_sweep_iter_type(&pyfov_SweepIterType);
+
+  if (PyType_Ready(&pyfov_SweepIterType) < 0)
+    return;
+
+  init_fov_viewer_type(&pyfov_ViewerType);
+
+  if (PyType_Ready(&pyfov_ViewerType) < 0)
+    return;
+
+  init_fov_map_type(&pyfov_MapType);
+
+  if (PyType_Ready(&pyfov_MapType) < 0)
+    return;
+
+  init_fov_dictmap_type(&pyfov_DictMapType);
+
+  if (PyType_Ready(&pyfov_DictMapType) < 0)
+    return;
+  init_fov_watchset_type(&pyfov_WatchSetType);
+
+  if (PyType_Ready(&pyfov_WatchSetType) < 0)
+    return;
+
+  PyStructSequence_InitType(&pyfov_SweepResultType,
+                            &pyfov_SweepResult_desc);
+
+  // Add the custom types to this module
   PyModule_AddObject(m, "Settings", (PyObject *)&pyfov_SettingsType);
+  Py_INCREF(&pyfov_MapType);
+  PyModule_AddObject(m, "Map", (PyObject *)&pyfov_MapType);
+  Py_INCREF(&pyfov_DictMapType);
+  PyModule_AddObject(m, "DictMap", (PyObject *)&pyfov_DictMapType);
+  Py_INCREF(&pyfov_WatchSetType);
+  PyModule_AddObject(m, "WatchSet", (PyObject *)&pyfov_WatchSetType);
+  Py_INCREF(&pyfov_ViewerType);
+  PyModule_AddObject(m, "Viewer", (PyObject *)&pyfov_ViewerType);
+  Py_INCREF(&pyfov_SweepResultType);
+  PyModule_AddObject(m, "SweepResult", (PyObject *)&pyfov_SweepResultType);
 
   // Add consts from fov.h to python module
 
@@ -409,18 +3270,96 @@ initfov(void)
   PyModule_AddIntConstant(m, "OPAQUE_APPLY", FOV_OPAQUE_APPLY);
   PyModule_AddIntConstant(m, "OPAQUE_NOAPPLY", FOV_OPAQUE_NOAPPLY);
 
+  // pyfov_lookup_type
+  PyModule_AddIntConstant(m, "LOOKUP_CALLBACK", PYFOV_LOOKUP_CALLBACK);
+  PyModule_AddIntConstant(m, "LOOKUP_ITEM", PYFOV_LOOKUP_ITEM);
+  PyModule_AddIntConstant(m, "LOOKUP_ROWS", PYFOV_LOOKUP_ROWS);
+
+  // pyfov_engine_type
+  PyModule_AddIntConstant(m, "ENGINE_LIBFOV", PYFOV_ENGINE_LIBFOV);
+  PyModule_AddIntConstant(m, "ENGINE_RECURSIVE_SHADOWCAST",
+                          PYFOV_ENGINE_RECURSIVE_SHADOWCAST);
+  PyModule_AddIntConstant(m, "ENGINE_SYMMETRIC_SHADOWCAST",
+                          PYFOV_ENGINE_SYMMETRIC_SHADOWCAST);
+  PyModule_AddIntConstant(m, "ENGINE_PERMISSIVE", PYFOV_ENGINE_PERMISSIVE);
+  PyModule_AddIntConstant(m, "ENGINE_DIAMOND_WALLS",
+                          PYFOV_ENGINE_DIAMOND_WALLS);
+  PyModule_AddIntConstant(m, "ENGINE_TABLE", PYFOV_ENGINE_TABLE);
+  PyModule_AddIntConstant(m, "ENGINE_AUTO", PYFOV_ENGINE_AUTO);
+  // Only ever reported by Settings.last_engine
+  PyModule_AddIntConstant(m, "ENGINE_HEX", PYFOV_ENGINE_HEX);
+  PyModule_AddIntConstant(m, "ENGINE_BITBOARD", PYFOV_ENGINE_BITBOARD);
+
+  // pyfov_map_layout
+  PyModule_AddIntConstant(m, "MAP_SQUARE", PYFOV_MAP_SQUARE);
+  PyModule_AddIntConstant(m, "MAP_HEX", PYFOV_MAP_HEX);
+  PyModule_AddIntConstant(m, "MAP_ISOMETRIC", PYFOV_MAP_ISOMETRIC);
+
+  // The engine profile ENGINE_AUTO picks by, if one is configured
+  profile = getenv("PYFOV_PROFILE");
+  if (profile != NULL && *profile != '\0' && pyfov_profile_load(profile) < 0)
+    return;
 }
 
 static PyMethodDef pyfov_methods[] = {
+  {"load_profile", (PyCFunction)pyfov_load_profile,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"profile", (PyCFunction)pyfov_profile, METH_NOARGS, NULL},
+  {"autotune", (PyCFunction)pyfov_autotune,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"set_slow_log", (PyCFunction)pyfov_set_slow_log,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"slow_log", (PyCFunction)pyfov_slow_log,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"metrics_text", (PyCFunction)pyfov_metrics_export, METH_NOARGS, NULL},
   {NULL, NULL, 0, NULL} /* Sentinel */
 };
 
+/**
+ * Wraps a Settings method so that fov.metrics_text() counts its calls,
+ * failures and wall time
+ */
+#define PYFOV_COUNTED(METHOD, CALL) \
+  static PyObject * \
+  METHOD##_counted(pyfov_Settings *self, PyObject *args, \
+                   PyObject *kwargs) { \
+    uint64_t start = pyfov_clock_ns(); \
+    PyObject *result = METHOD(self, args, kwargs); \
+    pyfov_metrics_call(CALL, result == NULL, pyfov_clock_ns() - start); \
+    return result; \
+  }
+
+PYFOV_COUNTED(pyfov_Settings_beam, PYFOV_CALL_BEAM)
+PYFOV_COUNTED(pyfov_Settings_circle, PYFOV_CALL_CIRCLE)
+PYFOV_COUNTED(pyfov_Settings_circle_bits, PYFOV_CALL_CIRCLE_BITS)
+PYFOV_COUNTED(pyfov_Settings_circle_batch, PYFOV_CALL_CIRCLE_BATCH)
+PYFOV_COUNTED(pyfov_Settings_area_light, PYFOV_CALL_AREA_LIGHT)
+PYFOV_COUNTED(pyfov_Settings_flood, PYFOV_CALL_FLOOD)
+PYFOV_COUNTED(pyfov_Settings_iter_circle, PYFOV_CALL_ITER_CIRCLE)
+PYFOV_COUNTED(pyfov_Settings_nearest, PYFOV_CALL_NEAREST)
+
 static PyMethodDef pyfov_Settings_methods[] = {
   // We set METH_VARARGS to require a sane calling convention, even
-  // though we require all the args.  PyArg_ParseTuple does some
+  // though we require all the args.  PyArg_ParseTupleAndKeywords does some
   // awesome error handling.
-  {"beam", (PyCFunction)pyfov_Settings_beam, METH_VARARGS, NULL},
-  {"circle", (PyCFunction)pyfov_Settings_circle, METH_VARARGS, NULL},
+  {"beam", (PyCFunction)pyfov_Settings_beam_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"circle", (PyCFunction)pyfov_Settings_circle_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"circle_bits", (PyCFunction)pyfov_Settings_circle_bits_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"circle_batch", (PyCFunction)pyfov_Settings_circle_batch_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"benchmark", (PyCFunction)pyfov_Settings_benchmark,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"iter_circle", (PyCFunction)pyfov_Settings_iter_circle_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"nearest", (PyCFunction)pyfov_Settings_nearest_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"area_light", (PyCFunction)pyfov_Settings_area_light_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
+  {"flood", (PyCFunction)pyfov_Settings_flood_counted,
+   METH_VARARGS | METH_KEYWORDS, NULL},
   {NULL, NULL, 0, NULL} /* Sentinel */
 };
 
@@ -442,3 +3381,32 @@ init_fov_settings_type(PyTypeObject *t) {
   t->tp_methods = pyfov_Settings_methods;
   t->tp_getset = pyfov_Settings_properties;
 }
+
+static void
+init_fov_viewer_type(PyTypeObject *t) {
+  t->tp_name = "fov.Viewer";
+  t->tp_basicsize = sizeof(pyfov_Viewer);
+  t->tp_flags = Py_TPFLAGS_DEFAULT;
+  t->tp_doc = "A lit circle whose radius can be changed incrementally";
+
+  t->tp_init = (initproc)pyfov_Viewer_init;
+  t->tp_dealloc = (destructor)pyfov_Viewer_dealloc;
+
+  // Use a generic new method (inits members to 0/NULL)
+  t->tp_new = PyType_GenericNew;
+  t->tp_methods = pyfov_Viewer_methods;
+  t->tp_getset = pyfov_Viewer_properties;
+  t->tp_as_sequence = &pyfov_Viewer_sequence;
+  t->tp_iter = (getiterfunc)pyfov_Viewer_iter;
+}
+
+static void
+init_fov_sweep_iter_type(PyTypeObject *t) {
+  t->tp_name = "fov.SweepIterator";
+  t->tp_basicsize = sizeof(pyfov_SweepIter);
+  t->tp_flags = Py_TPFLAGS_DEFAULT;
+  t->tp_doc = "Lazy sweep over the lit cells of a circle";
+  t->tp_dealloc = (destructor)pyfov_SweepIter_dealloc;
+  t->tp_iter = PyObject_SelfIter;
+  t->tp_iternext = (iternextfunc)pyfov_SweepIter_next;
+}
@@ -0,0 +1,293 @@
+#include <Python.h>
+#include <string.h>
+#include "halo.h"
+
+/**
+ * Halos
+ *
+ * A world too big for one process is split into shards, each a Map with
+ * a halo as deep as its viewers see past its edges.  Shards publish the
+ * strips along their edges to shared memory and sync their halos from the
+ * strips their neighbours published, so sweeps near a border read the
+ * neighbour's cells without asking it for them.
+ *
+ * A published edge is the strip's columns and rows and a version per tile
+ * as uint32s, then the tiles' cells, tile after tile and row by row.  The
+ * versions work as seqlocks: the publisher makes a tile's version odd
+ * while it copies the tile and even again after, and a sync only keeps a
+ * copy made under one even version.  Version 0 was never published.
+ */
+
+/* Copies of a tile the neighbour keeps rewriting a sync tries */
+#define HALO_SYNC_TRIES 4
+
+/* Header words before the versions */
+#define HALO_HEADER 2
+
+/* Directions by whether y, then x, is before, on or after the map */
+static const fov_direction_type halo_sides[3][3] = {
+  {FOV_NORTHWEST, FOV_NORTH, FOV_NORTHEAST},
+  {FOV_WEST, FOV_EAST, FOV_EAST},
+  {FOV_SOUTHWEST, FOV_SOUTH, FOV_SOUTHEAST},
+};
+
+/* The sign of x and y toward each direction */
+static const int halo_units[8][2] = {
+  { 1,  0},  /* FOV_EAST */
+  { 1, -1},  /* FOV_NORTHEAST */
+  { 0, -1},  /* FOV_NORTH */
+  {-1, -1},  /* FOV_NORTHWEST */
+  {-1,  0},  /* FOV_WEST */
+  {-1,  1},  /* FOV_SOUTHWEST */
+  { 0,  1},  /* FOV_SOUTH */
+  { 1,  1},  /* FOV_SOUTHEAST */
+};
+
+/**
+ * A rectangle of storage cells
+ */
+typedef struct {
+  int col, row;
+  int cols, rows;
+} halo_rect;
+
+static int
+halo_start(int unit, int size, int halo, bool edge) {
+  if (unit < 0)
+    return edge ? 0 : -halo;
+  if (unit > 0)
+    return edge ? size - halo : size;
+  return 0;
+}
+
+/**
+ * The map's halo toward `side`, or with `edge` the cells along its edge
+ * that the neighbour on that side holds in its halo
+ */
+static halo_rect
+halo_strip(const pyfov_Map *map, fov_direction_type side, bool edge) {
+  int ux = halo_units[side][0], uy = halo_units[side][1];
+  halo_rect strip;
+
+  strip.col = halo_start(ux, map->width, map->halo, edge);
+  strip.row = halo_start(uy, map->height, map->halo, edge);
+  strip.cols = ux != 0 ? map->halo : map->width;
+  strip.rows = uy != 0 ? map->halo : map->height;
+  return strip;
+}
+
+/**
+ * Strips toward east and west are split into tiles of rows, those toward
+ * north and south into tiles of columns, and corners are a single tile
+ */
+static unsigned
+halo_tiles(const pyfov_Map *map, fov_direction_type side) {
+  int length = 1;
+
+  if (halo_units[side][1] == 0)
+    length = map->height;
+  else if (halo_units[side][0] == 0)
+    length = map->width;
+  return (length + PYFOV_HALO_TILE - 1) / PYFOV_HALO_TILE;
+}
+
+static halo_rect
+halo_tile(halo_rect strip, fov_direction_type side, unsigned t) {
+  int start = (int)t * PYFOV_HALO_TILE;
+
+  if (halo_units[side][1] == 0) {
+    strip.row += start;
+    strip.rows -= start;
+    if (strip.rows > PYFOV_HALO_TILE)
+      strip.rows = PYFOV_HALO_TILE;
+  } else if (halo_units[side][0] == 0) {
+    strip.col += start;
+    strip.cols -= start;
+    if (strip.cols > PYFOV_HALO_TILE)
+      strip.cols = PYFOV_HALO_TILE;
+  }
+  return strip;
+}
+
+/**
+ * The versions last synced into the halo toward `side`
+ */
+static uint32_t *
+halo_synced(pyfov_Map *map, fov_direction_type side) {
+  unsigned base = 0;
+  int s;
+
+  for (s = 0; s < (int)side; ++s)
+    base += halo_tiles(map, s);
+  return &map->halo_versions[base];
+}
+
+int
+pyfov_halo_alloc(pyfov_Map *map, int halo) {
+  halo_rect strip;
+  size_t cells = 0;
+  unsigned tiles = 0;
+  int side;
+
+  pyfov_halo_free(map);
+  if (halo == 0)
+    return 0;
+
+  map->halo = halo;
+  for (side = 0; side < 8; ++side) {
+    strip = halo_strip(map, side, false);
+    map->halo_offsets[side] = cells;
+    cells += (size_t)strip.cols * strip.rows;
+    tiles += halo_tiles(map, side);
+  }
+  map->halo_cells = PyMem_Malloc(cells);
+  map->halo_versions = PyMem_Malloc(tiles * sizeof(uint32_t));
+  if (map->halo_cells == NULL || map->halo_versions == NULL) {
+    pyfov_halo_free(map);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  // Until a neighbour publishes them, halo cells are walls like those off
+  // the map
+  memset(map->halo_cells, 1, cells);
+  memset(map->halo_versions, 0, tiles * sizeof(uint32_t));
+  return 0;
+}
+
+void
+pyfov_halo_free(pyfov_Map *map) {
+  PyMem_Free(map->halo_cells);
+  PyMem_Free(map->halo_versions);
+  map->halo_cells = NULL;
+  map->halo_versions = NULL;
+  map->halo = 0;
+}
+
+const unsigned char *
+pyfov_map_halo_cell(const pyfov_Map *map, int col, int row) {
+  fov_direction_type side;
+  halo_rect strip;
+  int halo = map->halo;
+
+  if (col < -halo || row < -halo || col >= map->width + halo ||
+      row >= map->height + halo)
+    return NULL;
+
+  side = halo_sides[(row >= 0) + (row >= map->height)]
+    [(col >= 0) + (col >= map->width)];
+  strip = halo_strip(map, side, false);
+  return &map->halo_cells[map->halo_offsets[side] +
+                          (size_t)(row - strip.row) * strip.cols +
+                          (col - strip.col)];
+}
+
+size_t
+pyfov_halo_edge_size(const pyfov_Map *map, fov_direction_type side) {
+  halo_rect strip = halo_strip(map, side, true);
+
+  return (HALO_HEADER + halo_tiles(map, side)) * sizeof(uint32_t) +
+    (size_t)strip.cols * strip.rows;
+}
+
+/**
+ * Whether `data` already holds the map's cells under `tile`
+ */
+static bool
+halo_same(const pyfov_Map *map, halo_rect tile, const unsigned char *data) {
+  int y;
+
+  for (y = 0; y < tile.rows; ++y)
+    if (memcmp(data + (size_t)y * tile.cols,
+               &map->cells[(tile.row + y) * map->stride + tile.col],
+               tile.cols) != 0)
+      return false;
+  return true;
+}
+
+unsigned
+pyfov_halo_publish(pyfov_Map *map, fov_direction_type side, void *buffer) {
+  volatile uint32_t *words = buffer, *versions = words + HALO_HEADER;
+  halo_rect strip = halo_strip(map, side, true), tile;
+  unsigned tiles = halo_tiles(map, side), t, written = 0;
+  unsigned char *data = (unsigned char *)(versions + tiles);
+  uint32_t version;
+  int y;
+
+  words[0] = strip.cols;
+  words[1] = strip.rows;
+  for (t = 0; t < tiles; ++t, data += (size_t)tile.cols * tile.rows) {
+    tile = halo_tile(strip, side, t);
+    version = versions[t];
+    if (version != 0 && !(version & 1) && halo_same(map, tile, data))
+      continue;
+
+    // A version left odd by a publisher that died mid copy is finished
+    version |= 1;
+    versions[t] = version;
+    __sync_synchronize();
+    for (y = 0; y < tile.rows; ++y)
+      memcpy(data + (size_t)y * tile.cols,
+             &map->cells[(tile.row + y) * map->stride + tile.col],
+             tile.cols);
+    __sync_synchronize();
+    versions[t] = version + 1;
+    ++written;
+  }
+  return written;
+}
+
+int
+pyfov_halo_sync(pyfov_Map *map, fov_direction_type side,
+                const void *buffer) {
+  const volatile uint32_t *words = buffer, *versions = words + HALO_HEADER;
+  halo_rect strip = halo_strip(map, side, false), tile;
+  unsigned tiles = halo_tiles(map, side), t;
+  const unsigned char *data = (const unsigned char *)(versions + tiles);
+  unsigned char *cells = &map->halo_cells[map->halo_offsets[side]];
+  unsigned char *scratch;
+  uint32_t *synced = halo_synced(map, side), version;
+  size_t size;
+  int copied = 0, tries, y;
+
+  // Nothing published yet
+  if (words[0] == 0 && words[1] == 0)
+    return 0;
+  if (words[0] != (uint32_t)strip.cols || words[1] != (uint32_t)strip.rows) {
+    PyErr_SetString(PyExc_ValueError,
+                    "published edge doesn't match the halo on that side");
+    return -1;
+  }
+
+  // Tiles are copied aside first, so a copy torn by the neighbour
+  // rewriting the tile never reaches the halo
+  tile = halo_tile(strip, side, 0);
+  if ((scratch = PyMem_Malloc((size_t)tile.cols * tile.rows)) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (t = 0; t < tiles; ++t, data += size) {
+    tile = halo_tile(strip, side, t);
+    size = (size_t)tile.cols * tile.rows;
+    for (tries = 0; tries < HALO_SYNC_TRIES; ++tries) {
+      version = versions[t];
+      if (version == 0 || (version & 1) || version == synced[t])
+        break;
+      __sync_synchronize();
+      memcpy(scratch, data, size);
+      __sync_synchronize();
+      if (versions[t] != version)
+        continue;
+      for (y = 0; y < tile.rows; ++y)
+        memcpy(&cells[(size_t)(tile.row - strip.row + y) * strip.cols +
+                      (tile.col - strip.col)],
+               scratch + (size_t)y * tile.cols, tile.cols);
+      synced[t] = version;
+      ++copied;
+      break;
+    }
+  }
+  PyMem_Free(scratch);
+  return copied;
+}
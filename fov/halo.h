@@ -0,0 +1,52 @@
+#ifndef PYFOV_HALO_H
+#define PYFOV_HALO_H
+
+#include <stddef.h>
+#include "fov/fov.h"
+#include "map.h"
+
+/**
+ * Halo strips are split into tiles of this many cells along their length,
+ * and only the tiles that changed are copied between shards
+ */
+#define PYFOV_HALO_TILE 64
+
+/**
+ * Gives an owned map a read-only margin `halo` cells deep on every side,
+ * opaque until it's synced.  Returns 0, or -1 with an exception set.
+ */
+int pyfov_halo_alloc(pyfov_Map *map, int halo);
+
+/**
+ * Drops the map's halo, if it has one
+ */
+void pyfov_halo_free(pyfov_Map *map);
+
+/**
+ * Bytes of shared memory that hold the map's edge toward `side`, as
+ * written by pyfov_halo_publish and read by pyfov_halo_sync on the
+ * neighbour: the strip's shape and a version per tile as uint32s, then
+ * the tiles' cells.  `buffer`s must be 4-byte aligned.
+ */
+size_t pyfov_halo_edge_size(const pyfov_Map *map, fov_direction_type side);
+
+/**
+ * Writes the `halo` cells deep strip along the map's `side` edge to
+ * `buffer`, bumping the version of each tile that changed.  Returns the
+ * number of tiles written.
+ */
+unsigned pyfov_halo_publish(pyfov_Map *map, fov_direction_type side,
+                            void *buffer);
+
+/**
+ * Copies the tiles of a neighbour's edge in `buffer` whose version moved
+ * since the last sync into the map's halo on `side`.  Each tile is copied
+ * aside and only committed to the halo once its version shows the copy is
+ * whole; tiles the neighbour is writing meanwhile are left for the next
+ * sync.  Returns the number of tiles copied, or -1 with an exception set
+ * if the edge is a different shape than the halo or memory runs out.
+ */
+int pyfov_halo_sync(pyfov_Map *map, fov_direction_type side,
+                    const void *buffer);
+
+#endif
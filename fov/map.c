@@ -0,0 +1,648 @@
+#include <Python.h>
+#include "map.h"
+#include "halo.h"
+
+/**
+ * fov.Map
+ *
+ * Example Usage:
+ *
+ * m = fov.Map(5, 5)
+ * m[2, 2] = 1
+ * s.circle(m, None, 0, 0, 4)
+ *
+ * With halo=n the map also holds, read-only, the n cells past each edge
+ * that belong to the neighbouring shards, as synced by sync_halo().
+ */
+
+PyTypeObject pyfov_MapType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+static Py_ssize_t
+_pyfov_Map_size(pyfov_Map *self) {
+  return (Py_ssize_t)self->width * self->height;
+}
+
+/**
+ * Drops the cells, whether the map owns them or views them.
+ */
+static void
+_pyfov_Map_clear(pyfov_Map *self) {
+  if (self->view.obj != NULL)
+    PyBuffer_Release(&self->view);
+  else
+    PyMem_Free(self->cells);
+  self->cells = NULL;
+  self->board_valid = false;
+  pyfov_halo_free(self);
+}
+
+static int
+_pyfov_Map_check_shape(int width, int height, int layout) {
+  if (width <= 0 || height <= 0) {
+    PyErr_SetString(PyExc_ValueError, "width and height must be positive");
+    return -1;
+  }
+  if (layout < 0 || layout >= PYFOV_MAP_LAYOUT_COUNT) {
+    PyErr_SetString(PyExc_ValueError, "unknown layout");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Raises BufferError if a batch is sweeping the map
+ */
+static int
+_pyfov_Map_check_idle(pyfov_Map *self) {
+  if (self->busy == 0)
+    return 0;
+  PyErr_SetString(PyExc_BufferError,
+                  "Map can't change while a batch sweeps it");
+  return -1;
+}
+
+/**
+ * Gives the map `width` * `height` cells of its own, zeroed, with the
+ * default opacity table.
+ */
+static int
+_pyfov_Map_alloc(pyfov_Map *self, int width, int height, int layout) {
+  _pyfov_Map_clear(self);
+  self->width = width;
+  self->height = height;
+  self->stride = width;
+  self->layout = (pyfov_map_layout)layout;
+  memset(self->lut, 1, sizeof(self->lut));
+  self->lut[0] = 0;
+
+  self->cells = PyMem_Malloc(_pyfov_Map_size(self));
+  if (self->cells == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  memset(self->cells, 0, _pyfov_Map_size(self));
+  return 0;
+}
+
+/**
+ * Fills a 256 entry opacity table from a string of opaque characters, or
+ * just "#" if `opaque` is NULL.  Unicode strings are taken as latin-1.
+ */
+static int
+_pyfov_Map_fill_lut(unsigned char *lut, PyObject *opaque) {
+  PyObject *bytes = NULL;
+  const char *chars;
+  Py_ssize_t len, i;
+
+  if (opaque == NULL) {
+    memset(lut, 0, 256);
+    lut['#'] = 1;
+    return 0;
+  }
+
+  if (PyUnicode_Check(opaque)) {
+    if ((bytes = PyUnicode_AsLatin1String(opaque)) == NULL)
+      return -1;
+    opaque = bytes;
+  }
+  if (PyObject_AsCharBuffer(opaque, &chars, &len) < 0) {
+    Py_XDECREF(bytes);
+    return -1;
+  }
+
+  memset(lut, 0, 256);
+  for (i = 0; i < len; ++i)
+    lut[(unsigned char)chars[i]] = 1;
+
+  Py_XDECREF(bytes);
+  return 0;
+}
+
+static int
+pyfov_Map_init(pyfov_Map *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"width", "height", "layout", "data", "halo",
+                           NULL};
+  int width, height;
+  int layout = PYFOV_MAP_SQUARE, halo = 0;
+  PyObject *data = Py_None;
+  const void *buf;
+  Py_ssize_t len;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|iOi", kwlist,
+                                   &width, &height, &layout, &data,
+                                   &halo)) {
+    return -1;
+  }
+  // Like bytearray, cells that buffers were taken of can't be dropped
+  if (self->exports != 0) {
+    PyErr_SetString(PyExc_BufferError,
+                    "Map can't be re-initialized while buffers of it exist");
+    return -1;
+  }
+  if (_pyfov_Map_check_idle(self) < 0) {
+    return -1;
+  }
+  if (_pyfov_Map_check_shape(width, height, layout) < 0) {
+    return -1;
+  }
+  if (halo < 0 || halo > width || halo > height) {
+    PyErr_SetString(PyExc_ValueError,
+                    "halo must be between 0 and the width and height");
+    return -1;
+  }
+  if (_pyfov_Map_alloc(self, width, height, layout) < 0 ||
+      pyfov_halo_alloc(self, halo) < 0) {
+    return -1;
+  }
+
+  if (data == Py_None) {
+    return 0;
+  }
+
+  // Copy the initial cells from anything that exposes a buffer
+  if (PyObject_AsReadBuffer(data, &buf, &len) < 0) {
+    return -1;
+  }
+  if (len != _pyfov_Map_size(self)) {
+    PyErr_SetString(PyExc_ValueError, "data must hold width * height bytes");
+    return -1;
+  }
+  memcpy(self->cells, buf, len);
+  return 0;
+}
+
+static void
+pyfov_Map_dealloc(pyfov_Map *self)
+{
+  _pyfov_Map_clear(self);
+  if (self->board != NULL)
+    --pyfov_bitboards;
+  PyMem_Free(self->board);
+  self->ob_type->tp_free(self);
+}
+
+/**
+ * Map.from_rows(rows, opaque="#", layout=MAP_SQUARE)
+ *
+ * Builds a map from a sequence of str/bytes rows in a single pass, e.g.
+ * a level file's lines.  Characters in `opaque` are opaque; rows shorter
+ * than the longest one are padded with opaque cells.
+ */
+static PyObject *
+pyfov_Map_from_rows(PyTypeObject *cls, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"rows", "opaque", "layout", NULL};
+  PyObject *rows, *opaque = NULL, *seq, *row, *bytes;
+  int layout = PYFOV_MAP_SQUARE;
+  unsigned char lut[256];
+  const char *chars;
+  Py_ssize_t len, width = 0, height, x, y;
+  pyfov_Map *self;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oi", kwlist,
+                                   &rows, &opaque, &layout))
+    return NULL;
+
+  if (_pyfov_Map_fill_lut(lut, opaque) < 0)
+    return NULL;
+
+  seq = PySequence_Fast(rows, "rows must be a sequence");
+  if (seq == NULL)
+    return NULL;
+  height = PySequence_Fast_GET_SIZE(seq);
+
+  for (y = 0; y < height; ++y) {
+    len = PyObject_Length(PySequence_Fast_GET_ITEM(seq, y));
+    if (len < 0) {
+      Py_DECREF(seq);
+      return NULL;
+    }
+    if (len > width)
+      width = len;
+  }
+  if (width > INT_MAX || height > INT_MAX ||
+      _pyfov_Map_check_shape((int)width, (int)height, layout) < 0) {
+    if (!PyErr_Occurred())
+      PyErr_SetString(PyExc_OverflowError, "too many rows or columns");
+    Py_DECREF(seq);
+    return NULL;
+  }
+
+  self = (pyfov_Map *)cls->tp_alloc(cls, 0);
+  if (self == NULL ||
+      _pyfov_Map_alloc(self, (int)width, (int)height, layout) < 0) {
+    Py_XDECREF(self);
+    Py_DECREF(seq);
+    return NULL;
+  }
+
+  for (y = 0; y < height; ++y) {
+    row = PySequence_Fast_GET_ITEM(seq, y);
+    bytes = NULL;
+    if (PyUnicode_Check(row)) {
+      if ((row = bytes = PyUnicode_AsLatin1String(row)) == NULL)
+        goto fail;
+    }
+    if (PyObject_AsCharBuffer(row, &chars, &len) < 0) {
+      Py_XDECREF(bytes);
+      goto fail;
+    }
+    for (x = 0; x < len; ++x)
+      self->cells[y * width + x] = lut[(unsigned char)chars[x]];
+    for (; x < width; ++x)
+      self->cells[y * width + x] = 1;
+    Py_XDECREF(bytes);
+  }
+
+  Py_DECREF(seq);
+  return (PyObject *)self;
+
+fail:
+  Py_DECREF(self);
+  Py_DECREF(seq);
+  return NULL;
+}
+
+/**
+ * Map.from_bytes(data, width, height=None, stride=None, opaque="#",
+ *                layout=MAP_SQUARE)
+ *
+ * Builds a read-only map that views `data` without copying it, e.g. a
+ * whole level file with stride = width + 1 to skip the newlines.  Row y
+ * starts at byte y * stride.  The opacity of each byte is looked up in a
+ * table built from `opaque`.
+ */
+static PyObject *
+pyfov_Map_from_bytes(PyTypeObject *cls, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"data", "width", "height", "stride", "opaque",
+                           "layout", NULL};
+  PyObject *data, *opaque = NULL;
+  int width, height = -1, layout = PYFOV_MAP_SQUARE;
+  Py_ssize_t stride = -1;
+  pyfov_Map *self;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|inOi", kwlist,
+                                   &data, &width, &height, &stride,
+                                   &opaque, &layout))
+    return NULL;
+
+  self = (pyfov_Map *)cls->tp_alloc(cls, 0);
+  if (self == NULL)
+    return NULL;
+
+  // Holding the buffer keeps the data from being resized under us
+  if (PyObject_GetBuffer(data, &self->view, PyBUF_SIMPLE) < 0)
+    goto fail;
+
+  if (stride < 0)
+    stride = width;
+  if (height < 0)
+    height = stride > 0 && self->view.len >= width ?
+      (int)((self->view.len - width) / stride + 1) : 1;
+  if (_pyfov_Map_check_shape(width, height, layout) < 0)
+    goto fail;
+  if (stride < width ||
+      (Py_ssize_t)(height - 1) * stride + width > self->view.len) {
+    PyErr_SetString(PyExc_ValueError,
+                    "data is too short for width, height and stride");
+    goto fail;
+  }
+
+  if (_pyfov_Map_fill_lut(self->lut, opaque) < 0)
+    goto fail;
+
+  self->width = width;
+  self->height = height;
+  self->stride = stride;
+  self->layout = (pyfov_map_layout)layout;
+  self->cells = self->view.buf;
+  return (PyObject *)self;
+
+fail:
+  Py_DECREF(self);
+  return NULL;
+}
+
+/**
+ * Parses the (side, buffer) arguments of the halo methods, checking that
+ * `buffer` holds the edge toward `side`
+ */
+static int
+_pyfov_Map_edge_args(pyfov_Map *self, PyObject *args, bool writable,
+                     int *side, void **buf) {
+  PyObject *buffer;
+  Py_ssize_t len;
+
+  if (!PyArg_ParseTuple(args, "iO", side, &buffer))
+    return -1;
+  if (self->halo == 0) {
+    PyErr_SetString(PyExc_ValueError, "Map has no halo");
+    return -1;
+  }
+  if (*side < 0 || *side >= 8) {
+    PyErr_SetString(PyExc_ValueError, "side must be a direction");
+    return -1;
+  }
+  if ((writable ? PyObject_AsWriteBuffer(buffer, buf, &len) :
+       PyObject_AsReadBuffer(buffer, (const void **)buf, &len)) < 0)
+    return -1;
+  if ((size_t)len < pyfov_halo_edge_size(self, *side)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer must hold edge_size(side) bytes");
+    return -1;
+  }
+  if ((uintptr_t)*buf % sizeof(uint32_t) != 0) {
+    PyErr_SetString(PyExc_ValueError, "buffer must be 4-byte aligned");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Map.edge_size(side)
+ *
+ * Bytes of shared memory that publish_edge(side, ...) writes to.
+ */
+static PyObject *
+pyfov_Map_edge_size(pyfov_Map *self, PyObject *args) {
+  int side;
+
+  if (!PyArg_ParseTuple(args, "i", &side))
+    return NULL;
+  if (self->halo == 0) {
+    PyErr_SetString(PyExc_ValueError, "Map has no halo");
+    return NULL;
+  }
+  if (side < 0 || side >= 8) {
+    PyErr_SetString(PyExc_ValueError, "side must be a direction");
+    return NULL;
+  }
+  return PyInt_FromSize_t(pyfov_halo_edge_size(self, side));
+}
+
+/**
+ * Map.publish_edge(side, buffer)
+ *
+ * Writes the cells along the map's edge toward `side` (e.g. fov.EAST),
+ * `halo` cells deep, to `buffer` (e.g. an mmap shared with the neighbour
+ * on that side, who syncs them from the opposite side).  Only the tiles
+ * that changed since they were last published are written.  Returns the
+ * number of tiles written.
+ */
+static PyObject *
+pyfov_Map_publish_edge(pyfov_Map *self, PyObject *args) {
+  void *buf;
+  int side;
+
+  if (_pyfov_Map_edge_args(self, args, true, &side, &buf) < 0)
+    return NULL;
+  return PyInt_FromLong(pyfov_halo_publish(self, side, buf));
+}
+
+/**
+ * Map.sync_halo(side, buffer)
+ *
+ * Copies the tiles of the edge the neighbour toward `side` published to
+ * `buffer` that changed since the last sync into the halo on that side.
+ * Returns the number of tiles copied.
+ */
+static PyObject *
+pyfov_Map_sync_halo(pyfov_Map *self, PyObject *args) {
+  void *buf;
+  int side, copied;
+
+  if (_pyfov_Map_edge_args(self, args, false, &side, &buf) < 0 ||
+      _pyfov_Map_check_idle(self) < 0)
+    return NULL;
+  if ((copied = pyfov_halo_sync(self, side, buf)) < 0)
+    return NULL;
+  return PyInt_FromLong(copied);
+}
+
+static PyMethodDef pyfov_Map_methods[] = {
+  {"from_rows", (PyCFunction)pyfov_Map_from_rows,
+   METH_VARARGS | METH_KEYWORDS | METH_CLASS, NULL},
+  {"from_bytes", (PyCFunction)pyfov_Map_from_bytes,
+   METH_VARARGS | METH_KEYWORDS | METH_CLASS, NULL},
+  {"edge_size", (PyCFunction)pyfov_Map_edge_size, METH_VARARGS, NULL},
+  {"publish_edge", (PyCFunction)pyfov_Map_publish_edge, METH_VARARGS, NULL},
+  {"sync_halo", (PyCFunction)pyfov_Map_sync_halo, METH_VARARGS, NULL},
+  {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+/**
+ * Property implementations
+ */
+static PyObject *
+pyfov_Map_get_width(pyfov_Map *self, void *data) {
+  return PyInt_FromLong(self->width);
+}
+
+static PyObject *
+pyfov_Map_get_height(pyfov_Map *self, void *data) {
+  return PyInt_FromLong(self->height);
+}
+
+static PyObject *
+pyfov_Map_get_layout(pyfov_Map *self, void *data) {
+  return PyInt_FromLong(self->layout);
+}
+
+static PyObject *
+pyfov_Map_get_halo(pyfov_Map *self, void *data) {
+  return PyInt_FromLong(self->halo);
+}
+
+static PyGetSetDef pyfov_Map_properties[] = {
+  {"width", (getter)pyfov_Map_get_width, NULL, "", NULL},
+  {"height", (getter)pyfov_Map_get_height, NULL, "", NULL},
+  {"layout", (getter)pyfov_Map_get_layout, NULL, "", NULL},
+  {"halo", (getter)pyfov_Map_get_halo, NULL, "", NULL},
+  /* Sentinel */
+  {NULL, NULL, NULL, NULL, NULL},
+};
+
+/**
+ * m[x, y], in storage coordinates.  Halo cells can be read but not
+ * written.
+ */
+static unsigned char *
+_pyfov_Map_cell(pyfov_Map *self, PyObject *key, bool write) {
+  const unsigned char *cell;
+  int x, y;
+
+  if (!PyTuple_Check(key) || !PyArg_ParseTuple(key, "ii", &x, &y)) {
+    PyErr_Clear();
+    PyErr_SetString(PyExc_TypeError, "Map keys are (x, y) tuples");
+    return NULL;
+  }
+  if (x >= 0 && y >= 0 && x < self->width && y < self->height)
+    return &self->cells[y * self->stride + x];
+
+  cell = self->halo > 0 ? pyfov_map_halo_cell(self, x, y) : NULL;
+  if (cell == NULL) {
+    PyErr_SetString(PyExc_IndexError, "Map index out of range");
+    return NULL;
+  }
+  if (write) {
+    PyErr_SetString(PyExc_TypeError, "Map halo cells are read-only");
+    return NULL;
+  }
+  return (unsigned char *)cell;
+}
+
+static PyObject *
+pyfov_Map_getitem(pyfov_Map *self, PyObject *key) {
+  unsigned char *cell = _pyfov_Map_cell(self, key, false);
+
+  if (cell == NULL)
+    return NULL;
+  return PyInt_FromLong(*cell);
+}
+
+static int
+pyfov_Map_setitem(pyfov_Map *self, PyObject *key, PyObject *value) {
+  unsigned char *cell = _pyfov_Map_cell(self, key, true);
+  long lvalue;
+
+  if (cell == NULL)
+    return -1;
+  if (self->view.obj != NULL) {
+    PyErr_SetString(PyExc_TypeError, "Map is a read-only view");
+    return -1;
+  }
+  if (_pyfov_Map_check_idle(self) < 0)
+    return -1;
+  if (value == NULL) {
+    PyErr_SetString(PyExc_TypeError, "Map cells can't be deleted");
+    return -1;
+  }
+  lvalue = PyInt_AsLong(value);
+  if (PyErr_Occurred())
+    return -1;
+  if (lvalue < 0 || lvalue > 255) {
+    PyErr_SetString(PyExc_ValueError, "Map cells hold 0-255");
+    return -1;
+  }
+  *cell = (unsigned char)lvalue;
+  self->board_valid = false;
+  return 0;
+}
+
+static PyMappingMethods pyfov_Map_as_mapping = {
+  (lenfunc)_pyfov_Map_size,
+  (binaryfunc)pyfov_Map_getitem,
+  (objobjargproc)pyfov_Map_setitem,
+};
+
+/**
+ * The cells of maps that own them are exposed as a writable buffer, so
+ * they can be filled in bulk (e.g. memoryview(m)[:] = data).  Only the new
+ * buffer protocol is offered: the old one can't tell when a pointer to the
+ * cells is let go, so re-initializing the map could free cells still
+ * written through it, and cached bitboards couldn't be trusted.
+ */
+static int
+pyfov_Map_getbuffer(pyfov_Map *self, Py_buffer *view, int flags) {
+  if (self->view.obj != NULL) {
+    PyErr_SetString(PyExc_BufferError, "Map is a read-only view");
+    return -1;
+  }
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE &&
+      _pyfov_Map_check_idle(self) < 0)
+    return -1;
+  if (PyBuffer_FillInfo(view, (PyObject *)self, self->cells,
+                        _pyfov_Map_size(self), 0, flags) < 0)
+    return -1;
+  self->exports++;
+  self->board_valid = false;
+  return 0;
+}
+
+static void
+pyfov_Map_releasebuffer(pyfov_Map *self, Py_buffer *view) {
+  self->exports--;
+  // Bitboards built while the buffer was held may predate its last writes
+  self->board_valid = false;
+}
+
+static PyBufferProcs pyfov_Map_as_buffer = {
+  (readbufferproc)NULL,
+  (writebufferproc)NULL,
+  (segcountproc)NULL,
+  (charbufferproc)NULL,
+  (getbufferproc)pyfov_Map_getbuffer,
+  (releasebufferproc)pyfov_Map_releasebuffer,
+};
+
+/**
+ * Bitboards
+ */
+unsigned long long pyfov_bitboard_hits = 0;
+unsigned long long pyfov_bitboard_builds = 0;
+unsigned long pyfov_bitboards = 0;
+
+pyfov_bitboard *
+pyfov_map_bitboard(pyfov_Map *map) {
+  int x, y;
+  uint64_t row;
+  const unsigned char *cells;
+
+  if (map->cells == NULL || map->layout != PYFOV_MAP_SQUARE ||
+      map->width > 64 || map->height > 64 || map->halo > 0) {
+    PyErr_SetString(PyExc_ValueError, "bitboards need a square Map of at "
+                    "most 64x64 cells without a halo");
+    return NULL;
+  }
+
+  // Owned cells and read-only views only change in ways we see
+  if (map->board_valid && map->exports == 0 &&
+      (map->view.obj == NULL || map->view.readonly)) {
+    ++pyfov_bitboard_hits;
+    return map->board;
+  }
+
+  if (map->board == NULL) {
+    map->board = PyMem_Malloc(sizeof(pyfov_bitboard));
+    if (map->board == NULL) {
+      PyErr_NoMemory();
+      return NULL;
+    }
+    ++pyfov_bitboards;
+  }
+
+  ++pyfov_bitboard_builds;
+  for (y = 0; y < 64; ++y) {
+    row = ~(uint64_t)0;
+    if (y < map->height) {
+      cells = &map->cells[y * map->stride];
+      for (x = 0; x < map->width; ++x)
+        if (!map->lut[cells[x]])
+          row &= ~((uint64_t)1 << x);
+    }
+    map->board->rows[y] = row;
+  }
+  pyfov_bitboard_fill(map->board);
+
+  map->board_valid = true;
+  return map->board;
+}
+
+void
+init_fov_map_type(PyTypeObject *t) {
+  t->tp_name = "fov.Map";
+  t->tp_basicsize = sizeof(pyfov_Map);
+  t->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+  t->tp_doc = "Native opacity grid";
+
+  t->tp_init = (initproc)pyfov_Map_init;
+  t->tp_dealloc = (destructor)pyfov_Map_dealloc;
+
+  // Use a generic new method (inits members to 0/NULL)
+  t->tp_new = PyType_GenericNew;
+  t->tp_methods = pyfov_Map_methods;
+  t->tp_getset = pyfov_Map_properties;
+  t->tp_as_mapping = &pyfov_Map_as_mapping;
+  t->tp_as_buffer = &pyfov_Map_as_buffer;
+}
@@ -0,0 +1,152 @@
+#ifndef PYFOV_MAP_H
+#define PYFOV_MAP_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "engines.h"
+
+/**
+ * How a fov.Map's storage relates to the square grid the engines sweep.
+ */
+typedef enum {
+  /* Storage is the grid */
+  PYFOV_MAP_SQUARE,
+  /* Axial (q, r) hex coordinates, swept by the hex kernel */
+  PYFOV_MAP_HEX,
+  /**
+   * Staggered rows of a diamond isometric map: odd rows are shifted half a
+   * tile to the right.  The engines sweep the underlying square grid.
+   */
+  PYFOV_MAP_ISOMETRIC,
+
+  PYFOV_MAP_LAYOUT_COUNT
+} pyfov_map_layout;
+
+/**
+ * A native opacity grid that circle and beam read without calling back
+ * into python.  Cells are bytes whose opacity is looked up in `lut`;
+ * everything outside of the map and its halo is opaque.
+ */
+typedef struct {
+  PyObject_HEAD
+
+  int width;
+  int height;
+  pyfov_map_layout layout;
+
+  /**
+   * height rows of width cells, `stride` bytes apart
+   */
+  unsigned char *cells;
+  Py_ssize_t stride;
+
+  /**
+   * Opacity of each byte value.  Maps that own their cells treat zero as
+   * transparent and anything else as opaque.
+   */
+  unsigned char lut[256];
+
+  /**
+   * For read-only maps viewing someone else's bytes (Map.from_bytes), the
+   * buffer that holds them.  view.obj is NULL when the map owns its cells.
+   */
+  Py_buffer view;
+
+  /**
+   * Read-only margin around maps split into shards, holding the edges of
+   * the neighbouring shards: storage cells -halo to width + halo - 1 and
+   * -halo to height + halo - 1 that aren't in the map.  `halo_cells` holds
+   * the margin toward each direction, row by row, from `halo_offsets`, and
+   * `halo_versions` the version of each tile last synced.
+   */
+  int halo;
+  unsigned char *halo_cells;
+  size_t halo_offsets[8];
+  uint32_t *halo_versions;
+
+  /**
+   * Cached opacity bitboards for maps of at most 64x64 cells, and whether
+   * they still match the cells.  Writes through exported buffers can't be
+   * seen, so the cache isn't trusted while any are alive.
+   */
+  pyfov_bitboard *board;
+  bool board_valid;
+  Py_ssize_t exports;
+
+  /**
+   * Batches sweeping the map with the GIL released.  The map can't change
+   * while any are.
+   */
+  Py_ssize_t busy;
+} pyfov_Map;
+
+extern PyTypeObject pyfov_MapType;
+
+#define pyfov_Map_Check(op) PyObject_TypeCheck(op, &pyfov_MapType)
+
+void init_fov_map_type(PyTypeObject *t);
+
+/**
+ * Returns the map's opacity bitboards, or NULL with an exception set if
+ * the map isn't a square map of at most 64x64 cells without a halo.
+ */
+pyfov_bitboard *pyfov_map_bitboard(pyfov_Map *map);
+
+/**
+ * Bitboard cache counters: lookups served from the cache, lookups that
+ * (re)built the bitboards, and bitboards currently allocated
+ */
+extern unsigned long long pyfov_bitboard_hits;
+extern unsigned long long pyfov_bitboard_builds;
+extern unsigned long pyfov_bitboards;
+
+/**
+ * The halo cell at storage cell (col, row), or NULL if it's outside of
+ * the halo.  Only called for cells outside of the map.
+ */
+const unsigned char *pyfov_map_halo_cell(const pyfov_Map *map, int col,
+                                         int row);
+
+/**
+ * Translates a cell of the grid the engines sweep to its storage cell.
+ */
+static inline void
+pyfov_map_to_storage(pyfov_Map *map, int x, int y, int *col, int *row) {
+  if (map->layout == PYFOV_MAP_ISOMETRIC) {
+    *row = x + y;
+    *col = (x - y - (*row & 1)) / 2;
+  } else {
+    *col = x;
+    *row = y;
+  }
+}
+
+/**
+ * Translates a storage cell to the grid the engines sweep.
+ */
+static inline void
+pyfov_map_from_storage(pyfov_Map *map, int col, int row, int *x, int *y) {
+  if (map->layout == PYFOV_MAP_ISOMETRIC) {
+    *x = col + (row + (row & 1)) / 2;
+    *y = (row - (row & 1)) / 2 - col;
+  } else {
+    *x = col;
+    *y = row;
+  }
+}
+
+static inline bool
+pyfov_map_opaque(pyfov_Map *map, int x, int y) {
+  const unsigned char *cell;
+  int col, row;
+
+  pyfov_map_to_storage(map, x, y, &col, &row);
+  if (col < 0 || row < 0 || col >= map->width || row >= map->height) {
+    cell = map->halo > 0 ? pyfov_map_halo_cell(map, col, row) : NULL;
+    return cell == NULL || map->lut[*cell];
+  }
+  return map->lut[map->cells[row * map->stride + col]];
+}
+
+#endif
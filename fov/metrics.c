@@ -0,0 +1,214 @@
+#include <Python.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "metrics.h"
+#include "map.h"
+#include "profile.h"
+#include "slowlog.h"
+
+/**
+ * Module metrics
+ *
+ * Plain counters bumped by every call, rendered straight to Prometheus
+ * text by fov.metrics_text() along with the state of the module's caches.
+ */
+
+/* Call durations are bucketed at 1us * 4^k */
+#define METRICS_BUCKETS 9
+
+static const char *call_names[PYFOV_CALL_COUNT] = {
+  "circle", "beam", "circle_bits", "area_light", "flood", "circle_batch",
+  "iter_circle", "nearest",
+};
+
+/* Indexed by pyfov_engine_type, as named in engine profiles */
+static const char *engine_names[PYFOV_ENGINE_AUTO] = {
+  "libfov", "recursive", "symmetric", "permissive", "diamond", "table",
+  "hex", "bitboard",
+};
+
+static struct {
+  unsigned long long calls[PYFOV_CALL_COUNT];
+  unsigned long long errors[PYFOV_CALL_COUNT];
+  /* Per call, calls that took at most each bucket's bound, not cumulative;
+   * the last bucket is +Inf */
+  unsigned long long buckets[PYFOV_CALL_COUNT][METRICS_BUCKETS + 1];
+  uint64_t ns[PYFOV_CALL_COUNT];
+  unsigned long long sweeps[PYFOV_ENGINE_AUTO];
+  unsigned long long probes;
+  unsigned long long lit;
+} metrics;
+
+void
+pyfov_metrics_call(pyfov_call call, bool failed, uint64_t ns) {
+  uint64_t bound = 1000;
+  int b;
+
+  ++metrics.calls[call];
+  if (failed)
+    ++metrics.errors[call];
+  metrics.ns[call] += ns;
+  for (b = 0; b < METRICS_BUCKETS && ns > bound; ++b)
+    bound *= 4;
+  ++metrics.buckets[call][b];
+}
+
+void
+pyfov_metrics_sweep(pyfov_engine_type engine, unsigned long probes,
+                    unsigned long lit) {
+  if ((unsigned)engine < PYFOV_ENGINE_AUTO)
+    ++metrics.sweeps[engine];
+  metrics.probes += probes;
+  metrics.lit += lit;
+}
+
+/**
+ * A growing text buffer.  Once an allocation fails it stops growing, and
+ * metrics_text reports the failure.
+ */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+  bool failed;
+} metrics_buffer;
+
+static void
+metrics_printf(metrics_buffer *buf, const char *format, ...) {
+  va_list args;
+  char *data;
+  int n;
+
+  if (buf->failed)
+    return;
+  for (;;) {
+    va_start(args, format);
+    n = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, args);
+    va_end(args);
+    if (n < 0) {
+      buf->failed = true;
+      return;
+    }
+    if ((size_t)n < buf->size - buf->len)
+      break;
+    data = realloc(buf->data, buf->size * 2 + n);
+    if (data == NULL) {
+      buf->failed = true;
+      return;
+    }
+    buf->data = data;
+    buf->size = buf->size * 2 + n;
+  }
+  buf->len += n;
+}
+
+static void
+metrics_header(metrics_buffer *buf, const char *name, const char *type,
+               const char *help) {
+  metrics_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+                 type);
+}
+
+static void
+metrics_value(metrics_buffer *buf, const char *name, const char *type,
+              const char *help, unsigned long long value) {
+  metrics_header(buf, name, type, help);
+  metrics_printf(buf, "%s %llu\n", name, value);
+}
+
+PyObject *
+pyfov_metrics_text(void) {
+  metrics_buffer buf = {NULL, 0, 4096, false};
+  unsigned entries, capacity;
+  unsigned long long cumulative;
+  size_t slow_bytes;
+  double bound;
+  PyObject *text;
+  int c, b, e;
+
+  if ((buf.data = malloc(buf.size)) == NULL)
+    return PyErr_NoMemory();
+  pyfov_slowlog_stats(&entries, &capacity, &slow_bytes);
+
+  metrics_header(&buf, "pyfov_calls_total", "counter",
+                 "Settings method calls.");
+  for (c = 0; c < PYFOV_CALL_COUNT; ++c)
+    metrics_printf(&buf, "pyfov_calls_total{call=\"%s\"} %llu\n",
+                   call_names[c], metrics.calls[c]);
+  metrics_header(&buf, "pyfov_call_errors_total", "counter",
+                 "Settings method calls that raised.");
+  for (c = 0; c < PYFOV_CALL_COUNT; ++c)
+    metrics_printf(&buf, "pyfov_call_errors_total{call=\"%s\"} %llu\n",
+                   call_names[c], metrics.errors[c]);
+
+  metrics_header(&buf, "pyfov_call_duration_seconds", "histogram",
+                 "Wall time of Settings method calls.");
+  for (c = 0; c < PYFOV_CALL_COUNT; ++c) {
+    cumulative = 0;
+    bound = 1e-6;
+    for (b = 0; b < METRICS_BUCKETS; ++b, bound *= 4) {
+      cumulative += metrics.buckets[c][b];
+      metrics_printf(&buf, "pyfov_call_duration_seconds_bucket"
+                     "{call=\"%s\",le=\"%g\"} %llu\n",
+                     call_names[c], bound, cumulative);
+    }
+    cumulative += metrics.buckets[c][METRICS_BUCKETS];
+    metrics_printf(&buf, "pyfov_call_duration_seconds_bucket"
+                   "{call=\"%s\",le=\"+Inf\"} %llu\n",
+                   call_names[c], cumulative);
+    metrics_printf(&buf, "pyfov_call_duration_seconds_sum{call=\"%s\"} "
+                   "%.9f\n", call_names[c], metrics.ns[c] / 1e9);
+    metrics_printf(&buf, "pyfov_call_duration_seconds_count{call=\"%s\"} "
+                   "%llu\n", call_names[c], cumulative);
+  }
+
+  metrics_header(&buf, "pyfov_sweeps_total", "counter",
+                 "Circle, beam, batch and lazy sweeps by the engine that "
+                 "ran them.");
+  for (e = 0; e < PYFOV_ENGINE_AUTO; ++e)
+    metrics_printf(&buf, "pyfov_sweeps_total{engine=\"%s\"} %llu\n",
+                   engine_names[e], metrics.sweeps[e]);
+  metrics_value(&buf, "pyfov_probes_total", "counter",
+                "Opacity tests made by circle, beam, batch and lazy sweeps.",
+                metrics.probes);
+  metrics_value(&buf, "pyfov_lit_cells_total", "counter",
+                "Cells lit by circle, beam, batch and lazy sweeps.",
+                metrics.lit);
+
+  metrics_value(&buf, "pyfov_bitboard_cache_hits_total", "counter",
+                "Map bitboard lookups served from the cache.",
+                pyfov_bitboard_hits);
+  metrics_value(&buf, "pyfov_bitboard_cache_builds_total", "counter",
+                "Map bitboard lookups that rebuilt the bitboards.",
+                pyfov_bitboard_builds);
+  metrics_value(&buf, "pyfov_bitboards", "gauge",
+                "Maps holding bitboards.", pyfov_bitboards);
+
+  metrics_value(&buf, "pyfov_slow_log_entries", "gauge",
+                "Calls held by the slow log.", entries);
+  metrics_value(&buf, "pyfov_slow_log_capacity", "gauge",
+                "Calls the slow log holds at most.", capacity);
+  metrics_header(&buf, "pyfov_slow_log_threshold_seconds", "gauge",
+                 "Slow log threshold; 0 when it is off.");
+  metrics_printf(&buf, "pyfov_slow_log_threshold_seconds %.9f\n",
+                 pyfov_slowlog_threshold / 1e9);
+  metrics_value(&buf, "pyfov_profile_rules", "gauge",
+                "Rules in the engine profile.", pyfov_profile_rules());
+
+  metrics_header(&buf, "pyfov_memory_bytes", "gauge",
+                 "Memory held by the module's caches.");
+  metrics_printf(&buf, "pyfov_memory_bytes{area=\"bitboards\"} %llu\n",
+                 (unsigned long long)pyfov_bitboards *
+                 sizeof(pyfov_bitboard));
+  metrics_printf(&buf, "pyfov_memory_bytes{area=\"slow_log\"} %llu\n",
+                 (unsigned long long)slow_bytes);
+
+  if (buf.failed) {
+    free(buf.data);
+    return PyErr_NoMemory();
+  }
+  text = PyString_FromStringAndSize(buf.data, buf.len);
+  free(buf.data);
+  return text;
+}
@@ -0,0 +1,43 @@
+#ifndef PYFOV_METRICS_H
+#define PYFOV_METRICS_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "engines.h"
+
+/**
+ * Settings methods the module counts
+ */
+typedef enum {
+  PYFOV_CALL_CIRCLE,
+  PYFOV_CALL_BEAM,
+  PYFOV_CALL_CIRCLE_BITS,
+  PYFOV_CALL_AREA_LIGHT,
+  PYFOV_CALL_FLOOD,
+  PYFOV_CALL_CIRCLE_BATCH,
+  PYFOV_CALL_ITER_CIRCLE,
+  PYFOV_CALL_NEAREST,
+
+  PYFOV_CALL_COUNT
+} pyfov_call;
+
+/**
+ * Counts a call that took `ns`, and whether it raised
+ */
+void pyfov_metrics_call(pyfov_call call, bool failed, uint64_t ns);
+
+/**
+ * Counts a circle, beam, batched or lazy sweep run by `engine`, and the
+ * opacity probes and lit cells it made
+ */
+void pyfov_metrics_sweep(pyfov_engine_type engine, unsigned long probes,
+                         unsigned long lit);
+
+/**
+ * Every module counter, histogram and cache in the Prometheus text
+ * exposition format.  Returns a new str, or NULL with an exception set.
+ */
+PyObject *pyfov_metrics_text(void);
+
+#endif
@@ -0,0 +1,539 @@
+#include <Python.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+#include "map.h"
+#include "dictmap.h"
+
+/**
+ * Engine profiles
+ *
+ * A profile is a text file of rules, one per line:
+ *
+ *   # kind radius density engine
+ *   bitboard 16 * bitboard
+ *   * 8 0.2 recursive
+ *   * * * libfov
+ *
+ * `kind` is one of map, bitboard, dict, lookup, callback or * for any map;
+ * bitboard rules match circles that could be swept on a fov.Map's
+ * bitboards.  A call matches a rule if its radius and sampled density are
+ * at most the rule's (* matches anything), and ENGINE_AUTO runs the engine
+ * of the first rule it matches, or libfov if there is none.  Densities run
+ * from 0 to 1 and lines are at most 255 bytes.
+ */
+#define PYFOV_PROFILE_MAX_RULES 128
+
+static const char *kind_names[PYFOV_KIND_COUNT] = {
+  "*", "map", "bitboard", "dict", "lookup", "callback",
+};
+
+static const struct {
+  const char *name;
+  pyfov_engine_type engine;
+} engine_names[] = {
+  {"libfov", PYFOV_ENGINE_LIBFOV},
+  {"recursive", PYFOV_ENGINE_RECURSIVE_SHADOWCAST},
+  {"symmetric", PYFOV_ENGINE_SYMMETRIC_SHADOWCAST},
+  {"permissive", PYFOV_ENGINE_PERMISSIVE},
+  {"diamond", PYFOV_ENGINE_DIAMOND_WALLS},
+  {"table", PYFOV_ENGINE_TABLE},
+  {"bitboard", PYFOV_ENGINE_BITBOARD},
+  {NULL, 0},
+};
+
+/* Until a profile is loaded, only bitboard sweeps are picked over libfov */
+static pyfov_profile_rule rules[PYFOV_PROFILE_MAX_RULES] = {
+  {PYFOV_KIND_BITBOARD, UINT_MAX, 1.0f, PYFOV_ENGINE_BITBOARD},
+  {PYFOV_KIND_ANY, UINT_MAX, 1.0f, PYFOV_ENGINE_LIBFOV},
+};
+static int nrules = 2;
+
+pyfov_engine_type
+pyfov_profile_choose(pyfov_map_kind kind, unsigned radius, float density,
+                     bool bitboard) {
+  const pyfov_profile_rule *rule;
+  int i;
+
+  for (i = 0; i < nrules; ++i) {
+    rule = &rules[i];
+    if ((rule->kind == PYFOV_KIND_ANY || rule->kind == kind ||
+         (rule->kind == PYFOV_KIND_BITBOARD && bitboard)) &&
+        radius <= rule->radius && density <= rule->density &&
+        (bitboard || rule->engine != PYFOV_ENGINE_BITBOARD))
+      return rule->engine;
+  }
+  return PYFOV_ENGINE_LIBFOV;
+}
+
+static const char *
+engine_name(pyfov_engine_type engine) {
+  int i;
+
+  for (i = 0; engine_names[i].name != NULL; ++i)
+    if (engine_names[i].engine == engine)
+      return engine_names[i].name;
+  return NULL;
+}
+
+/**
+ * Parses one rule from `line`.  Returns 1 if it held one, 0 if it was
+ * blank or a comment, or -1 if it couldn't be read.
+ */
+static int
+parse_rule(char *line, pyfov_profile_rule *rule) {
+  char *fields[4], *end;
+  int n = 0, i;
+  unsigned long radius;
+  double density;
+
+  if ((end = strchr(line, '#')) != NULL)
+    *end = '\0';
+  for (fields[n] = strtok(line, " \t\r\n"); fields[n] != NULL;
+       fields[n] = strtok(NULL, " \t\r\n"))
+    if (++n == 4)
+      break;
+  if (n == 0)
+    return 0;
+  if (n < 4 || strtok(NULL, " \t\r\n") != NULL)
+    return -1;
+
+  for (i = 0; i < PYFOV_KIND_COUNT; ++i)
+    if (strcmp(fields[0], kind_names[i]) == 0)
+      break;
+  if (i == PYFOV_KIND_COUNT)
+    return -1;
+  rule->kind = (pyfov_map_kind)i;
+
+  if (strcmp(fields[1], "*") == 0) {
+    rule->radius = UINT_MAX;
+  } else {
+    radius = strtoul(fields[1], &end, 10);
+    if (*end != '\0' || radius >= UINT_MAX)
+      return -1;
+    rule->radius = (unsigned)radius;
+  }
+
+  if (strcmp(fields[2], "*") == 0) {
+    rule->density = 1.0f;
+  } else {
+    density = strtod(fields[2], &end);
+    // Densities are fractions of walls, so nan and inf can't be one
+    if (*end != '\0' || !(density >= 0.0 && density <= 1.0))
+      return -1;
+    rule->density = (float)density;
+  }
+
+  for (i = 0; engine_names[i].name != NULL; ++i)
+    if (strcmp(fields[3], engine_names[i].name) == 0)
+      break;
+  if (engine_names[i].name == NULL)
+    return -1;
+  rule->engine = engine_names[i].engine;
+  return 1;
+}
+
+int
+pyfov_profile_load(const char *path) {
+  pyfov_profile_rule loaded[PYFOV_PROFILE_MAX_RULES];
+  char line[256];
+  int n = 0, lineno = 0, result;
+  size_t len;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    ++lineno;
+    len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n' &&
+        getc(f) != EOF) {
+      // fgets split a line too long to hold a rule
+      result = -1;
+    } else if (n == PYFOV_PROFILE_MAX_RULES) {
+      result = -1;
+    } else {
+      result = parse_rule(line, &loaded[n]);
+      if (result > 0)
+        ++n;
+    }
+    if (result < 0) {
+      fclose(f);
+      PyErr_Format(PyExc_ValueError, "%s:%d: bad profile rule", path,
+                   lineno);
+      return -1;
+    }
+  }
+  fclose(f);
+
+  memcpy(rules, loaded, n * sizeof(pyfov_profile_rule));
+  nrules = n;
+  return 0;
+}
+
+int
+pyfov_profile_rules(void) {
+  return nrules;
+}
+
+PyObject *
+pyfov_profile_text(void) {
+  PyObject *text, *line;
+  char radius[16], density[16];
+  int i;
+
+  text = PyString_FromString("# kind radius density engine\n");
+  for (i = 0; i < nrules && text != NULL; ++i) {
+    if (rules[i].radius == UINT_MAX)
+      strcpy(radius, "*");
+    else
+      PyOS_snprintf(radius, sizeof(radius), "%u", rules[i].radius);
+    if (rules[i].density >= 1.0f)
+      strcpy(density, "*");
+    else
+      PyOS_snprintf(density, sizeof(density), "%.3g",
+                    (double)rules[i].density);
+
+    line = PyString_FromFormat("%s %s %s %s\n", kind_names[rules[i].kind],
+                               radius, density,
+                               engine_name(rules[i].engine));
+    if (line == NULL) {
+      Py_CLEAR(text);
+      break;
+    }
+    PyString_ConcatAndDel(&text, line);
+  }
+  return text;
+}
+
+
+/**
+ * Autotuning
+ *
+ * Each candidate engine sweeps generated maps at a few radii and wall
+ * densities, with a lighting callback that does no work.  The maps are
+ * probed the way each kind of map is, natively or through python, so
+ * every kind gets rules of its own for the fastest engine at each radius
+ * and density; maps small enough for bitboards get rules too.  Only
+ * engines that light what libfov does are candidates, so tuning changes
+ * how fast ENGINE_AUTO is but never what it lights.
+ */
+#define TUNE_SIDE 160
+#define TUNE_SOURCE (TUNE_SIDE / 2)
+
+static const unsigned tune_radii[] = {4, 8, 16, 32, 64};
+static const float tune_densities[] = {0.0f, 0.1f, 0.25f, 0.5f};
+
+#define TUNE_RADII (sizeof(tune_radii) / sizeof(tune_radii[0]))
+#define TUNE_DENSITIES (sizeof(tune_densities) / sizeof(tune_densities[0]))
+
+/* The first radii, which fit on a bitboard around a source at (32, 32) */
+#define TUNE_BITBOARD_RADII 4
+
+/* The kinds of map timed, each probed like the real thing */
+static const pyfov_map_kind tune_kinds[] = {
+  PYFOV_KIND_MAP, PYFOV_KIND_DICT, PYFOV_KIND_LOOKUP, PYFOV_KIND_CALLBACK,
+};
+
+#define TUNE_KINDS (sizeof(tune_kinds) / sizeof(tune_kinds[0]))
+
+/**
+ * The generated map in every form the kinds are probed through
+ */
+typedef struct {
+  unsigned char *grid;
+  pyfov_Map map;
+  PyObject *dict;
+  /* TUNE_SIDE lists of TUNE_SIDE ints, and a python opacity callback */
+  PyObject *rows;
+  PyObject *callback;
+} tune_maps;
+
+static bool
+tune_in_grid(int x, int y) {
+  return x >= 0 && y >= 0 && x < TUNE_SIDE && y < TUNE_SIDE;
+}
+
+static bool
+tune_map_opaque(void *map, int x, int y) {
+  return pyfov_map_opaque(&((tune_maps *)map)->map, x, y);
+}
+
+static bool
+tune_dict_opaque(void *map, int x, int y) {
+  return pyfov_dictmap_opaque((pyfov_DictMap *)((tune_maps *)map)->dict,
+                              x, y) != 0;
+}
+
+static bool
+tune_lookup_opaque(void *map, int x, int y) {
+  PyObject *rows = ((tune_maps *)map)->rows, *row, *cell;
+  int result;
+
+  if (!tune_in_grid(x, y))
+    return true;
+  if ((row = PySequence_GetItem(rows, y)) == NULL)
+    return true;
+  cell = PySequence_GetItem(row, x);
+  Py_DECREF(row);
+  if (cell == NULL)
+    return true;
+  result = PyObject_IsTrue(cell);
+  Py_DECREF(cell);
+  return result != 0;
+}
+
+static bool
+tune_callback_opaque(void *map, int x, int y) {
+  tune_maps *maps = (tune_maps *)map;
+  PyObject *args, *result;
+  int opaque;
+
+  if (!tune_in_grid(x, y))
+    return true;
+  if ((args = Py_BuildValue("(Oii)", maps->rows, x, y)) == NULL)
+    return true;
+  result = PyObject_CallObject(maps->callback, args);
+  Py_DECREF(args);
+  if (result == NULL)
+    return true;
+  opaque = PyObject_IsTrue(result);
+  Py_DECREF(result);
+  return opaque != 0;
+}
+
+static void
+tune_apply(void *map, int x, int y, int dx, int dy, void *src) {
+}
+
+/**
+ * Fills the grid with walls at `density`, from a fixed seed so every run
+ * times the same maps, and rebuilds the python forms of it.  Returns 0,
+ * or -1 with an exception set.
+ */
+static int
+tune_fill(tune_maps *maps, float density) {
+  unsigned long seed = 12345;
+  PyObject *row, *key, *terrain;
+  int i, x, y;
+
+  for (i = 0; i < TUNE_SIDE * TUNE_SIDE; ++i) {
+    seed = (seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+    maps->grid[i] = (seed >> 8) % 1000 < (unsigned long)(density * 1000.0f);
+  }
+  maps->grid[TUNE_SOURCE * TUNE_SIDE + TUNE_SOURCE] = 0;
+
+  Py_CLEAR(maps->dict);
+  Py_CLEAR(maps->rows);
+  if ((terrain = PyDict_New()) == NULL ||
+      (maps->rows = PyList_New(TUNE_SIDE)) == NULL)
+    goto fail;
+  for (y = 0; y < TUNE_SIDE; ++y) {
+    if ((row = PyList_New(TUNE_SIDE)) == NULL)
+      goto fail;
+    PyList_SET_ITEM(maps->rows, y, row);
+    for (x = 0; x < TUNE_SIDE; ++x) {
+      PyList_SET_ITEM(row, x, PyInt_FromLong(maps->grid[y * TUNE_SIDE + x]));
+      if (PyList_GET_ITEM(row, x) == NULL)
+        goto fail;
+      if ((key = Py_BuildValue("(ii)", x, y)) == NULL)
+        goto fail;
+      if (PyDict_SetItem(terrain, key, PyList_GET_ITEM(row, x)) < 0) {
+        Py_DECREF(key);
+        goto fail;
+      }
+      Py_DECREF(key);
+    }
+  }
+  maps->dict = PyObject_CallFunction((PyObject *)&pyfov_DictMapType, "O",
+                                     terrain);
+  Py_DECREF(terrain);
+  return maps->dict != NULL ? 0 : -1;
+
+fail:
+  Py_XDECREF(terrain);
+  return -1;
+}
+
+/**
+ * The 64x64 window of `grid` around the source, as a bitboard with the
+ * source at (32, 32).
+ */
+static void
+tune_board(const unsigned char *grid, pyfov_bitboard *board) {
+  int x, y, offset = TUNE_SOURCE - 32;
+
+  for (y = 0; y < 64; ++y) {
+    board->rows[y] = 0;
+    for (x = 0; x < 64; ++x)
+      if (grid[(y + offset) * TUNE_SIDE + x + offset])
+        board->rows[y] |= (uint64_t)1 << x;
+  }
+  pyfov_bitboard_fill(board);
+}
+
+/**
+ * Appends the rules for the first `radii` rows of the winners in `best`
+ * (or bitboard where `bitboard` is set) to `tuned`.  Densities are split
+ * halfway between the ones timed, runs of one engine along a row become a
+ * single rule, and rows that match the next one are left to it.  The last
+ * row of a kind other than bitboard covers every radius beyond it.
+ */
+static void
+tune_emit(pyfov_profile_rule *tuned, int *n, pyfov_map_kind kind,
+          bool bitboard[][TUNE_DENSITIES],
+          pyfov_engine_type best[][TUNE_DENSITIES], size_t radii) {
+  pyfov_engine_type row[TUNE_RADII][TUNE_DENSITIES];
+  size_t r, d;
+
+  for (r = 0; r < radii; ++r)
+    for (d = 0; d < TUNE_DENSITIES; ++d)
+      row[r][d] = bitboard != NULL && bitboard[r][d] ?
+        PYFOV_ENGINE_BITBOARD : best[r][d];
+
+  for (r = 0; r < radii; ++r) {
+    if (r + 1 < radii &&
+        memcmp(row[r], row[r + 1], sizeof(row[r])) == 0)
+      continue;
+    for (d = 0; d < TUNE_DENSITIES; ++d) {
+      if (d + 1 < TUNE_DENSITIES && row[r][d] == row[r][d + 1])
+        continue;
+      tuned[*n].kind = kind;
+      tuned[*n].radius = r + 1 < radii || kind == PYFOV_KIND_BITBOARD ?
+        tune_radii[r] : UINT_MAX;
+      tuned[*n].density = d + 1 < TUNE_DENSITIES ?
+        (tune_densities[d] + tune_densities[d + 1]) / 2 : 1.0f;
+      tuned[*n].engine = row[r][d];
+      ++*n;
+    }
+  }
+}
+
+/**
+ * Best time of `repeat` runs of `sweeps` circles, in seconds
+ */
+static double
+tune_time(pyfov_engine_type engine, fov_settings_type *settings,
+          tune_maps *maps, const pyfov_bitboard *board,
+          unsigned radius, int sweeps, int repeat) {
+  uint64_t lit[64];
+  double best = -1.0, elapsed;
+  clock_t start;
+  int i, j;
+
+  for (i = 0; i < repeat; ++i) {
+    start = clock();
+    for (j = 0; j < sweeps; ++j) {
+      if (engine == PYFOV_ENGINE_BITBOARD)
+        pyfov_bitboard_circle(settings, board, 32, 32, radius, lit);
+      else
+        pyfov_engine_circle(engine, settings, maps, NULL, TUNE_SOURCE,
+                            TUNE_SOURCE, radius, NULL);
+    }
+    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (best < 0.0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+int
+pyfov_profile_autotune(int repeat) {
+  static const pyfov_engine_type candidates[] = {
+    PYFOV_ENGINE_LIBFOV,
+    PYFOV_ENGINE_RECURSIVE_SHADOWCAST,
+    PYFOV_ENGINE_TABLE,
+  };
+  static bool (*const probes[])(void *, int, int) = {
+    tune_map_opaque, tune_dict_opaque, tune_lookup_opaque,
+    tune_callback_opaque,
+  };
+  pyfov_profile_rule tuned[(TUNE_KINDS + 1) * TUNE_RADII * TUNE_DENSITIES];
+  pyfov_engine_type best[TUNE_KINDS][TUNE_RADII][TUNE_DENSITIES];
+  bool bitboard[TUNE_RADII][TUNE_DENSITIES];
+  fov_settings_type settings;
+  tune_maps maps;
+  pyfov_bitboard board;
+  PyObject *globals = NULL;
+  double fastest, elapsed;
+  size_t k, r, d, c;
+  int n = 0, sweeps, result = -1;
+  bool won = false;
+
+  fov_settings_init(&settings);
+  fov_settings_set_apply_lighting_function(&settings, tune_apply);
+  memset(&maps, 0, sizeof(maps));
+  maps.map.width = maps.map.height = TUNE_SIDE;
+  maps.map.stride = TUNE_SIDE;
+  maps.map.lut[1] = 1;
+  if ((maps.grid = malloc(TUNE_SIDE * TUNE_SIDE)) == NULL) {
+    PyErr_NoMemory();
+    goto done;
+  }
+  maps.map.cells = maps.grid;
+  if ((globals = PyDict_New()) == NULL ||
+      PyDict_SetItemString(globals, "__builtins__",
+                           PyEval_GetBuiltins()) < 0 ||
+      (maps.callback = PyRun_String("lambda m, x, y: m[y][x]",
+                                    Py_eval_input, globals,
+                                    globals)) == NULL)
+    goto done;
+
+  for (d = 0; d < TUNE_DENSITIES; ++d) {
+    if (tune_fill(&maps, tune_densities[d]) < 0)
+      goto done;
+    tune_board(maps.grid, &board);
+    for (k = 0; k < TUNE_KINDS; ++k) {
+      settings.opaque = probes[k];
+      for (r = 0; r < TUNE_RADII; ++r) {
+        // Enough sweeps to outlast the clock's resolution; maps probed
+        // through python are slow enough with fewer
+        sweeps = 1 + (tune_kinds[k] == PYFOV_KIND_MAP ? 40000 : 4000) /
+          (int)(tune_radii[r] * tune_radii[r]);
+        fastest = -1.0;
+        for (c = 0; c < sizeof(candidates) / sizeof(candidates[0]); ++c) {
+          elapsed = tune_time(candidates[c], &settings, &maps, &board,
+                              tune_radii[r], sweeps, repeat);
+          if (fastest < 0.0 || elapsed < fastest) {
+            fastest = elapsed;
+            best[k][r][d] = candidates[c];
+          }
+        }
+        if (tune_kinds[k] == PYFOV_KIND_MAP)
+          bitboard[r][d] = r < TUNE_BITBOARD_RADII &&
+            tune_time(PYFOV_ENGINE_BITBOARD, &settings, &maps, &board,
+                      tune_radii[r], sweeps, repeat) < fastest;
+      }
+      if (PyErr_Occurred())
+        goto done;
+    }
+  }
+
+  // Bitboard rules go first, since they match a subset of fov.Map calls,
+  // and are only needed if bitboards ever won
+  for (r = 0; r < TUNE_BITBOARD_RADII; ++r)
+    for (d = 0; d < TUNE_DENSITIES; ++d)
+      won = won || bitboard[r][d];
+  if (won)
+    tune_emit(tuned, &n, PYFOV_KIND_BITBOARD, bitboard, best[0],
+              TUNE_BITBOARD_RADII);
+  for (k = 0; k < TUNE_KINDS; ++k)
+    tune_emit(tuned, &n, tune_kinds[k], NULL, best[k], TUNE_RADII);
+
+  memcpy(rules, tuned, n * sizeof(pyfov_profile_rule));
+  nrules = n;
+  result = 0;
+
+done:
+  fov_settings_free(&settings);
+  free(maps.grid);
+  Py_XDECREF(maps.dict);
+  Py_XDECREF(maps.rows);
+  Py_XDECREF(maps.callback);
+  Py_XDECREF(globals);
+  return result;
+}
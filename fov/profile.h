@@ -0,0 +1,77 @@
+#ifndef PYFOV_PROFILE_H
+#define PYFOV_PROFILE_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include "engines.h"
+
+/**
+ * Kinds of map an engine profile tells apart
+ */
+typedef enum {
+  /* Any map */
+  PYFOV_KIND_ANY,
+  /* fov.Map */
+  PYFOV_KIND_MAP,
+  /**
+   * Circles on square fov.Maps of at most 64x64 cells that don't light
+   * anything off the map, which can be swept on the map's bitboards
+   */
+  PYFOV_KIND_BITBOARD,
+  /* fov.DictMap */
+  PYFOV_KIND_DICT,
+  /* Maps read through Settings.lookup */
+  PYFOV_KIND_LOOKUP,
+  /* Maps read through opacity_test_function */
+  PYFOV_KIND_CALLBACK,
+
+  PYFOV_KIND_COUNT
+} pyfov_map_kind;
+
+/**
+ * One line of an engine profile.  ENGINE_AUTO runs the engine of the first
+ * rule whose kind matches the map and whose radius and density are at
+ * least the call's.
+ */
+typedef struct {
+  pyfov_map_kind kind;
+  /* Largest radius matched, or UINT_MAX for any */
+  unsigned radius;
+  /* Largest fraction of opaque samples matched; 1 or more for any */
+  float density;
+  pyfov_engine_type engine;
+} pyfov_profile_rule;
+
+/**
+ * Picks the engine ENGINE_AUTO runs.  `density` is the sampled fraction of
+ * opaque cells around the source, or negative if the map wasn't sampled,
+ * which matches any rule.  `bitboard` says whether the sweep could run on
+ * the map's bitboards; if so it matches bitboard rules as well as rules
+ * for `kind`, and otherwise rules naming the bitboard engine are skipped.
+ */
+pyfov_engine_type pyfov_profile_choose(pyfov_map_kind kind, unsigned radius,
+                                       float density, bool bitboard);
+
+/**
+ * Replaces the active rules with the profile file at `path`.  Returns 0,
+ * or -1 with an exception set.
+ */
+int pyfov_profile_load(const char *path);
+
+/**
+ * Times the candidate engines on generated maps and replaces the active
+ * rules with the winners.  Returns 0, or -1 with an exception set.
+ */
+int pyfov_profile_autotune(int repeat);
+
+/**
+ * The active rules in profile file syntax
+ */
+PyObject *pyfov_profile_text(void);
+
+/**
+ * How many rules are active
+ */
+int pyfov_profile_rules(void);
+
+#endif
@@ -0,0 +1,164 @@
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slowlog.h"
+
+/**
+ * Slow-query log
+ *
+ * A ring of the last calls that took at least the threshold, kept as
+ * plain structs and only turned into dicts when read, so logging a call
+ * allocates no python objects unless a hook is set.
+ */
+#define PYFOV_SLOWLOG_DEFAULT_CAPACITY 64
+
+uint64_t pyfov_slowlog_threshold = 0;
+
+static pyfov_slow_call *slow_ring = NULL;
+static int slow_capacity = 0;
+/* Calls logged since the log was last cleared; the ring holds the last */
+static unsigned long slow_count = 0;
+static PyObject *slow_hook = NULL;
+
+int
+pyfov_slowlog_configure(uint64_t threshold, int capacity, PyObject *hook) {
+  pyfov_slow_call *ring;
+
+  if (capacity < 1) {
+    PyErr_SetString(PyExc_ValueError, "capacity must be positive");
+    return -1;
+  }
+  if (hook != Py_None && !PyCallable_Check(hook)) {
+    PyErr_SetString(PyExc_TypeError, "hook must be callable or None");
+    return -1;
+  }
+  if ((ring = calloc(capacity, sizeof(*ring))) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  free(slow_ring);
+  slow_ring = ring;
+  slow_capacity = capacity;
+  slow_count = 0;
+  pyfov_slowlog_threshold = threshold;
+  Py_XDECREF(slow_hook);
+  slow_hook = NULL;
+  if (hook != Py_None) {
+    Py_INCREF(hook);
+    slow_hook = hook;
+  }
+  return 0;
+}
+
+/**
+ * Adds `value` (a new reference, or NULL) to `dict` under `key`
+ */
+static int
+slow_set(PyObject *dict, const char *key, PyObject *value) {
+  int result;
+
+  if (value == NULL)
+    return -1;
+  result = PyDict_SetItemString(dict, key, value);
+  Py_DECREF(value);
+  return result;
+}
+
+static PyObject *
+slow_call_dict(const pyfov_slow_call *call) {
+  PyObject *dict = PyDict_New();
+
+  if (dict == NULL)
+    return NULL;
+
+  if (call->beam) {
+    if (slow_set(dict, "direction", PyInt_FromLong(call->direction)) < 0 ||
+        slow_set(dict, "angle", PyFloat_FromDouble(call->angle)) < 0)
+      goto fail;
+  } else if (PyDict_SetItemString(dict, "direction", Py_None) < 0 ||
+             PyDict_SetItemString(dict, "angle", Py_None) < 0) {
+    goto fail;
+  }
+
+  if (slow_set(dict, "call",
+               PyString_FromString(call->beam ? "beam" :
+                                   call->batch ? "circle_batch" :
+                                   "circle")) < 0 ||
+      slow_set(dict, "source_x", PyInt_FromLong(call->source_x)) < 0 ||
+      slow_set(dict, "source_y", PyInt_FromLong(call->source_y)) < 0 ||
+      slow_set(dict, "radius", PyInt_FromSize_t(call->radius)) < 0 ||
+      slow_set(dict, "engine", PyInt_FromLong(call->engine)) < 0 ||
+      slow_set(dict, "map_id",
+               PyLong_FromUnsignedLongLong(call->map_id)) < 0 ||
+      slow_set(dict, "map_type", PyString_FromString(call->map_type)) < 0 ||
+      slow_set(dict, "probes", PyInt_FromSize_t(call->probes)) < 0 ||
+      slow_set(dict, "lit", PyInt_FromSize_t(call->lit)) < 0 ||
+      slow_set(dict, "seconds", PyFloat_FromDouble(call->ns / 1e9)) < 0 ||
+      slow_set(dict, "python_seconds",
+               PyFloat_FromDouble(call->python_ns / 1e9)) < 0)
+    goto fail;
+  return dict;
+
+fail:
+  Py_DECREF(dict);
+  return NULL;
+}
+
+int
+pyfov_slowlog_record(const pyfov_slow_call *call) {
+  PyObject *entry, *hook, *result;
+
+  if (slow_ring == NULL &&
+      pyfov_slowlog_configure(pyfov_slowlog_threshold,
+                              PYFOV_SLOWLOG_DEFAULT_CAPACITY, Py_None) < 0)
+    return -1;
+  slow_ring[slow_count++ % slow_capacity] = *call;
+
+  if (slow_hook == NULL)
+    return 0;
+  if ((entry = slow_call_dict(call)) == NULL)
+    return -1;
+  // The hook may set another one (or none) while it runs
+  hook = slow_hook;
+  Py_INCREF(hook);
+  result = PyObject_CallFunctionObjArgs(hook, entry, NULL);
+  Py_DECREF(hook);
+  Py_DECREF(entry);
+  if (result == NULL)
+    return -1;
+  Py_DECREF(result);
+  return 0;
+}
+
+void
+pyfov_slowlog_stats(unsigned *entries, unsigned *capacity, size_t *bytes) {
+  *capacity = slow_ring != NULL ? (unsigned)slow_capacity :
+    PYFOV_SLOWLOG_DEFAULT_CAPACITY;
+  *entries = slow_count < *capacity ? (unsigned)slow_count : *capacity;
+  *bytes = slow_ring != NULL ? slow_capacity * sizeof(pyfov_slow_call) : 0;
+}
+
+PyObject *
+pyfov_slowlog_entries(bool clear) {
+  PyObject *list = PyList_New(0), *entry;
+  unsigned long i, first;
+
+  if (list == NULL)
+    return NULL;
+
+  first = slow_count > (unsigned long)slow_capacity ?
+    slow_count - slow_capacity : 0;
+  for (i = first; i < slow_count; ++i) {
+    if ((entry = slow_call_dict(&slow_ring[i % slow_capacity])) == NULL ||
+        PyList_Append(list, entry) < 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(list);
+      return NULL;
+    }
+    Py_DECREF(entry);
+  }
+  if (clear)
+    slow_count = 0;
+  return list;
+}
@@ -0,0 +1,67 @@
+#ifndef PYFOV_SLOWLOG_H
+#define PYFOV_SLOWLOG_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "engines.h"
+
+/**
+ * A circle or beam call, or a circle of a batch, that took at least the
+ * slow log's threshold
+ */
+typedef struct {
+  bool beam;
+  bool batch;
+  int source_x, source_y;
+  unsigned radius;
+  /* Only set for beams */
+  int direction;
+  float angle;
+  pyfov_engine_type engine;
+  /* The map's id() and type name; the map itself isn't kept alive */
+  uintptr_t map_id;
+  char map_type[48];
+  /* Opacity tests and lit cells the sweep made */
+  unsigned long probes;
+  unsigned long lit;
+  /* Wall time of the call (or of the batch's sweep), and the part of it
+   * spent in python */
+  uint64_t ns;
+  uint64_t python_ns;
+} pyfov_slow_call;
+
+/**
+ * Calls taking at least this many nanoseconds are logged; 0 turns the log
+ * off.  Sweeps only time themselves while it's on.
+ */
+extern uint64_t pyfov_slowlog_threshold;
+
+/**
+ * Sets the threshold, resizes the log to hold the last `capacity` calls
+ * (dropping what it held) and sets the hook, a callable or Py_None, that
+ * each logged call is passed to as a dict.  Returns 0, or -1 with an
+ * exception set.
+ */
+int pyfov_slowlog_configure(uint64_t threshold, int capacity,
+                            PyObject *hook);
+
+/**
+ * Logs a call and passes it to the hook.  Returns 0, or -1 with the hook's
+ * exception set.
+ */
+int pyfov_slowlog_record(const pyfov_slow_call *call);
+
+/**
+ * The logged calls as a list of dicts, oldest first.  With `clear` the
+ * log is emptied.
+ */
+PyObject *pyfov_slowlog_entries(bool clear);
+
+/**
+ * Calls the log holds, out of its capacity, and the bytes its ring takes
+ */
+void pyfov_slowlog_stats(unsigned *entries, unsigned *capacity,
+                         size_t *bytes);
+
+#endif
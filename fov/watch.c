@@ -0,0 +1,265 @@
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "watch.h"
+
+/**
+ * fov.WatchSet
+ *
+ * Example Usage:
+ *
+ * traps = fov.WatchSet([(3, 4), (10, 2)])
+ * fired = s.circle(m, None, 5, 5, 8, watch=traps).watched
+ */
+
+PyTypeObject pyfov_WatchSetType = {
+  PyObject_HEAD_INIT(NULL)
+};
+
+/**
+ * Cell sets
+ *
+ * Linear probing kept at most half full, with deletions shifting later
+ * slots of the run back so no tombstones are needed.
+ */
+static size_t
+cellset_hash(int x, int y) {
+  uint32_t h = (uint32_t)x * 0x9e3779b1u ^ (uint32_t)y * 0x85ebca77u;
+
+  h ^= h >> 15;
+  h *= 0xc2b2ae3du;
+  h ^= h >> 13;
+  return h;
+}
+
+/**
+ * The slot holding (x, y), or the empty slot it would go in
+ */
+static pyfov_cellset_slot *
+cellset_slot(const pyfov_cellset *set, int x, int y) {
+  size_t mask = set->size - 1, i = cellset_hash(x, y) & mask;
+
+  while (set->slots[i].used &&
+         (set->slots[i].x != x || set->slots[i].y != y))
+    i = (i + 1) & mask;
+  return &set->slots[i];
+}
+
+static int
+cellset_grow(pyfov_cellset *set) {
+  pyfov_cellset old = *set;
+  pyfov_cellset_slot *slot;
+  size_t i;
+
+  set->size = old.size == 0 ? 16 : old.size * 2;
+  if ((set->slots = calloc(set->size, sizeof(pyfov_cellset_slot))) == NULL) {
+    *set = old;
+    return -1;
+  }
+  for (i = 0; i < old.size; ++i) {
+    if (!old.slots[i].used)
+      continue;
+    slot = cellset_slot(set, old.slots[i].x, old.slots[i].y);
+    *slot = old.slots[i];
+  }
+  free(old.slots);
+  return 0;
+}
+
+int
+pyfov_cellset_add(pyfov_cellset *set, int x, int y) {
+  pyfov_cellset_slot *slot;
+
+  if (2 * (set->count + 1) > set->size && cellset_grow(set) < 0)
+    return -1;
+  slot = cellset_slot(set, x, y);
+  if (slot->used)
+    return 0;
+  slot->x = x;
+  slot->y = y;
+  slot->used = true;
+  ++set->count;
+  return 1;
+}
+
+bool
+pyfov_cellset_contains(const pyfov_cellset *set, int x, int y) {
+  return set->count > 0 && cellset_slot(set, x, y)->used;
+}
+
+bool
+pyfov_cellset_remove(pyfov_cellset *set, int x, int y) {
+  size_t mask = set->size - 1, i, j, home;
+
+  if (set->count == 0)
+    return false;
+  i = cellset_slot(set, x, y) - set->slots;
+  if (!set->slots[i].used)
+    return false;
+
+  // Move back any later slot of the run that could live in the hole
+  for (j = (i + 1) & mask; set->slots[j].used; j = (j + 1) & mask) {
+    home = cellset_hash(set->slots[j].x, set->slots[j].y) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      set->slots[i] = set->slots[j];
+      i = j;
+    }
+  }
+  set->slots[i].used = false;
+  --set->count;
+  return true;
+}
+
+void
+pyfov_cellset_clear(pyfov_cellset *set) {
+  free(set->slots);
+  set->slots = NULL;
+  set->size = 0;
+  set->count = 0;
+}
+
+int
+pyfov_cellset_update(pyfov_cellset *set, PyObject *cells) {
+  PyObject *iter, *cell;
+  int x, y, result = 0;
+
+  if ((iter = PyObject_GetIter(cells)) == NULL)
+    return -1;
+  while (result == 0 && (cell = PyIter_Next(iter)) != NULL) {
+    if (!PyArg_ParseTuple(cell, "ii;cells must be (x, y) pairs", &x, &y))
+      result = -1;
+    else if (pyfov_cellset_add(set, x, y) < 0) {
+      PyErr_NoMemory();
+      result = -1;
+    }
+    Py_DECREF(cell);
+  }
+  Py_DECREF(iter);
+  return result == 0 && PyErr_Occurred() ? -1 : result;
+}
+
+static int
+pyfov_WatchSet_init(pyfov_WatchSet *self, PyObject *args, PyObject *kwargs) {
+  static char *kwlist[] = {"cells", NULL};
+  PyObject *cells = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &cells))
+    return -1;
+  pyfov_cellset_clear(&self->cells);
+  if (cells != NULL && pyfov_cellset_update(&self->cells, cells) < 0)
+    return -1;
+  return 0;
+}
+
+static void
+pyfov_WatchSet_dealloc(pyfov_WatchSet *self) {
+  pyfov_cellset_clear(&self->cells);
+  self->ob_type->tp_free(self);
+}
+
+static PyObject *
+pyfov_WatchSet_add(pyfov_WatchSet *self, PyObject *args) {
+  int x, y;
+
+  if (!PyArg_ParseTuple(args, "ii", &x, &y))
+    return NULL;
+  if (pyfov_cellset_add(&self->cells, x, y) < 0)
+    return PyErr_NoMemory();
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pyfov_WatchSet_discard(pyfov_WatchSet *self, PyObject *args) {
+  int x, y;
+
+  if (!PyArg_ParseTuple(args, "ii", &x, &y))
+    return NULL;
+  pyfov_cellset_remove(&self->cells, x, y);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pyfov_WatchSet_clear(pyfov_WatchSet *self) {
+  pyfov_cellset_clear(&self->cells);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static Py_ssize_t
+pyfov_WatchSet_len(pyfov_WatchSet *self) {
+  return (Py_ssize_t)self->cells.count;
+}
+
+static int
+pyfov_WatchSet_contains(pyfov_WatchSet *self, PyObject *cell) {
+  int x, y;
+
+  if (!PyTuple_Check(cell) || PyTuple_GET_SIZE(cell) != 2)
+    return 0;
+  x = (int)PyInt_AsLong(PyTuple_GET_ITEM(cell, 0));
+  y = (int)PyInt_AsLong(PyTuple_GET_ITEM(cell, 1));
+  if (PyErr_Occurred()) {
+    PyErr_Clear();
+    return 0;
+  }
+  return pyfov_cellset_contains(&self->cells, x, y);
+}
+
+/**
+ * Iterates over a list of the cells, so the set can change meanwhile
+ */
+static PyObject *
+pyfov_WatchSet_iter(pyfov_WatchSet *self) {
+  PyObject *cells = PyList_New(0), *cell, *iter;
+  size_t i;
+
+  if (cells == NULL)
+    return NULL;
+  for (i = 0; i < self->cells.size; ++i) {
+    if (!self->cells.slots[i].used)
+      continue;
+    cell = Py_BuildValue("(ii)", self->cells.slots[i].x,
+                         self->cells.slots[i].y);
+    if (cell == NULL || PyList_Append(cells, cell) < 0) {
+      Py_XDECREF(cell);
+      Py_DECREF(cells);
+      return NULL;
+    }
+    Py_DECREF(cell);
+  }
+  iter = PyObject_GetIter(cells);
+  Py_DECREF(cells);
+  return iter;
+}
+
+static PyMethodDef pyfov_WatchSet_methods[] = {
+  {"add", (PyCFunction)pyfov_WatchSet_add, METH_VARARGS, NULL},
+  {"discard", (PyCFunction)pyfov_WatchSet_discard, METH_VARARGS, NULL},
+  {"clear", (PyCFunction)pyfov_WatchSet_clear, METH_NOARGS, NULL},
+  {NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+static PySequenceMethods pyfov_WatchSet_sequence = {
+  (lenfunc)pyfov_WatchSet_len,
+  0, 0, 0, 0, 0, 0,
+  (objobjproc)pyfov_WatchSet_contains,
+};
+
+void
+init_fov_watchset_type(PyTypeObject *t) {
+  t->tp_name = "fov.WatchSet";
+  t->tp_basicsize = sizeof(pyfov_WatchSet);
+  t->tp_flags = Py_TPFLAGS_DEFAULT;
+  t->tp_doc = "A native set of (x, y) cells for circle and beam to watch";
+
+  t->tp_init = (initproc)pyfov_WatchSet_init;
+  t->tp_dealloc = (destructor)pyfov_WatchSet_dealloc;
+
+  // Use a generic new method (inits members to 0/NULL)
+  t->tp_new = PyType_GenericNew;
+  t->tp_methods = pyfov_WatchSet_methods;
+  t->tp_as_sequence = &pyfov_WatchSet_sequence;
+  t->tp_iter = (getiterfunc)pyfov_WatchSet_iter;
+}
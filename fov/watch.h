@@ -0,0 +1,62 @@
+#ifndef PYFOV_WATCH_H
+#define PYFOV_WATCH_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * An open-addressed hash set of (x, y) cells
+ */
+typedef struct {
+  int x, y;
+  bool used;
+} pyfov_cellset_slot;
+
+typedef struct {
+  pyfov_cellset_slot *slots;
+  /* A power of two, or 0 before the first add */
+  size_t size;
+  size_t count;
+} pyfov_cellset;
+
+/**
+ * Adds (x, y).  Returns 1 if it was added, 0 if it was already there, or
+ * -1 if the set couldn't grow.
+ */
+int pyfov_cellset_add(pyfov_cellset *set, int x, int y);
+
+bool pyfov_cellset_contains(const pyfov_cellset *set, int x, int y);
+
+/**
+ * Removes (x, y).  Returns whether it was there.
+ */
+bool pyfov_cellset_remove(pyfov_cellset *set, int x, int y);
+
+/**
+ * Empties the set and frees its slots
+ */
+void pyfov_cellset_clear(pyfov_cellset *set);
+
+/**
+ * Cells watched for by circle and beam.  The set is built once, so each
+ * lit cell is checked against it without making a tuple.
+ */
+typedef struct {
+  PyObject_HEAD
+  pyfov_cellset cells;
+} pyfov_WatchSet;
+
+extern PyTypeObject pyfov_WatchSetType;
+
+#define pyfov_WatchSet_Check(op) PyObject_TypeCheck(op, &pyfov_WatchSetType)
+
+void init_fov_watchset_type(PyTypeObject *t);
+
+/**
+ * Adds the (x, y) cells of the iterable `cells` to `set`.  Returns 0, or
+ * -1 with an exception set.
+ */
+int pyfov_cellset_update(pyfov_cellset *set, PyObject *cells);
+
+#endif
@@ -1,4 +1,61 @@
-from distutils.core import setup, Extension
+import os
+import subprocess
+import sys
+import unittest
+from distutils.core import setup, Extension, Command
+
+# PYFOV_SANITIZE=address,undefined builds the module with those sanitizers,
+# e.g. to run the tests under them
+sanitize = os.environ.get('PYFOV_SANITIZE')
+sanitize_flags = ['-fsanitize=' + sanitize, '-fno-omit-frame-pointer',
+                  '-g'] if sanitize else []
+
+
+class test(Command):
+  """Builds the module and runs the tests under tests/ against it"""
+  description = 'run the tests'
+  user_options = [
+    ('sanitize=', None,
+     'build with these sanitizers (e.g. address,undefined) and run the '
+     'tests under them'),
+  ]
+
+  # Runtimes python has to load before the module, as it isn't built with
+  # them
+  runtimes = {'address': 'libasan.so', 'thread': 'libtsan.so'}
+
+  def initialize_options(self):
+    self.sanitize = None
+
+  def finalize_options(self):
+    pass
+
+  def run(self):
+    if self.sanitize:
+      self.run_sanitized()
+      return
+    self.run_command('build')
+    sys.path.insert(0, self.get_finalized_command('build').build_lib)
+    suite = unittest.TestLoader().discover('tests')
+    if not unittest.TextTestRunner(verbosity=2).run(suite).wasSuccessful():
+      sys.exit(1)
+
+  def run_sanitized(self):
+    """Reruns the build and tests in a child with the sanitizers loaded"""
+    env = dict(os.environ, PYFOV_SANITIZE=self.sanitize,
+               ASAN_OPTIONS=os.environ.get('ASAN_OPTIONS', 'detect_leaks=0'))
+    preload = [subprocess.check_output(
+                 [os.environ.get('CC', 'cc'), '-print-file-name=' + lib])
+               .strip() for name, lib in sorted(self.runtimes.items())
+               if name in self.sanitize.split(',')]
+    if preload:
+      env['LD_PRELOAD'] = ' '.join(preload)
+    # A build tree of its own, so that objects built without the
+    # sanitizers aren't reused
+    sys.exit(subprocess.call(
+      [sys.executable, 'setup.py', 'build',
+       '--build-base=build/sanitize-' + self.sanitize.replace(',', '-'),
+       'test'], env=env))
 
 setup(name='python-libfov',
       version='0.1',
@@ -7,7 +64,14 @@ setup(name='python-libfov',
       author_email='ruibalp@gmail.com',
       url='https://github.com/fmoo/python-libfov',
       ext_modules = [
-        Extension('fov', ['fov/fov.c'],
-                  libraries=['fov'])
+        Extension('fov', ['fov/fov.c', 'fov/engines.c', 'fov/map.c',
+                         'fov/dictmap.c', 'fov/profile.c',
+                         'fov/counters.c', 'fov/slowlog.c',
+                         'fov/metrics.c', 'fov/watch.c', 'fov/batch.c',
+                         'fov/halo.c'],
+                  libraries=['fov', 'pthread'],
+                  extra_compile_args=sanitize_flags,
+                  extra_link_args=sanitize_flags)
       ],
+      cmdclass={'test': test},
      )
@@ -0,0 +1,43 @@
+"""
+Settings.circle_batch's out buffers and threads.
+"""
+import unittest
+
+import fov
+
+
+class BatchOutTest(unittest.TestCase):
+
+    def test_out_is_a_map(self):
+        s = fov.Settings()
+        m = fov.Map(11, 11)
+        self.assertRaises(ValueError, s.circle_batch, [m], [(0, 5, 5, 4)],
+                          out=[m])
+        self.assertRaises(ValueError, s.circle_batch, [m], [(0, 5, 5, 4)],
+                          out=[memoryview(m)[11:22]])
+        # Nothing was cleared or lit
+        self.assertEqual(bytearray(m), bytearray(121))
+
+    def test_out_under_a_map_view(self):
+        s = fov.Settings()
+        text = bytearray('.' * 10 + '\n') * 10
+        m = fov.Map.from_bytes(text, 10, 10, 11)
+        self.assertRaises(ValueError, s.circle_batch, [m], [(0, 5, 5, 4)],
+                          out=[text])
+        self.assertEqual(text, bytearray('.' * 10 + '\n') * 10)
+
+    def test_out_shared(self):
+        s = fov.Settings()
+        m = fov.Map(8, 8)
+        out = bytearray(128)
+        self.assertRaises(ValueError, s.circle_batch, [m],
+                          [(0, 1, 1, 3), (0, 6, 6, 3)],
+                          out=[out, memoryview(out)[32:]])
+        masks = s.circle_batch([m], [(0, 1, 1, 3), (0, 6, 6, 3)],
+                               out=[memoryview(out)[:64],
+                                    memoryview(out)[64:]])
+        self.assertEqual(len(masks), 2)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,50 @@
+"""
+A smoke test of Settings.benchmark.
+"""
+import unittest
+
+import fov
+
+COUNTERS = ['cycles', 'instructions', 'l1d_misses', 'llc_misses',
+            'branch_misses']
+
+
+class BenchmarkTest(unittest.TestCase):
+
+    def setUp(self):
+        self.settings = fov.Settings()
+        self.map = fov.Map(30, 30)
+        self.map[17, 15] = 1
+
+    def test_result(self):
+        lit = set()
+        self.settings.circle(self.map, None, 15, 15, 8, into=lit)
+        result = self.settings.benchmark(self.map, 15, 15, 8, repeat=5)
+        self.assertEqual(sorted(result),
+                         sorted(['engine', 'cells', 'seconds', 'sweeps'] +
+                                COUNTERS))
+        self.assertEqual(result['engine'], fov.ENGINE_LIBFOV)
+        self.assertEqual(result['cells'], len(lit))
+        self.assertEqual(result['sweeps'], 5)
+        self.assertTrue(result['seconds'] >= 0.0)
+
+        # Wherever perf_event_open is denied (most VMs and containers),
+        # counters are None rather than errors
+        for name in COUNTERS:
+            self.assertTrue(result[name] is None or result[name] >= 0,
+                            '%s is %r' % (name, result[name]))
+
+    def test_without_counters(self):
+        result = self.settings.benchmark(self.map, 15, 15, 8, fov.EAST,
+                                         repeat=2, counters=False)
+        for name in COUNTERS:
+            self.assertEqual(result[name], None)
+
+        self.settings.engine = fov.ENGINE_TABLE
+        result = self.settings.benchmark(self.map, 15, 15, 8, repeat=2,
+                                         counters=False)
+        self.assertEqual(result['engine'], fov.ENGINE_TABLE)
+
+
+if __name__ == '__main__':
+    unittest.main()
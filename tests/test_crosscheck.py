@@ -0,0 +1,441 @@
+"""
+Differential checks of the fast paths.
+
+The fast paths (native maps and their layouts, lookups, dict maps, into=,
+bitboards, lazy sweeps, batches and ENGINE_AUTO) must light exactly what
+the plain python callbacks light.  Each case generates a random map,
+source and settings, sweeps it once through opacity_test_function and
+apply_lighting_function, and then through every fast path.  Floods and
+area lights must fill the same lightmap whatever map they read.
+
+PYFOV_CROSSCHECK_CASES and PYFOV_CROSSCHECK_SEED pick how many cases are
+run and from which seed, e.g. to run many more under the sanitizers.
+"""
+import array
+import copy
+import os
+import random
+import unittest
+
+import fov
+
+CASES = int(os.environ.get('PYFOV_CROSSCHECK_CASES', '200'))
+SEED = int(os.environ.get('PYFOV_CROSSCHECK_SEED', '0'))
+
+ENGINES = [fov.ENGINE_LIBFOV, fov.ENGINE_RECURSIVE_SHADOWCAST,
+           fov.ENGINE_SYMMETRIC_SHADOWCAST, fov.ENGINE_PERMISSIVE,
+           fov.ENGINE_DIAMOND_WALLS, fov.ENGINE_TABLE]
+SHAPES = [fov.SHAPE_CIRCLE_PRECALCULATE, fov.SHAPE_SQUARE, fov.SHAPE_CIRCLE,
+          fov.SHAPE_OCTAGON]
+DENSITIES = [0.0, 0.05, 0.2, 0.4, 0.7]
+RADII = [0, 1, 2, 3, 5, 8, 13, 20, 40, 90]
+ANGLES = [0.0, 30.0, 90.0, 135.0, 360.0]
+
+
+def reference_opaque(rows, x, y):
+    return not (0 <= y < len(rows) and 0 <= x < len(rows[y])) or \
+        rows[y][x] != 0
+
+
+def reference_apply(rows, x, y, dx, dy, lit):
+    lit.add((x, y))
+
+
+class Case(object):
+    """
+    A random map, source and settings.  Maps straddle the 64 cell bitboard
+    limit.
+    """
+
+    def __init__(self, rng, index):
+        self.index = index
+        self.width = rng.randint(1, 72)
+        self.height = rng.randint(1, 72)
+        self.source_x = rng.randrange(self.width)
+        self.source_y = rng.randrange(self.height)
+        self.radius = rng.choice(RADII)
+        self.shape = rng.choice(SHAPES)
+        self.corner_peek = rng.randrange(2)
+        self.opaque_apply = rng.randrange(2)
+        self.engine = rng.choice(ENGINES)
+        self.beam = rng.randrange(4) == 0
+        self.direction = rng.randrange(8)
+        self.angle = rng.choice(ANGLES)
+        density = rng.choice(DENSITIES)
+        self.rows = [[int(rng.random() < density) for x in range(self.width)]
+                     for y in range(self.height)]
+
+    def __str__(self):
+        return ('case %d of seed %d: %dx%d map, %s from (%d, %d), radius %d, '
+                'engine %d, shape %d, corner_peek %d, opaque_apply %d' %
+                (self.index, SEED, self.width, self.height,
+                 'beam %d/%g' % (self.direction, self.angle) if self.beam
+                 else 'circle', self.source_x, self.source_y, self.radius,
+                 self.engine, self.shape, self.corner_peek,
+                 self.opaque_apply))
+
+    def settings(self, engine=None):
+        s = fov.Settings()
+        s.shape = self.shape
+        s.corner_peek = self.corner_peek
+        s.opaque_apply = self.opaque_apply
+        s.engine = self.engine if engine is None else engine
+        return s
+
+    def reference(self, engine=None):
+        s = self.settings(engine)
+        s.opacity_test_function = reference_opaque
+        s.apply_lighting_function = reference_apply
+        return s
+
+    def sweep(self, settings, map, source=None, **kwargs):
+        if self.beam:
+            return settings.beam(map, source, self.source_x, self.source_y,
+                                 self.radius, self.direction, self.angle,
+                                 **kwargs)
+        return settings.circle(map, source, self.source_x, self.source_y,
+                               self.radius, **kwargs)
+
+    def lit(self, settings, map):
+        lit = set()
+        self.sweep(settings, map, into=lit)
+        return lit
+
+    def expected(self, engine=None):
+        lit = set()
+        self.sweep(self.reference(engine), self.rows, lit)
+        return lit
+
+    def on_map(self, cells):
+        return set((x, y) for x, y in cells
+                   if 0 <= x < self.width and 0 <= y < self.height)
+
+    def data(self):
+        return bytearray(cell for row in self.rows for cell in row)
+
+    def map(self, layout=fov.MAP_SQUARE):
+        return fov.Map(self.width, self.height, layout, self.data())
+
+
+def mask_cells(mask, width, height):
+    return set((x, y) for y in range(height) for x in range(width)
+               if mask[y * width + x])
+
+
+def bits_cells(bits):
+    return set((x, y) for y in range(64) for x in range(64)
+               if bits[y] >> x & 1)
+
+
+class CrosscheckTest(unittest.TestCase):
+
+    def cases(self, seed_offset=0):
+        rng = random.Random(SEED * 7919 + seed_offset)
+        for i in range(CASES):
+            yield Case(rng, i)
+
+    def check(self, case, path, lit, expected):
+        if lit != expected:
+            self.fail('%s: %s lit %d cells where the callbacks lit %d (%s)' %
+                      (case, path, len(lit), len(expected),
+                       sorted(lit ^ expected)[:8]))
+
+    def test_square_maps(self):
+        for case in self.cases():
+            expected = case.expected()
+            settings = case.settings()
+            text = ''.join(''.join('#' if cell else '.' for cell in row) +
+                           '\n' for row in case.rows)
+            strings = [''.join('#' if cell else '.' for cell in row)
+                       for row in case.rows]
+            terrain = dict(((x, y), case.rows[y][x])
+                           for y in range(case.height)
+                           for x in range(case.width))
+
+            self.check(case, 'fov.Map', case.lit(settings, case.map()),
+                       expected)
+            self.check(case, 'Map.from_bytes',
+                       case.lit(settings, fov.Map.from_bytes(
+                           text, case.width, case.height, case.width + 1)),
+                       expected)
+            self.check(case, 'Map.from_rows',
+                       case.lit(settings, fov.Map.from_rows(strings)),
+                       expected)
+            self.check(case, 'fov.DictMap',
+                       case.lit(settings, fov.DictMap(terrain)), expected)
+
+            settings.lookup = fov.LOOKUP_ROWS
+            self.check(case, 'LOOKUP_ROWS', case.lit(settings, case.rows),
+                       expected)
+            settings.opaque_tiles = '#'
+            self.check(case, 'LOOKUP_ROWS with opaque_tiles',
+                       case.lit(settings, strings), expected)
+            settings.opaque_tiles = None
+            settings.lookup = fov.LOOKUP_ITEM
+            self.check(case, 'LOOKUP_ITEM', case.lit(settings, terrain),
+                       expected)
+
+            settings = case.settings()
+            into = {}
+            case.sweep(settings, case.map(), into=into)
+            self.check(case, 'into= a dict', set(into), expected)
+            settings.apply_lighting_function = reference_apply
+            lit = set()
+            case.sweep(settings, case.map(), lit)
+            self.check(case, 'fov.Map with apply_lighting_function', lit,
+                       expected)
+
+            # Visibility comes from the same shadow intervals whatever the
+            # map
+            if case.engine != fov.ENGINE_PERMISSIVE:
+                want = bytearray(case.width * case.height)
+                got = bytearray(case.width * case.height)
+                case.sweep(case.reference(), case.rows, set(),
+                           visibility=want, width=case.width)
+                case.sweep(settings, case.map(), set(), visibility=got,
+                           width=case.width)
+                self.assertEqual(got, want, '%s: fov.Map visibility' % case)
+
+            if case.beam:
+                continue
+            on_map = case.on_map(expected)
+
+            # Bitboards, lazy sweeps and batches light what the engine
+            # lights on the map
+            if case.engine == fov.ENGINE_LIBFOV:
+                if case.width <= 64 and case.height <= 64:
+                    bits = settings.circle_bits(case.map(), case.source_x,
+                                                case.source_y, case.radius)
+                    self.check(case, 'circle_bits', bits_cells(bits), on_map)
+                self.check(case, 'iter_circle',
+                           set(settings.iter_circle(case.map(), case.source_x,
+                                                    case.source_y,
+                                                    case.radius)),
+                           expected)
+            masks = settings.circle_batch(
+                [case.map()],
+                [(0, case.source_x, case.source_y, case.radius)])
+            self.check(case, 'circle_batch',
+                       mask_cells(masks[0], case.width, case.height), on_map)
+
+    def test_engine_auto(self):
+        for case in self.cases(1):
+            expected = case.expected(fov.ENGINE_LIBFOV)
+            settings = case.settings(fov.ENGINE_AUTO)
+            self.check(case, 'ENGINE_AUTO on fov.Map',
+                       case.lit(settings, case.map()), expected)
+            settings.lookup = fov.LOOKUP_ROWS
+            self.check(case, 'ENGINE_AUTO with LOOKUP_ROWS',
+                       case.lit(settings, case.rows), expected)
+            if not case.beam:
+                settings = case.settings(fov.ENGINE_AUTO)
+                masks = settings.circle_batch(
+                    [case.map()],
+                    [(0, case.source_x, case.source_y, case.radius)])
+                self.check(case, 'ENGINE_AUTO in circle_batch',
+                           mask_cells(masks[0], case.width, case.height),
+                           case.on_map(expected))
+
+    def test_batches(self):
+        # Several sources on each of several maps, swept on more threads
+        # than the other tests use sources
+        cases = list(self.cases(7))
+        for start in range(0, len(cases), 12):
+            group = cases[start:start + 12]
+            lead = group[0]
+            sources, expected = [], []
+            for i, case in enumerate(group):
+                case.shape = lead.shape
+                case.opaque_apply = lead.opaque_apply
+                case.engine = lead.engine
+                case.beam = False
+                mirrored = copy.copy(case)
+                mirrored.source_x = case.width - 1 - case.source_x
+                mirrored.source_y = case.height - 1 - case.source_y
+                for source in [case, mirrored]:
+                    sources.append((i, source.source_x, source.source_y,
+                                    source.radius))
+                    expected.append((source,
+                                     source.on_map(source.expected())))
+            masks = lead.settings().circle_batch(
+                [case.map() for case in group], sources, threads=4)
+            for (case, want), mask in zip(expected, masks):
+                self.check(case, 'threaded circle_batch',
+                           mask_cells(mask, case.width, case.height), want)
+
+    def test_table_engine(self):
+        # The table engine lights what libfov lights, and beams what the
+        # port of libfov's scan lights
+        for case in self.cases(6):
+            engine = fov.ENGINE_RECURSIVE_SHADOWCAST if case.beam \
+                else fov.ENGINE_LIBFOV
+            expected = case.expected(engine)
+            settings = case.settings(fov.ENGINE_TABLE)
+            self.check(case, 'ENGINE_TABLE', case.lit(settings, case.map()),
+                       expected)
+
+        # Batch threads all read the same tables
+        rng = random.Random(SEED * 7919 + 6)
+        settings = fov.Settings()
+        settings.engine = fov.ENGINE_TABLE
+        reference = fov.Settings()
+        maps, sources = [], []
+        for i in range(8):
+            case = Case(rng, i)
+            case.radius = rng.choice(RADII[:-1])
+            maps.append(case.map())
+            sources.append((i, case.source_x, case.source_y, case.radius))
+        masks = settings.circle_batch(maps, sources, threads=4)
+        for (i, x, y, radius), mask in zip(sources, masks):
+            want = set()
+            reference.circle(maps[i], None, x, y, radius, into=want)
+            width, height = maps[i].width, maps[i].height
+            self.assertEqual(mask_cells(mask, width, height),
+                             set((x, y) for x, y in want
+                                 if 0 <= x < width and 0 <= y < height),
+                             'batch source %d' % i)
+
+    def test_isometric_maps(self):
+        # The engines sweep the square grid under the staggered rows, so
+        # the callbacks read it through the same translation
+        def to_storage(x, y):
+            row = x + y
+            return (x - y - (row & 1)) // 2, row
+
+        def from_storage(col, row):
+            return col + (row + (row & 1)) // 2, (row - (row & 1)) // 2 - col
+
+        for case in self.cases(2):
+            def opaque(rows, x, y):
+                return reference_opaque(rows, *to_storage(x, y))
+
+            def apply(rows, x, y, dx, dy, lit):
+                lit.add(to_storage(x, y))
+
+            reference = case.settings()
+            reference.opacity_test_function = opaque
+            reference.apply_lighting_function = apply
+            expected = set()
+            x, y = from_storage(case.source_x, case.source_y)
+            if case.beam:
+                reference.beam(case.rows, expected, x, y, case.radius,
+                               case.direction, case.angle)
+            else:
+                reference.circle(case.rows, expected, x, y, case.radius)
+
+            settings = case.settings()
+            self.check(case, 'isometric fov.Map',
+                       case.lit(settings, case.map(fov.MAP_ISOMETRIC)),
+                       expected)
+            if not case.beam:
+                masks = settings.circle_batch(
+                    [case.map(fov.MAP_ISOMETRIC)],
+                    [(0, case.source_x, case.source_y, case.radius)])
+                self.check(case, 'isometric circle_batch',
+                           mask_cells(masks[0], case.width, case.height),
+                           case.on_map(expected))
+
+    def test_hex_maps(self):
+        # Hex maps always run the hex kernel, so its paths are checked
+        # against each other and against the hex distance
+        for case in self.cases(3):
+            settings = case.settings()
+            expected = case.lit(settings, case.map(fov.MAP_HEX))
+            for q, r in expected:
+                dq, dr = q - case.source_x, r - case.source_y
+                self.assertTrue(
+                    (abs(dq) + abs(dr) + abs(dq + dr)) // 2 <= case.radius,
+                    '%s: hex cell (%d, %d) is out of range' % (case, q, r))
+
+            settings.apply_lighting_function = reference_apply
+            lit = set()
+            case.sweep(settings, case.map(fov.MAP_HEX), lit)
+            self.check(case, 'hex fov.Map with apply_lighting_function',
+                       lit, expected)
+            if not case.beam:
+                masks = settings.circle_batch(
+                    [case.map(fov.MAP_HEX)],
+                    [(0, case.source_x, case.source_y, case.radius)])
+                self.check(case, 'hex circle_batch',
+                           mask_cells(masks[0], case.width, case.height),
+                           case.on_map(expected))
+
+            # Nothing in the way: every cell in range is lit
+            if case.beam:
+                continue
+            open_map = fov.Map(case.width, case.height, fov.MAP_HEX)
+            lit = case.on_map(case.lit(settings, open_map))
+            for r in range(case.height):
+                for q in range(case.width):
+                    dq, dr = q - case.source_x, r - case.source_y
+                    if (dq or dr) and \
+                       (abs(dq) + abs(dr) + abs(dq + dr)) // 2 <= case.radius:
+                        self.assertTrue((q, r) in lit,
+                                        '%s: open hex cell (%d, %d) is dark'
+                                        % (case, q, r))
+
+    def lightmaps(self, case, fill):
+        """
+        Runs `fill(settings, map, lightmap)` on every kind of map of the
+        case, and returns the lightmaps by path
+        """
+        terrain = dict(((x, y), case.rows[y][x]) for y in range(case.height)
+                       for x in range(case.width))
+        runs = [('callbacks', case.reference(), case.rows),
+                ('fov.Map', case.settings(), case.map()),
+                ('fov.DictMap', case.settings(), fov.DictMap(terrain)),
+                ('LOOKUP_ROWS', case.settings(), case.rows),
+                ('LOOKUP_ITEM', case.settings(), terrain)]
+        runs[3][1].lookup = fov.LOOKUP_ROWS
+        runs[4][1].lookup = fov.LOOKUP_ITEM
+        lightmaps = []
+        for path, settings, map in runs:
+            lightmap = array.array('f', [0.0] * (case.width * case.height))
+            fill(settings, map, lightmap)
+            lightmaps.append((path, lightmap))
+        return lightmaps
+
+    def check_lightmaps(self, case, lightmaps):
+        path, expected = lightmaps[0]
+        for path, lightmap in lightmaps[1:]:
+            self.assertEqual(lightmap, expected,
+                             '%s: %s lightmap differs from the callbacks\'' %
+                             (case, path))
+
+    def test_floods(self):
+        rng = random.Random(SEED * 7919 + 4)
+        for case in self.cases(4):
+            sources = [(rng.randrange(case.width), rng.randrange(case.height),
+                        rng.choice([0.5, 1.0, 2.0]))
+                       for i in range(rng.randint(1, 4))]
+            costs = None
+            if rng.randrange(2):
+                costs = bytearray(rng.choice([0, 0, 1, 5])
+                                  for i in range(case.width * case.height))
+            radius = min(case.radius, 30)
+
+            def fill(settings, map, lightmap):
+                settings.flood(map, sources, radius, lightmap, case.width,
+                               costs=costs)
+
+            self.check_lightmaps(case, self.lightmaps(case, fill))
+
+    def test_area_lights(self):
+        rng = random.Random(SEED * 7919 + 5)
+        for case in self.cases(5):
+            if case.engine == fov.ENGINE_PERMISSIVE:
+                continue
+            light_radius = rng.choice([0.0, 0.5, 1.5, 3.0])
+            samples = rng.choice([1, 4, 16])
+            radius = min(case.radius, 20)
+
+            def fill(settings, map, lightmap):
+                settings.area_light(map, case.source_x, case.source_y,
+                                    radius, light_radius, lightmap,
+                                    case.width, samples=samples)
+
+            self.check_lightmaps(case, self.lightmaps(case, fill))
+
+
+if __name__ == '__main__':
+    unittest.main()
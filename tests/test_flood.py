@@ -0,0 +1,27 @@
+"""
+Settings.flood's limits.
+"""
+import array
+import unittest
+
+import fov
+
+
+class FloodTest(unittest.TestCase):
+
+    def test_radius_limit(self):
+        s = fov.Settings()
+        m = fov.Map(4, 4)
+        lightmap = array.array('f', [0.0] * 16)
+        # The window of these radii has more cells than an int counts
+        for radius in [8192, 23170, 2 ** 31, 2 ** 32 - 1]:
+            self.assertRaises(ValueError, s.flood, m, [(1, 1)], radius,
+                              lightmap, 4)
+        self.assertEqual(list(lightmap), [0.0] * 16)
+
+        s.flood(m, [(1, 1)], 3, lightmap, 4)
+        self.assertEqual(lightmap[1 * 4 + 2], 1.0 - 1.0 / 4)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,111 @@
+"""
+Map halos, published and synced within one process.
+"""
+import mmap
+import random
+import unittest
+
+import fov
+
+WIDTH, HEIGHT, HALO = 20, 10, 4
+
+
+def lit(settings, m, x, y, radius, offset=0):
+    cells = set()
+    settings.circle(m, None, x, y, radius, into=cells)
+    return set((cx + offset, cy) for cx, cy in cells)
+
+
+class HaloTest(unittest.TestCase):
+
+    def setUp(self):
+        # A world of two shards side by side
+        rng = random.Random(0)
+        self.world = fov.Map(2 * WIDTH, HEIGHT)
+        self.west = fov.Map(WIDTH, HEIGHT, halo=HALO)
+        self.east = fov.Map(WIDTH, HEIGHT, halo=HALO)
+        for y in range(HEIGHT):
+            for x in range(2 * WIDTH):
+                wall = int(rng.random() < 0.2)
+                self.world[x, y] = wall
+                if x < WIDTH:
+                    self.west[x, y] = wall
+                else:
+                    self.east[x - WIDTH, y] = wall
+        self.settings = fov.Settings()
+        self.settings.opaque_apply = fov.OPAQUE_APPLY
+
+    def edge(self, m, side):
+        return mmap.mmap(-1, m.edge_size(side))
+
+    def test_round_trip(self):
+        west_edge = self.edge(self.west, fov.EAST)
+        east_edge = self.edge(self.east, fov.WEST)
+        self.assertTrue(self.west.publish_edge(fov.EAST, west_edge) > 0)
+        self.assertTrue(self.east.publish_edge(fov.WEST, east_edge) > 0)
+        self.assertTrue(self.east.sync_halo(fov.WEST, west_edge) > 0)
+        self.assertTrue(self.west.sync_halo(fov.EAST, east_edge) > 0)
+
+        # Sweeps within the halo of the border see what the world does, as
+        # far as the shard's own rows go
+        def on_rows(cells):
+            return set((x, y) for x, y in cells if 0 <= y < HEIGHT)
+
+        for y in range(HEIGHT):
+            for x in range(WIDTH - HALO, WIDTH):
+                self.assertEqual(
+                    on_rows(lit(self.settings, self.west, x, y, HALO)),
+                    on_rows(lit(self.settings, self.world, x, y, HALO)),
+                    'west shard from (%d, %d)' % (x, y))
+                self.assertEqual(
+                    on_rows(lit(self.settings, self.east, x - WIDTH + HALO,
+                                y, HALO, WIDTH)),
+                    on_rows(lit(self.settings, self.world, x + HALO, y,
+                                HALO)),
+                    'east shard from (%d, %d)' % (x - WIDTH + HALO, y))
+
+    def test_unchanged_tiles_skipped(self):
+        buf = self.edge(self.west, fov.EAST)
+        self.assertEqual(self.west.publish_edge(fov.EAST, buf), 1)
+        self.assertEqual(self.west.publish_edge(fov.EAST, buf), 0)
+        self.assertEqual(self.east.sync_halo(fov.WEST, buf), 1)
+        self.assertEqual(self.east.sync_halo(fov.WEST, buf), 0)
+
+        # A cell deeper than the halo isn't in the edge
+        self.west[WIDTH - HALO - 1, 3] ^= 1
+        self.assertEqual(self.west.publish_edge(fov.EAST, buf), 0)
+        self.west[WIDTH - 1, 3] ^= 1
+        self.assertEqual(self.west.publish_edge(fov.EAST, buf), 1)
+        self.assertEqual(self.east.sync_halo(fov.WEST, buf), 1)
+        self.assertEqual(self.east.sync_halo(fov.WEST, buf), 0)
+
+    def test_shape_mismatch(self):
+        buf = self.edge(self.west, fov.EAST)
+        self.assertRaises(ValueError, self.west.publish_edge, fov.NORTH, buf)
+        self.assertRaises(ValueError, self.east.sync_halo, fov.NORTH, buf)
+
+        # Neighbours must agree on the halo and their shared edge
+        for m in [fov.Map(WIDTH, HEIGHT, halo=HALO + 1),
+                  fov.Map(WIDTH, HEIGHT + 1, halo=HALO)]:
+            self.assertRaises(ValueError, m.sync_halo, fov.WEST, buf)
+        self.assertRaises(ValueError, self.west.publish_edge, fov.EAST,
+                          mmap.mmap(-1, 1))
+
+    def test_walls_before_sync(self):
+        m = fov.Map(WIDTH, HEIGHT, halo=HALO)
+        cells = lit(self.settings, m, WIDTH - 1, 5, HALO)
+        self.assertTrue((WIDTH, 5) in cells)
+        self.assertFalse((WIDTH + 1, 5) in cells)
+
+        # Once synced from an open neighbour, the halo is seen through
+        neighbour = fov.Map(WIDTH, HEIGHT, halo=HALO)
+        buf = self.edge(neighbour, fov.WEST)
+        neighbour.publish_edge(fov.WEST, buf)
+        m.sync_halo(fov.EAST, buf)
+        cells = lit(self.settings, m, WIDTH - 1, 5, HALO)
+        self.assertTrue((WIDTH + 1, 5) in cells)
+        self.assertTrue((WIDTH + HALO - 2, 5) in cells)
+
+
+if __name__ == '__main__':
+    unittest.main()
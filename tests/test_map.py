@@ -0,0 +1,68 @@
+"""
+fov.Map's buffers and the bitboards cached from them.
+"""
+import ctypes
+import unittest
+
+import fov
+
+
+class MapBufferTest(unittest.TestCase):
+
+    def test_bulk_fill(self):
+        m = fov.Map(8, 8)
+        memoryview(m)[:] = b'\x01' * 64
+        self.assertEqual(m[3, 5], 1)
+        self.assertEqual(bytearray(m), bytearray(b'\x01' * 64))
+
+    def test_old_buffer_protocol_refused(self):
+        # Pointers handed out through it are never released, so the cells
+        # could be freed under them
+        m = fov.Map(64, 64)
+        self.assertRaises(TypeError,
+                          (ctypes.c_ubyte * 4096).from_buffer, m)
+
+    def test_init_refused_while_exported(self):
+        m = fov.Map(64, 64)
+        view = memoryview(m)
+        self.assertRaises(BufferError, m.__init__, 8, 8)
+        del view
+        m.__init__(8, 8)
+        self.assertEqual(m.width, 8)
+
+
+def lit_cells(bits):
+    return set((x, y) for y in range(64) for x in range(64)
+               if bits[y] >> x & 1)
+
+
+class BitboardCacheTest(unittest.TestCase):
+
+    def test_writes_through_buffers(self):
+        s = fov.Settings()
+        m = fov.Map(16, 16)
+        self.assertTrue((12, 8) in lit_cells(s.circle_bits(m, 8, 8, 6)))
+
+        # A wall written through a buffer held across sweeps
+        view = memoryview(m)
+        view[8 * 16 + 10] = b'\x01'
+        lit = lit_cells(s.circle_bits(m, 8, 8, 6))
+        self.assertTrue((10, 8) in lit)
+        self.assertFalse((12, 8) in lit)
+
+        # and one written through that buffer before letting it go
+        view[8 * 16 + 10] = b'\x00'
+        view[8 * 16 + 6] = b'\x01'
+        del view
+        lit = lit_cells(s.circle_bits(m, 8, 8, 6))
+        self.assertTrue((12, 8) in lit)
+        self.assertFalse((4, 8) in lit)
+
+        want = set()
+        s.circle(m, None, 8, 8, 6, into=want)
+        self.assertEqual(lit, set((x, y) for x, y in want
+                                  if 0 <= x < 16 and 0 <= y < 16))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,83 @@
+"""
+fov.metrics_text() in the Prometheus text format.
+"""
+import re
+import unittest
+
+import fov
+
+SAMPLE = re.compile(r'^([a-z_]+)(?:\{([^}]*)\})? (\S+)$')
+LABEL = re.compile(r'([a-z]+)="([^"]*)"')
+
+
+def parse(text):
+    """
+    Returns {(name, labels): value} for the samples of `text`, checking
+    that each belongs to a family declared with HELP and TYPE before it
+    """
+    types, samples = {}, {}
+    for line in text.splitlines():
+        if line.startswith('# HELP '):
+            continue
+        if line.startswith('# TYPE '):
+            name, kind = line.split()[2:]
+            types[name] = kind
+            continue
+        match = SAMPLE.match(line)
+        assert match, 'not a sample: %r' % line
+        name, labels, value = match.groups()
+        family = re.sub(r'_(bucket|sum|count)$', '', name)
+        assert family in types or name in types, 'no TYPE for %s' % name
+        key = (name, tuple(sorted(LABEL.findall(labels or ''))))
+        samples[key] = float(value)
+    return samples
+
+
+class MetricsTest(unittest.TestCase):
+
+    def test_counters_rise(self):
+        s = fov.Settings()
+        m = fov.Map(20, 20)
+        before = parse(fov.metrics_text())
+        lit = s.circle(m, None, 10, 10, 5).lit
+        after = parse(fov.metrics_text())
+
+        def delta(name, **labels):
+            key = (name, tuple(sorted(labels.items())))
+            return after[key] - before[key]
+
+        self.assertEqual(delta('pyfov_calls_total', call='circle'), 1)
+        self.assertEqual(delta('pyfov_calls_total', call='beam'), 0)
+        self.assertEqual(delta('pyfov_sweeps_total', engine='libfov'), 1)
+        self.assertEqual(delta('pyfov_lit_cells_total'), lit)
+        self.assertTrue(delta('pyfov_probes_total') > 0)
+        self.assertEqual(delta('pyfov_call_duration_seconds_count',
+                               call='circle'), 1)
+
+    def test_histogram_buckets_cumulative(self):
+        s = fov.Settings()
+        m = fov.Map(20, 20)
+        for radius in range(10):
+            s.circle(m, None, 10, 10, radius)
+        samples = parse(fov.metrics_text())
+
+        buckets = {}
+        for (name, labels), value in samples.items():
+            if name == 'pyfov_call_duration_seconds_bucket':
+                labels = dict(labels)
+                buckets.setdefault(labels['call'], []).append(
+                    (float(labels['le']), value))
+        self.assertTrue('circle' in buckets)
+        for call, counts in buckets.items():
+            counts.sort()
+            self.assertEqual(counts[-1][0], float('inf'))
+            values = [value for le, value in counts]
+            self.assertEqual(values, sorted(values), call)
+            self.assertEqual(
+                values[-1],
+                samples[('pyfov_call_duration_seconds_count',
+                         (('call', call),))], call)
+
+
+if __name__ == '__main__':
+    unittest.main()
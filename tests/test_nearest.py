@@ -0,0 +1,68 @@
+"""
+Settings.nearest on small hand made maps.
+"""
+import unittest
+
+import fov
+
+
+class NearestTest(unittest.TestCase):
+
+    def setUp(self):
+        self.settings = fov.Settings()
+        self.map = fov.Map(21, 21)
+
+    def test_nearest_first(self):
+        targets = set([(10, 15), (13, 10), (9, 9)])
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, targets,
+                                               k=3),
+                         [(9, 9), (13, 10), (10, 15)])
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, targets),
+                         [(9, 9)])
+
+        mask = bytearray(21 * 21)
+        for x, y in targets:
+            mask[y * 21 + x] = 1
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, mask,
+                                               k=3, width=21),
+                         [(9, 9), (13, 10), (10, 15)])
+
+    def test_ties(self):
+        # Targets as near keep the order the sweep meets them in
+        targets = set([(13, 10), (7, 10), (10, 13), (10, 7)])
+        swept = [cell for cell in self.settings.iter_circle(self.map, 10, 10,
+                                                            5)
+                 if cell in targets]
+        self.assertEqual(len(swept), 4)
+        for k in range(1, 5):
+            self.assertEqual(self.settings.nearest(self.map, 10, 10, 5,
+                                                   targets, k=k),
+                             swept[:k])
+
+    def test_k(self):
+        targets = set([(11, 10), (12, 10), (10, 14)])
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, targets,
+                                               k=2),
+                         [(11, 10), (12, 10)])
+        # Asking for more than there are returns every visible one
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, targets,
+                                               k=100),
+                         [(11, 10), (12, 10), (10, 14)])
+        self.assertRaises(ValueError, self.settings.nearest, self.map, 10,
+                          10, 8, targets, k=0)
+
+    def test_no_target_in_range(self):
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8, set()),
+                         [])
+        # Too far, and behind a wall
+        self.map[10, 11] = 1
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 3,
+                                               set([(17, 10), (10, 12)])),
+                         [])
+        self.assertEqual(self.settings.nearest(self.map, 10, 10, 8,
+                                               set([(17, 10), (10, 12)])),
+                         [(17, 10)])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,86 @@
+"""
+The ordered= output of circle and beam.
+"""
+import array
+import random
+import unittest
+
+import fov
+
+SHAPES = [fov.SHAPE_CIRCLE_PRECALCULATE, fov.SHAPE_SQUARE, fov.SHAPE_CIRCLE,
+          fov.SHAPE_OCTAGON]
+
+
+def distance(shape, dx, dy):
+    major, minor = sorted([abs(dx), abs(dy)], reverse=True)
+    if shape == fov.SHAPE_OCTAGON:
+        return 2 * major + minor
+    if shape == fov.SHAPE_SQUARE:
+        return major
+    return major * major + minor * minor
+
+
+def pairs(buf, count):
+    return [(buf[2 * i], buf[2 * i + 1]) for i in range(count)]
+
+
+class OrderedTest(unittest.TestCase):
+
+    def sweep(self, settings, rows, x, y, radius, beam, **kwargs):
+        if beam:
+            return settings.beam(rows, None, x, y, radius, fov.NORTHEAST,
+                                 120.0, **kwargs)
+        return settings.circle(rows, None, x, y, radius, **kwargs)
+
+    def test_nearest_first(self):
+        rng = random.Random(0)
+        for i in range(100):
+            rows = [[int(rng.random() < 0.2) for x in range(30)]
+                    for y in range(30)]
+            x, y, radius = rng.randrange(30), rng.randrange(30), \
+                rng.randrange(16)
+            beam = rng.randrange(2) == 1
+            s = fov.Settings()
+            s.shape = rng.choice(SHAPES)
+            s.engine = fov.ENGINE_RECURSIVE_SHADOWCAST
+            s.opacity_test_function = lambda m, x, y: \
+                not (0 <= x < 30 and 0 <= y < 30) or m[y][x]
+            lit = []
+            s.apply_lighting_function = \
+                lambda m, x, y, dx, dy, src: lit.append((x, y))
+            buf = array.array('i', [0] * 2 * 4 * (radius + 1) ** 2)
+            result = self.sweep(s, rows, x, y, radius, beam, ordered=buf)
+
+            # The lit cells, sorted by distance, keeping the order they were
+            # lit in at the same distance
+            key = lambda cell: distance(s.shape, cell[0] - x, cell[1] - y)
+            self.assertEqual(result.ordered, result.lit)
+            self.assertEqual(pairs(buf, result.ordered), sorted(lit, key=key))
+
+    def test_short_buffers(self):
+        s = fov.Settings()
+        m = fov.Map(21, 21)
+        full = array.array('i', [0] * 2 * 21 * 21)
+        result = s.circle(m, None, 10, 10, 5, ordered=full)
+        self.assertTrue(result.ordered > 5)
+        nearest = pairs(full, result.ordered)
+
+        # Only whole pairs are written, and the rest of the buffer is left
+        # alone
+        for size in [0, 1, 2, 9, 10]:
+            buf = array.array('i', [-1] * size)
+            result = s.circle(m, None, 10, 10, 5, ordered=buf)
+            self.assertEqual(result.ordered, size // 2)
+            self.assertTrue(result.ordered < result.lit)
+            self.assertEqual(pairs(buf, result.ordered),
+                             nearest[:size // 2])
+            self.assertEqual(list(buf[result.ordered * 2:]),
+                             [-1] * (size % 2))
+
+        self.assertEqual(s.circle(m, None, 10, 10, 5).ordered, None)
+        self.assertRaises(TypeError, s.circle, m, None, 10, 10, 5,
+                          ordered='cells')
+
+
+if __name__ == '__main__':
+    unittest.main()
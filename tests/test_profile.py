@@ -0,0 +1,105 @@
+"""
+fov.load_profile, fov.profile and the PYFOV_PROFILE environment variable.
+"""
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+import fov
+
+
+class ProfileTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.default = self.write('default', fov.profile())
+
+    def tearDown(self):
+        fov.load_profile(self.default)
+        shutil.rmtree(self.dir)
+
+    def write(self, name, text):
+        path = os.path.join(self.dir, name)
+        with open(path, 'w') as f:
+            f.write(text)
+        return path
+
+    def assertBadRule(self, text, lineno):
+        before = fov.profile()
+        path = self.write('bad', text)
+        with self.assertRaises(ValueError) as cm:
+            fov.load_profile(path)
+        self.assertEqual(str(cm.exception),
+                         '%s:%d: bad profile rule' % (path, lineno))
+        self.assertEqual(fov.profile(), before)
+
+    def test_round_trip(self):
+        text = ('# kind radius density engine\n'
+                'bitboard 32 0.05 bitboard\n'
+                'map 8 * recursive\n'
+                'dict 16 0.25 table\n'
+                '* * 0 symmetric\n'
+                '* * * libfov\n')
+        fov.load_profile(self.write('tuned', text))
+        self.assertEqual(fov.profile(), text)
+        fov.load_profile(self.write('again', fov.profile()))
+        self.assertEqual(fov.profile(), text)
+
+    def test_bad_densities(self):
+        for density in ('nan', '-nan', 'inf', '-inf', '-0.5', '1.5', '0.2x'):
+            self.assertBadRule('map 8 0.1 libfov\n* * %s libfov\n' % density,
+                               2)
+
+    def test_bad_fields(self):
+        self.assertBadRule('* * *\n', 1)
+        self.assertBadRule('* * * libfov recursive\n', 1)
+        self.assertBadRule('hex * * libfov\n', 1)
+        self.assertBadRule('* -1 * libfov\n', 1)
+        self.assertBadRule('* * * fast\n', 1)
+
+    def test_long_lines(self):
+        # Split at 255 bytes, this line would read as two good rules
+        line = 'map 8 0.1 libfov'.ljust(255) + '* * * recursive\n'
+        self.assertBadRule('# tuned\n' + line, 2)
+        self.assertBadRule('# ' + 'x' * 300 + '\n* * * libfov\n', 1)
+
+        # A line that just fits is fine, with or without its newline
+        line = 'map 8 0.1 recursive'.ljust(254)
+        fov.load_profile(self.write('fits', line + '\n' + line))
+        self.assertEqual(fov.profile().count('recursive'), 2)
+        fov.load_profile(self.write('last', '* * * libfov\n' + line + ' '))
+        self.assertEqual(fov.profile().count('recursive'), 1)
+
+    def test_environment(self):
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+        code = 'import fov; print fov.profile().count("table")'
+
+        env['PYFOV_PROFILE'] = self.write('env', '* 8 * table\n')
+        child = subprocess.Popen([sys.executable, '-c', code], env=env,
+                                 stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE)
+        out, err = child.communicate()
+        self.assertEqual((child.returncode, out.strip()), (0, '1'), err)
+
+        env['PYFOV_PROFILE'] = self.write('bad', '* 8 inf table\n')
+        child = subprocess.Popen([sys.executable, '-c', code], env=env,
+                                 stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE)
+        out, err = child.communicate()
+        self.assertNotEqual(child.returncode, 0)
+        self.assertIn('bad:1: bad profile rule', err)
+
+        env['PYFOV_PROFILE'] = os.path.join(self.dir, 'missing')
+        child = subprocess.Popen([sys.executable, '-c', code], env=env,
+                                 stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE)
+        out, err = child.communicate()
+        self.assertNotEqual(child.returncode, 0)
+        self.assertIn('IOError', err)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,73 @@
+"""
+fov.set_slow_log and fov.slow_log.
+"""
+import unittest
+
+import fov
+
+
+class SlowLogTest(unittest.TestCase):
+
+    def setUp(self):
+        self.settings = fov.Settings()
+        self.map = fov.Map(30, 30)
+
+    def tearDown(self):
+        fov.set_slow_log(0)
+
+    def test_ring_wraps(self):
+        # Every call takes at least a nanosecond
+        fov.set_slow_log(1, capacity=3)
+        for radius in range(1, 6):
+            self.settings.circle(self.map, None, 15, 15, radius)
+        entries = fov.slow_log()
+        self.assertEqual([entry['radius'] for entry in entries], [3, 4, 5])
+        self.assertEqual(entries[0]['call'], 'circle')
+        self.assertEqual(entries[0]['map_type'], 'fov.Map')
+
+        self.settings.beam(self.map, None, 15, 15, 6, fov.EAST, 90.0)
+        self.settings.circle_batch([self.map], [(0, 15, 15, 7)])
+        self.assertEqual([(entry['call'], entry['radius'])
+                          for entry in fov.slow_log()],
+                         [('circle', 5), ('beam', 6), ('circle_batch', 7)])
+
+    def test_clear(self):
+        fov.set_slow_log(1)
+        self.settings.circle(self.map, None, 15, 15, 4)
+        self.settings.circle(self.map, None, 15, 15, 5)
+        self.assertEqual(len(fov.slow_log(clear=True)), 2)
+        self.assertEqual(fov.slow_log(), [])
+        self.settings.circle(self.map, None, 15, 15, 6)
+        self.assertEqual([entry['radius'] for entry in fov.slow_log()], [6])
+
+        # Turning the log off stops logging
+        fov.set_slow_log(0)
+        self.settings.circle(self.map, None, 15, 15, 7)
+        self.assertEqual(fov.slow_log(), [])
+
+    def test_hook(self):
+        seen = []
+        fov.set_slow_log(1, hook=seen.append)
+        self.settings.circle(self.map, None, 15, 15, 4)
+        self.assertEqual(seen, fov.slow_log())
+
+    def test_hook_replaces_itself(self):
+        # The log holds the only reference to the hook, which it drops
+        # while the hook runs
+        seen = []
+
+        def make_hook():
+            def hook(entry):
+                fov.set_slow_log(1, hook=None)
+                seen.append(entry['radius'])
+            return hook
+
+        fov.set_slow_log(1, hook=make_hook())
+        self.settings.circle(self.map, None, 15, 15, 4)
+        self.settings.circle(self.map, None, 15, 15, 5)
+        self.assertEqual(seen, [4])
+        self.assertEqual([entry['radius'] for entry in fov.slow_log()], [5])
+
+
+if __name__ == '__main__':
+    unittest.main()
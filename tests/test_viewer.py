@@ -0,0 +1,99 @@
+"""
+fov.Viewer as its radius grows and shrinks.
+"""
+import random
+import unittest
+
+import fov
+
+SHAPES = [fov.SHAPE_CIRCLE_PRECALCULATE, fov.SHAPE_SQUARE, fov.SHAPE_CIRCLE,
+          fov.SHAPE_OCTAGON]
+
+
+def random_map(rng, size, walls):
+    m = fov.Map(size, size)
+    for i in range(walls):
+        m[rng.randrange(size), rng.randrange(size)] = 1
+    return m
+
+
+class ViewerTest(unittest.TestCase):
+
+    def test_cells_enter_and_leave(self):
+        s = fov.Settings()
+        m = fov.Map(21, 21)
+        v = fov.Viewer(s, m, 10, 10, 3)
+        self.assertTrue((12, 10) in v)
+        self.assertFalse((15, 10) in v)
+        v.radius = 6
+        self.assertTrue((12, 10) in v)
+        self.assertTrue((15, 10) in v)
+        v.radius = 3
+        self.assertTrue((12, 10) in v)
+        self.assertFalse((15, 10) in v)
+
+        # A wall put up after the sweep only counts once refreshed
+        m[11, 10] = 1
+        self.assertTrue((12, 10) in v)
+        v.refresh()
+        self.assertFalse((12, 10) in v)
+
+    def test_rewind_matches_fresh_sweep(self):
+        rng = random.Random(0)
+        for shape in SHAPES:
+            s = fov.Settings()
+            s.shape = shape
+            for i in range(20):
+                m = random_map(rng, 40, 200)
+                x, y = rng.randrange(40), rng.randrange(40)
+                v = fov.Viewer(s, m, x, y, rng.randrange(16))
+                for j in range(10):
+                    radius = rng.randrange(16)
+                    v.radius = radius
+                    self.assertEqual(
+                        list(v), list(s.iter_circle(m, x, y, radius)),
+                        'shape %d from (%d, %d), radius %d' %
+                        (shape, x, y, radius))
+
+    def test_watched(self):
+        s = fov.Settings()
+        m = fov.Map(21, 21)
+        watch = [(12, 10), (15, 10), (10, 3)]
+        v = fov.Viewer(s, m, 10, 10, 3, watch=watch)
+        self.assertEqual(v.watched, [(12, 10)])
+        v.radius = 6
+        self.assertEqual(v.watched, [(15, 10)])
+        v.radius = 3
+        self.assertEqual(v.watched, [])
+        v.radius = 8
+        self.assertEqual(sorted(v.watched), [(10, 3), (15, 10)])
+
+        # Cells lit all along aren't reported again
+        v.refresh()
+        self.assertEqual(v.watched, [])
+
+    def test_watched_is_what_came_into_view(self):
+        rng = random.Random(1)
+        s = fov.Settings()
+        for i in range(50):
+            m = random_map(rng, 30, 150)
+            watch = set((rng.randrange(30), rng.randrange(30))
+                        for j in range(200))
+            v = fov.Viewer(s, m, 15, 15, rng.randrange(12), watch=watch)
+            before = set(v)
+            self.assertEqual(set(v.watched), before & watch)
+            for j in range(10):
+                if rng.randrange(3) == 0:
+                    m[rng.randrange(30), rng.randrange(30)] = \
+                        rng.randrange(2)
+                    v.refresh()
+                else:
+                    v.radius = rng.randrange(14)
+                now = set(v)
+                self.assertEqual(sorted(v.watched),
+                                 sorted((now - before) & watch))
+                before = now
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,142 @@
+"""
+fov.WatchSet, and the watched cells sweeps report.
+"""
+import random
+import unittest
+
+import fov
+
+
+def home(x, y, size=16):
+    """The slot (x, y) hashes to in a WatchSet of `size` slots"""
+    m = 0xffffffff
+    h = ((x & m) * 0x9e3779b1 & m) ^ ((y & m) * 0x85ebca77 & m)
+    h ^= h >> 15
+    h = h * 0xc2b2ae3d & m
+    h ^= h >> 13
+    return h & (size - 1)
+
+
+def colliding(slot, count):
+    """`count` cells that all hash to `slot` of a 16 slot WatchSet"""
+    cells = []
+    for y in range(-64, 64):
+        for x in range(-64, 64):
+            if home(x, y) == slot:
+                cells.append((x, y))
+                if len(cells) == count:
+                    return cells
+
+
+class WatchSetTest(unittest.TestCase):
+
+    def test_add_discard(self):
+        w = fov.WatchSet([(1, 2), (3, 4)])
+        w.add(5, 6)
+        w.add(1, 2)
+        self.assertEqual(len(w), 3)
+        self.assertEqual(sorted(w), [(1, 2), (3, 4), (5, 6)])
+        w.discard(3, 4)
+        w.discard(7, 8)
+        self.assertFalse((3, 4) in w)
+        self.assertTrue((1, 2) in w)
+        self.assertFalse('cell' in w)
+        self.assertEqual(len(w), 2)
+        w.clear()
+        self.assertEqual(len(w), 0)
+        self.assertFalse((1, 2) in w)
+
+    def test_discard_colliding(self):
+        # A run of cells from one slot, then one from the next slot that
+        # lands at the end of the run.  Discards shift later cells of the
+        # run back into the hole, and none may be lost.
+        a, b, c = colliding(3, 3)
+        d = colliding(4, 1)[0]
+        w = fov.WatchSet([a, b, c, d])
+        # Cells iterate in slot order, so this checks home() too
+        self.assertEqual(list(w), [a, b, c, d])
+        w.discard(*a)
+        self.assertFalse(a in w)
+        for cell in [b, c, d]:
+            self.assertTrue(cell in w, cell)
+        w.discard(*c)
+        self.assertFalse(c in w)
+        self.assertTrue(b in w)
+        self.assertTrue(d in w)
+        w.add(*a)
+        self.assertEqual(sorted(w), sorted([a, b, d]))
+
+        # A run that wraps past the last slot
+        cells = colliding(15, 4)
+        w = fov.WatchSet(cells)
+        self.assertEqual(list(w), cells[1:] + cells[:1])
+        for i, cell in enumerate(cells):
+            w.discard(*cell)
+            self.assertFalse(cell in w)
+            for rest in cells[i + 1:]:
+                self.assertTrue(rest in w, rest)
+
+    def test_against_set(self):
+        rng = random.Random(0)
+        pool = colliding(0, 6) + colliding(1, 6) + colliding(15, 6)
+        w, want = fov.WatchSet(), set()
+        for i in range(3000):
+            cell = rng.choice(pool)
+            if rng.randrange(2):
+                w.add(*cell)
+                want.add(cell)
+            else:
+                w.discard(*cell)
+                want.discard(cell)
+            self.assertEqual(len(w), len(want))
+            for cell in pool:
+                self.assertEqual(cell in w, cell in want, cell)
+        self.assertEqual(sorted(w), sorted(want))
+
+
+class WatchedTest(unittest.TestCase):
+
+    def setUp(self):
+        self.settings = fov.Settings()
+        self.map = fov.Map(21, 21)
+        self.map[12, 10] = 1
+        # In sight, lit wall, behind the wall, and out of range
+        self.watch = fov.WatchSet([(10, 13), (12, 10), (14, 10), (10, 20)])
+
+    def test_circle(self):
+        lit = set()
+        result = self.settings.circle(self.map, None, 10, 10, 6, into=lit,
+                                      watch=self.watch)
+        self.assertEqual(sorted(result.watched), [(10, 13), (12, 10)])
+        self.assertEqual(set(result.watched), lit & set(self.watch))
+        self.assertEqual(self.settings.circle(self.map, None, 10, 10, 6,
+                                              watch=[(14, 10)]).watched, [])
+
+        mask = bytearray(21 * 21)
+        mask[13 * 21 + 10] = 1
+        self.assertEqual(self.settings.circle(self.map, None, 10, 10, 6,
+                                              watch=mask, width=21).watched,
+                         [(10, 13)])
+
+    def test_beam(self):
+        # The native engines' cones don't depend on the libfov build
+        self.settings.engine = fov.ENGINE_RECURSIVE_SHADOWCAST
+        result = self.settings.beam(self.map, None, 10, 10, 6, fov.EAST,
+                                    90.0, watch=self.watch)
+        self.assertEqual(result.watched, [(12, 10)])
+        result = self.settings.beam(self.map, None, 10, 10, 6, fov.SOUTH,
+                                    90.0, watch=self.watch)
+        self.assertEqual(result.watched, [(10, 13)])
+
+    def test_circle_batch(self):
+        watched = []
+        self.settings.circle_batch([self.map],
+                                   [(0, 10, 10, 6), (0, 10, 19, 2),
+                                    (0, 0, 0, 3)],
+                                   threads=2, watch=self.watch,
+                                   watched=watched)
+        self.assertEqual(watched, [[(12, 10), (10, 13)], [(10, 20)], []])
+
+
+if __name__ == '__main__':
+    unittest.main()